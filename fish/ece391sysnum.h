@@ -11,5 +11,27 @@
 #define SYS_VIDMAP  8
 #define SYS_SET_HANDLER  9
 #define SYS_SIGRETURN  10
+#define SYS_NICE    11
+#define SYS_TIMESLICE 12
+#define SYS_FORK    13
+#define SYS_SPAWN   14
+#define SYS_WAITPID 15
+#define SYS_PROCINFO 16
+#define SYS_SLEEP   17
+#define SYS_CLOCK_GETTIME 18
+#define SYS_ALARM   19
+#define SYS_SHM_CREATE 20
+#define SYS_SHM_ATTACH 21
+#define SYS_IPC_SEND 22
+#define SYS_IPC_RECEIVE 23
+#define SYS_IPC_CALL 24
+#define SYS_TERMWEIGHT 25
+#define SYS_YIELD 26
+#define SYS_SCHED_SETPARAM 27
+#define SYS_BRK 28
+#define SYS_SBRK 29
+#define SYS_MMAP 30
+#define SYS_MUNMAP 31
+#define SYS_KILL 32
 
 #endif /* ECE391SYSNUM_H */
@@ -0,0 +1,260 @@
+/* apic.c - Implements the local APIC, the per-CPU interrupt controller that CPUs use
+ * to send each other interrupts and that has its own timer, and the IOAPIC, which
+ * routes device interrupts to the local APICs.
+ * Compared to the 8259s, acknowledging an interrupt is a single memory write instead
+ * of one or two slow port writes, and the local APIC timer is programmed with one
+ * register write too, so starting a time slice on every context switch gets cheap. */
+
+#include "apic.h"
+#include "i8259.h"
+#include "idt.h"
+#include "ktime.h"
+#include "lib.h"
+#include "mm.h"
+#include "sched.h"
+#include "smp.h"
+#include "x86_desc.h"
+
+/* CPUID.1:EDX APIC feature bit */
+#define CPUID_APIC (1 << 9)
+/* give up waiting for an IPI to be accepted after this many polls */
+#define LAPIC_IPI_POLLS 1000000
+/* the APIC timer counts down at the bus clock divided by 16 */
+#define LAPIC_TIMER_DIV_16 0x3
+/* how long to count APIC timer ticks for when calibrating it */
+#define LAPIC_CALIBRATE_MS 10
+
+int apic_in_use = 0;
+int apic_timer_in_use = 0;
+
+/* virtual (= physical) addresses of the local APIC's and IOAPIC's registers, NULL
+ * until mapped */
+static volatile uint32_t *lapic_regs = NULL;
+static volatile uint32_t *ioapic_regs = NULL;
+/* APIC timer ticks per millisecond */
+static uint32_t lapic_timer_khz = 0;
+/* whether a time slice is counting down on the APIC timer */
+static int apic_timer_armed = 0;
+
+/* lapic_present
+ * See apic.h.
+ * Return value: 1 if there is a local APIC, 0 otherwise */
+int lapic_present(void) {
+    uint32_t eax, ebx, ecx, edx;
+    asm volatile("cpuid"
+        : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+        : "a"(1));
+    return !!(edx & CPUID_APIC);
+}
+
+/* apic_mmio_map
+ * Identity maps the 4MiB containing some device registers into the kernel page
+ * directory, uncached.
+ * Inputs: base - physical address of the registers
+ * Side effects: Adds a global uncached 4MiB page to the kernel page directory */
+static void apic_mmio_map(uint32_t base) {
+    pd_ent_t pd_ent;
+    pd_ent.val = 0; /* zero initialize reserved fields */
+    pd_ent.present = 1;
+    pd_ent.write_enable = 1;
+    pd_ent.user_access = 0;
+    pd_ent.write_through = 1;
+    pd_ent.cache_disable = 1; /* registers, not memory */
+    pd_ent.page_size = 1;
+    pd_ent.global = 1;
+    pd_ent.base_4m = base >> 22;
+    kernel_page_dir[base >> 22] = pd_ent;
+    write_cr3(read_cr3());
+}
+
+/* lapic_map
+ * See apic.h.
+ * Inputs: base - physical address of the local APIC's registers
+ * Side effects: Maps the registers */
+void lapic_map(uint32_t base) {
+    apic_mmio_map(base);
+    lapic_regs = (volatile uint32_t*) base;
+}
+
+/* lapic_read
+ * Inputs: reg - register offset
+ * Return value: the register's value */
+uint32_t lapic_read(uint32_t reg) {
+    return lapic_regs[reg / sizeof(uint32_t)];
+}
+
+/* lapic_write
+ * Inputs: reg - register offset
+ *         val - value to write */
+void lapic_write(uint32_t reg, uint32_t val) {
+    lapic_regs[reg / sizeof(uint32_t)] = val;
+}
+
+/* lapic_id
+ * Return value: the current CPU's local APIC ID, 0 without a mapped local APIC */
+uint32_t lapic_id(void) {
+    if(!lapic_regs) return 0;
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+/* lapic_send_ipi
+ * See apic.h.
+ * Inputs: apic_id - destination local APIC ID
+ *         icr - low half of the interrupt command
+ * Side effects: Interrupts the destination CPU */
+void lapic_send_ipi(uint32_t apic_id, uint32_t icr) {
+    uint32_t flags, polls = 0;
+    cli_and_save(flags);
+    lapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+    /* writing the low half sends it */
+    lapic_write(LAPIC_ICR_LOW, icr);
+    while((lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING) && polls < LAPIC_IPI_POLLS)
+        ++polls;
+    restore_flags(flags);
+}
+
+/* ioapic_read / ioapic_write
+ * Access an IOAPIC register. Interrupts must be disabled, since selecting the register
+ * and accessing it are separate steps. */
+static uint32_t ioapic_read(uint32_t reg) {
+    ioapic_regs[IOAPIC_REGSEL / sizeof(uint32_t)] = reg;
+    return ioapic_regs[IOAPIC_WINDOW / sizeof(uint32_t)];
+}
+static void ioapic_write(uint32_t reg, uint32_t val) {
+    ioapic_regs[IOAPIC_REGSEL / sizeof(uint32_t)] = reg;
+    ioapic_regs[IOAPIC_WINDOW / sizeof(uint32_t)] = val;
+}
+
+/* ioapic_route
+ * Points the IOAPIC pin an ISA IRQ is wired to at the BSP, on the same vector the 8259
+ * would have used, with the polarity and trigger mode the MP table gave.
+ * Inputs: irq - ISA IRQ, 0-15
+ *         masked - nonzero to leave it masked
+ * Interrupts must be disabled. */
+static void ioapic_route(uint32_t irq, int masked) {
+    uint32_t pin = smp_isa_irq_pin[irq], flags = smp_isa_irq_flags[irq];
+    uint32_t entry = ICW2_MASTER + irq;
+    if((flags & MP_IRQ_POLARITY_MASK) == MP_IRQ_ACTIVE_LOW) entry |= IOAPIC_ACTIVE_LOW;
+    if((flags & MP_IRQ_TRIGGER_MASK) == MP_IRQ_LEVEL) entry |= IOAPIC_LEVEL;
+    if(masked) entry |= IOAPIC_MASKED;
+    /* physical destination mode, fixed delivery */
+    ioapic_write(IOAPIC_REDTBL + 2 * pin + 1, cpus[0].apic_id << 24);
+    ioapic_write(IOAPIC_REDTBL + 2 * pin, entry);
+}
+
+/* ioapic_set_masked
+ * See apic.h.
+ * Inputs: irq - ISA IRQ, 0-15
+ *         masked - nonzero to mask, zero to unmask
+ * Side effects: Writes to the IOAPIC */
+void ioapic_set_masked(uint32_t irq, int masked) {
+    uint32_t flags;
+    if(irq >= ISA_NUM_IRQS) panic_msg("irq_num %d outside of valid range!", irq);
+    cli_and_save(flags);
+    ioapic_route(irq, masked);
+    restore_flags(flags);
+}
+
+/* apic_timer_handler
+ * Handles the end of a time slice on the APIC timer.
+ * Inputs: irq - APIC_TIMER_IRQ
+ * Return value: 1, handled
+ * Side effects: Has irq_handler call the scheduler if something else can run. A
+ *               process running alone gets no more interrupts until apic_timer_kick. */
+static int apic_timer_handler(uint32_t irq) {
+    send_eoi(irq);
+    apic_timer_armed = 0;
+    if(sched_nr_running() > 1) sched_need_resched = 1;
+    return 1;
+}
+
+/* apic_timer_calibrate
+ * Return value: APIC timer ticks per millisecond, measured against the TSC, 0 if it
+ *               doesn't seem to count
+ * Side effects: Spins for LAPIC_CALIBRATE_MS, leaves the timer stopped */
+static uint32_t apic_timer_calibrate(void) {
+    uint32_t ticks;
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED | (ICW2_MASTER + APIC_TIMER_IRQ));
+    lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+    tsc_delay_us(LAPIC_CALIBRATE_MS * 1000);
+    ticks = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CURRENT);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+    return ticks / LAPIC_CALIBRATE_MS;
+}
+
+/* apic_init
+ * See apic.h.
+ * Inputs: none
+ * Return value: none
+ * Side effects: Maps the IOAPIC, masks the 8259s, enables the local APIC */
+void apic_init(void) {
+    uint32_t flags, max_pin, irq;
+    uint16_t enabled;
+    static irq_handler_node_t apic_timer_node = IRQ_HANDLER_NODE_INIT;
+    if(!lapic_regs || !smp_ioapic_addr || !tsc_khz) {
+        log_msg("apic: no IOAPIC, staying on the 8259");
+        return;
+    }
+    cli_and_save(flags);
+    apic_mmio_map(smp_ioapic_addr);
+    ioapic_regs = (volatile uint32_t*) smp_ioapic_addr;
+    max_pin = (ioapic_read(IOAPIC_VERSION) >> 16) & 0xFF;
+    for(irq = 0; irq < ISA_NUM_IRQS; ++irq) {
+        if(smp_isa_irq_pin[irq] > max_pin) {
+            restore_flags(flags);
+            log_msg("apic: irq %u wired to missing pin %u, staying on the 8259",
+                    irq, smp_isa_irq_pin[irq]);
+            return;
+        }
+    }
+
+    /* accept every priority, and turn the local APIC on. LINT0 is the 8259's virtual
+     * wire, which isn't needed anymore */
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+    lapic_write(LAPIC_LVT_LINT0, LAPIC_LVT_MASKED);
+
+    /* mask every pin, then bring over the IRQs that were on, cascade aside */
+    for(irq = 0; irq <= max_pin; ++irq) {
+        ioapic_write(IOAPIC_REDTBL + 2 * irq + 1, 0);
+        ioapic_write(IOAPIC_REDTBL + 2 * irq, IOAPIC_MASKED);
+    }
+    enabled = i8259_handoff();
+    apic_in_use = 1;
+    for(irq = 0; irq < ISA_NUM_IRQS; ++irq) {
+        if(irq != 2) ioapic_route(irq, !(enabled & (1 << irq)));
+    }
+
+    if((lapic_timer_khz = apic_timer_calibrate()) != 0) {
+        apic_timer_node.handler = &apic_timer_handler;
+        irq_register_handler(APIC_TIMER_IRQ, &apic_timer_node);
+        /* one-shot mode, unmasked */
+        lapic_write(LAPIC_LVT_TIMER, ICW2_MASTER + APIC_TIMER_IRQ);
+        apic_timer_in_use = 1;
+    }
+    restore_flags(flags);
+    log_msg("apic: irqs through the IOAPIC, timer at %u kHz", lapic_timer_khz);
+}
+
+/* apic_timer_start
+ * See apic.h.
+ * Inputs: ms - length of the time slice in milliseconds
+ * Return value: 0 on success, -1 without the APIC timer
+ * Side effects: Writes to the local APIC */
+int32_t apic_timer_start(uint32_t ms) {
+    uint32_t ticks;
+    if(!apic_timer_in_use) return -1;
+    ticks = ms > 0xFFFFFFFF / lapic_timer_khz ? 0xFFFFFFFF : ms * lapic_timer_khz;
+    lapic_write(LAPIC_TIMER_INIT, ticks ? ticks : 1);
+    apic_timer_armed = 1;
+    return 0;
+}
+
+/* apic_timer_kick
+ * See apic.h.
+ * Inputs: ms - length of the time slice in milliseconds
+ * Side effects: Might write to the local APIC */
+void apic_timer_kick(uint32_t ms) {
+    if(!apic_timer_armed) apic_timer_start(ms);
+}
@@ -0,0 +1,124 @@
+/* apic.h - Definitions for the local APIC and the IOAPIC */
+
+#ifndef _APIC_H
+#define _APIC_H
+
+#include "types.h"
+
+/* where the local APIC's registers are unless the MP table says otherwise. the 4MiB
+ * page mapping them also covers the IOAPIC at 0xFEC00000 */
+#define LAPIC_DEFAULT_BASE 0xFEE00000
+
+/* local APIC register offsets, x86 ISA manual vol 3 section 10.4.1 */
+#define LAPIC_ID 0x020
+#define LAPIC_VERSION 0x030
+#define LAPIC_TPR 0x080
+#define LAPIC_EOI 0x0B0
+#define LAPIC_SVR 0x0F0
+#define LAPIC_ESR 0x280
+#define LAPIC_ICR_LOW 0x300
+#define LAPIC_ICR_HIGH 0x310
+#define LAPIC_LVT_TIMER 0x320
+#define LAPIC_LVT_LINT0 0x350
+#define LAPIC_LVT_LINT1 0x360
+#define LAPIC_TIMER_INIT 0x380
+#define LAPIC_TIMER_CURRENT 0x390
+#define LAPIC_TIMER_DIVIDE 0x3E0
+
+/* interrupt command register bits, for sending IPIs */
+#define LAPIC_ICR_INIT 0x00000500
+#define LAPIC_ICR_STARTUP 0x00000600
+#define LAPIC_ICR_PENDING 0x00001000
+#define LAPIC_ICR_ASSERT 0x00004000
+#define LAPIC_ICR_LEVEL 0x00008000
+
+/* spurious interrupt vector register: software enable bit, and the vector, whose low
+ * 4 bits have to be set on older APICs. idtasm.S has a handler that just returns */
+#define LAPIC_SVR_ENABLE 0x100
+#define LAPIC_SPURIOUS_VECTOR 0xFF
+/* mask bit of the local vector table entries */
+#define LAPIC_LVT_MASKED 0x10000
+
+/* the local APIC timer goes through irq_handler like the ISA IRQs do, as the IRQ right
+ * after them, on vector 0x30 */
+#define APIC_TIMER_IRQ 16
+
+/* IOAPIC registers, accessed indirectly through the select and window registers */
+#define IOAPIC_REGSEL 0x00
+#define IOAPIC_WINDOW 0x10
+#define IOAPIC_VERSION 0x01
+#define IOAPIC_REDTBL 0x10
+/* redirection table entry bits */
+#define IOAPIC_ACTIVE_LOW 0x2000
+#define IOAPIC_LEVEL 0x8000
+#define IOAPIC_MASKED 0x10000
+
+#ifndef ASM
+
+/* whether the ISA IRQs go through the IOAPIC, with the 8259s masked. enable_irq,
+ * disable_irq and send_eoi check this */
+extern int apic_in_use;
+/* whether the local APIC timer ends time slices, instead of the PIT */
+extern int apic_timer_in_use;
+
+/* lapic_present
+ * Return value: whether the CPU has a local APIC, according to CPUID */
+int lapic_present(void);
+
+/* lapic_map
+ * Maps the local APIC's registers (and the IOAPIC's) into the kernel page directory,
+ * uncached. Has to happen before any process gets a page directory, see
+ * page_dir_create. */
+void lapic_map(uint32_t base);
+
+/* lapic_read / lapic_write
+ * Access a local APIC register of the current CPU. */
+uint32_t lapic_read(uint32_t reg);
+void lapic_write(uint32_t reg, uint32_t val);
+
+/* lapic_id
+ * Return value: the local APIC ID of the current CPU */
+uint32_t lapic_id(void);
+
+/* lapic_send_ipi
+ * Sends an interprocessor interrupt, waiting for the APIC to accept it.
+ * Inputs: apic_id - destination CPU
+ *         icr - the command, i.e. LAPIC_ICR_INIT or LAPIC_ICR_STARTUP plus flags */
+void lapic_send_ipi(uint32_t apic_id, uint32_t icr);
+
+/* apic_init
+ * Moves interrupt handling off the 8259s and onto the local APIC and IOAPIC, if
+ * smp_init found both: every ISA IRQ the 8259s had enabled gets routed through the
+ * IOAPIC to the BSP on the same vector, and the 8259s get masked for good. Also
+ * calibrates the local APIC timer against the TSC, from then on it ends time slices.
+ * Without an APIC (or with the noapic boot option) everything stays on the 8259s and
+ * the PIT. Has to run with interrupts off, after smp_init. */
+void apic_init(void);
+
+/* lapic_eoi
+ * Acknowledges the interrupt being handled, a single register write */
+static inline void lapic_eoi(void) {
+    lapic_write(LAPIC_EOI, 0);
+}
+
+/* ioapic_set_masked
+ * Masks or unmasks the IOAPIC pin an ISA IRQ is wired to.
+ * Inputs: irq - ISA IRQ, 0-15
+ *         masked - nonzero to mask it */
+void ioapic_set_masked(uint32_t irq, int masked);
+
+/* apic_timer_start
+ * Starts a time slice of ms milliseconds on the local APIC timer, replacing the one
+ * running. Once it runs out, the current process gets preempted if something else is
+ * runnable. Interrupts must be disabled.
+ * Return value: 0 on success, -1 if the APIC timer isn't in use */
+int32_t apic_timer_start(uint32_t ms);
+
+/* apic_timer_kick
+ * Starts a time slice of ms milliseconds if none is running, for when a second process
+ * becomes runnable while the first's slice already ran out. Interrupts must be
+ * disabled. */
+void apic_timer_kick(uint32_t ms);
+
+#endif /* ASM */
+#endif /* _APIC_H */
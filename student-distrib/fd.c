@@ -25,7 +25,9 @@ int32_t syscall_read(int32_t fd, int32_t arg2, int32_t nbytes) {
 
     if(!fd_info->present) return -1;
 
-    return fd_info->file_ops->read(fd_info, buf, nbytes);
+    int32_t ret = fd_info->file_ops->read(fd_info, buf, nbytes);
+    if(ret > 0) get_current_pcb()->stats.bytes_read += ret;
+    return ret;
 }
 
 /* syscall_write
@@ -46,7 +48,9 @@ int32_t syscall_write(int32_t fd, int32_t arg2, int32_t nbytes) {
 
     if(!fd_info->present) return -1;
 
-    return fd_info->file_ops->write(fd_info, buf, nbytes);
+    int32_t ret = fd_info->file_ops->write(fd_info, buf, nbytes);
+    if(ret > 0) get_current_pcb()->stats.bytes_written += ret;
+    return ret;
 }
 
 /* syscall_open
@@ -73,6 +73,16 @@ typedef int32_t fd_read_t(fd_info_t *fd_info, void *buf, int32_t nbytes);
  *               of ours will as far as I know) */
 typedef int32_t fd_write_t(fd_info_t *fd_info, const void *buf, int32_t nbytes);
 
+/* fd_dup_t
+ * Optional, for drivers that keep track of their open file descriptors. Called after
+ * new_fd has been copied from old_fd (i.e. by fork), to register the copy as open too.
+ * Drivers without it get a plain copy of the fd_info_t.
+ * Inputs: new_fd -- the copy, driver_data and all
+ *         old_fd -- the original file descriptor, still open
+ * Return value: 0 on success, -1 on error
+ * Side effects: depends on driver */
+typedef int32_t fd_dup_t(fd_info_t *new_fd, fd_info_t *old_fd);
+
 /* static structs for function pointers to a given fd driver's API */
 /* fd_driver_t
  * A struct containing function pointers to each of the driver file descriptor operations.
@@ -82,6 +92,7 @@ struct fd_driver_t {
     fd_close_t *close;
     fd_read_t *read;
     fd_write_t *write;
+    fd_dup_t *dup;
 };
 
 #endif /* ASM */
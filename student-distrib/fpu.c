@@ -0,0 +1,182 @@
+/* fpu.c - Lazy x87/SSE state switching.
+ * The FPU registers are only swapped when a process actually uses them. Switching to a
+ * process whose state isn't loaded sets CR0.TS, which makes its next FPU/SSE instruction
+ * raise #NM (device not available, vector 7). The #NM handler saves the registers into
+ * the previous owner's PCB, loads the current process's, clears TS and lets the
+ * instruction run again. Processes that never touch the FPU never pay for it. */
+
+#include "fpu.h"
+#include "idt.h"
+#include "lib.h"
+#include "process.h"
+#include "x86_desc.h"
+
+#define FPU_NM_VECTOR 7
+/* CPUID.1:EDX feature bits */
+#define CPUID_FPU (1 << 0)
+#define CPUID_FXSR (1 << 24)
+#define CPUID_SSE (1 << 25)
+/* byte offset of MXCSR in an FXSAVE image */
+#define FXSAVE_MXCSR_OFFSET 24
+
+pcb_t *fpu_owner = NULL;
+/* whether we can use FXSAVE/FXRSTOR, otherwise falls back to FNSAVE/FRSTOR */
+static int fpu_has_fxsr = 0;
+/* the register state right after fninit, loaded into a process on its first FPU use */
+static fpu_state_t fpu_init_state;
+
+static int fpu_nm_handler(uint32_t vect, iret_context_base_t *context);
+
+/* clts/stts
+ * Clear/set CR0.TS. With TS clear, FPU instructions run normally. */
+static inline void clts(void) {
+    asm volatile("clts" ::: "memory");
+}
+static inline void stts(void) {
+    cr0_t cr0 = read_cr0();
+    if(cr0.task_switched) return;
+    cr0.task_switched = 1;
+    write_cr0(cr0);
+}
+
+/* fpu_save
+ * Saves the FPU registers into state. FNSAVE also reinitializes the FPU, which doesn't
+ * matter since the registers get overwritten right after anyways.
+ * Side effects: TS must be clear */
+static void fpu_save(fpu_state_t *state) {
+    if(fpu_has_fxsr) asm volatile("fxsave %0" : "=m"(*state) :: "memory");
+    else asm volatile("fnsave %0" : "=m"(*state) :: "memory");
+}
+
+/* fpu_restore
+ * Loads the FPU registers from state.
+ * Side effects: TS must be clear */
+static void fpu_restore(fpu_state_t *state) {
+    if(fpu_has_fxsr) asm volatile("fxrstor %0" :: "m"(*state) : "memory");
+    else asm volatile("frstor %0" :: "m"(*state) : "memory");
+}
+
+/* fpu_init
+ * Enables the FPU for lazy switching: CR0.EM off so FPU instructions aren't emulated,
+ * MP on so WAIT respects TS too, NE on for native #MF error reporting, and with SSE,
+ * CR4.OSFXSR/OSXMMEXCPT so SSE instructions and #XM exceptions are allowed.
+ * Inputs: none
+ * Outputs: none
+ * Return value: none
+ * Side effects: Writes CR0/CR4, registers the #NM handler, sets TS.
+ */
+void fpu_init(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cr0_t cr0;
+    cr4_t cr4;
+    asm volatile("cpuid"
+        : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+        : "a"(1));
+
+    cr0 = read_cr0();
+    if(!(edx & CPUID_FPU)) {
+        /* no FPU at all, leave FPU instructions raising #NM, which kills the process */
+        cr0.emulation = 1;
+        write_cr0(cr0);
+        log_msg("fpu: no x87 FPU present");
+        return;
+    }
+    cr0.emulation = 0;
+    cr0.monitor_coprocessor = 1;
+    cr0.numeric_error = 1;
+    cr0.task_switched = 0;
+    write_cr0(cr0);
+
+    if(edx & CPUID_FXSR) {
+        cr4 = read_cr4();
+        cr4.fxsave_stor = 1;
+        if(edx & CPUID_SSE) cr4.simd_exceptions = 1;
+        write_cr4(cr4);
+        fpu_has_fxsr = 1;
+    }
+
+    asm volatile("fninit");
+    fpu_save(&fpu_init_state);
+    if(fpu_has_fxsr) {
+        *(uint32_t*)&fpu_init_state.data[FXSAVE_MXCSR_OFFSET] = FPU_MXCSR_DEFAULT;
+    }
+    fpu_owner = NULL;
+    set_exception_hook(FPU_NM_VECTOR, &fpu_nm_handler);
+    stts();
+    log_msg("fpu: lazy switching enabled, %s", fpu_has_fxsr ?
+            ((edx & CPUID_SSE) ? "fxsave, sse" : "fxsave") : "fnsave");
+}
+
+/* fpu_switch_in
+ * Inputs: pcb - the process that's about to run
+ * Outputs: none
+ * Return value: none
+ * Side effects: Sets or clears CR0.TS
+ */
+void fpu_switch_in(pcb_t *pcb) {
+    if(pcb == fpu_owner) clts();
+    else stts();
+}
+
+/* fpu_fork
+ * Inputs: child - the new process
+ *         parent - the current process
+ * Outputs: none
+ * Return value: none
+ * Side effects: Saves the FPU registers if parent has them loaded
+ */
+void fpu_fork(pcb_t *child, pcb_t *parent) {
+    uint32_t flags;
+    cli_and_save(flags);
+    child->fpu_used = parent->fpu_used;
+    if(parent == fpu_owner) {
+        /* the saved copy in the parent's PCB is stale, go to the registers */
+        clts();
+        fpu_save(&child->fpu_state);
+        /* FNSAVE wipes the registers, put them back */
+        if(!fpu_has_fxsr) fpu_restore(&child->fpu_state);
+    } else if(parent->fpu_used) {
+        memcpy(&child->fpu_state, &parent->fpu_state, sizeof(fpu_state_t));
+    }
+    restore_flags(flags);
+}
+
+/* fpu_release
+ * Inputs: pcb - the process being killed
+ * Outputs: none
+ * Return value: none
+ * Side effects: Might clear fpu_owner, the registers are left as is
+ */
+void fpu_release(pcb_t *pcb) {
+    uint32_t flags;
+    cli_and_save(flags);
+    if(fpu_owner == pcb) fpu_owner = NULL;
+    pcb->fpu_used = 0;
+    restore_flags(flags);
+}
+
+/* fpu_nm_handler
+ * Handles #NM, which happens when a process runs an FPU instruction while TS is set.
+ * Swaps the FPU state of the current process in, after which returning retries the
+ * faulting instruction.
+ * Inputs: vect - FPU_NM_VECTOR
+ *         context - state of the faulting code
+ * Return value: 1 if handled, 0 to fall back on the default exception handling
+ * Side effects: Clears TS, saves and loads FPU registers
+ */
+static int fpu_nm_handler(uint32_t vect, iret_context_base_t *context) {
+    /* the kernel itself never uses the FPU, so treat that as a normal exception */
+    if(context->cs != USER_CS) return 0;
+    pcb_t *curr = get_current_pcb();
+    clts();
+    if(fpu_owner == curr) return 1;
+    if(fpu_owner != NULL) fpu_save(&fpu_owner->fpu_state);
+    if(curr->fpu_used) {
+        fpu_restore(&curr->fpu_state);
+    } else {
+        fpu_restore(&fpu_init_state);
+        curr->fpu_used = 1;
+    }
+    fpu_owner = curr;
+    return 1;
+}
@@ -0,0 +1,46 @@
+/* fpu.h - Definitions for lazy x87/SSE state switching */
+
+#ifndef _FPU_H
+#define _FPU_H
+
+#include "types.h"
+
+/* size of an FXSAVE image, the older FNSAVE image (108 bytes) fits in it too */
+#define FPU_STATE_SIZE 512
+/* MXCSR after reset: all SIMD exceptions masked, round to nearest */
+#define FPU_MXCSR_DEFAULT 0x1F80
+
+#ifndef ASM
+
+/* fpu_state_t
+ * Saved x87/MMX/SSE registers of a process. FXSAVE needs a 16 byte aligned buffer. */
+typedef struct fpu_state_t {
+    uint8_t data[FPU_STATE_SIZE];
+} __attribute__((aligned(16))) fpu_state_t;
+
+struct pcb_t;
+
+/* the process whose state is currently loaded in the FPU registers, NULL if no one's */
+extern struct pcb_t *fpu_owner;
+
+/* fpu_init
+ * Detects FXSAVE/SSE support, enables them, and captures the clean register state
+ * every process starts with. Must be called before any process runs. */
+void fpu_init(void);
+
+/* fpu_switch_in
+ * Called whenever pcb starts running on the CPU. Leaves the FPU usable if pcb's state is
+ * already loaded, otherwise sets CR0.TS so its first FPU instruction traps (#NM) and
+ * the state gets swapped in then. Interrupts must be disabled. */
+void fpu_switch_in(struct pcb_t *pcb);
+
+/* fpu_fork
+ * Gives child a copy of parent's FPU state, parent must be the current process. */
+void fpu_fork(struct pcb_t *child, struct pcb_t *parent);
+
+/* fpu_release
+ * Forgets the FPU state of a dying process, so it doesn't get saved on the next swap. */
+void fpu_release(struct pcb_t *pcb);
+
+#endif /* ASM */
+#endif /* _FPU_H */
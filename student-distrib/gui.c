@@ -8,6 +8,7 @@
 #include "process.h"
 #include "xenia_vga.h"
 #include "gui.h"
+#include "pit.h"
 
 /* how many "steps" reported by the mouse count as one screen character. */
 #define MOUSE_SPEED 24
@@ -144,6 +145,7 @@ static uint16_t osk_codes_caps_shift[OSK_HEIGHT][OSK_WIDTH];
 static uint8_t osk_vga[OSK_HEIGHT][OSK_WIDTH][2];
 int osk_enable = 0; // is the on screen keyboard visible and interactable?
 int cursor_enable = 0; // is the cursor visible and usable?
+volatile int render_pending = 1; // draw the first frame no matter what
 
 /* init_gui - Initialize the GUI and on screen keyboard. */
 void init_gui(void) {
@@ -366,11 +368,15 @@ static void gui_handle_mouse_release(int cursor_row, int cursor_col) {
 }
 
 /* do_render - Renders the backing terminal buffers to the screen, layering
- * the on screen keyboard and the mouse cursor on top of it. This is called by the
- * PIT handler to regularly redraw the screen. It also checks for mouse inputs
- * and acts accordingly. 
+ * the on screen keyboard and the mouse cursor on top of it. This is queued by the
+ * PIT handler to regularly redraw the screen, and runs in the worker thread. It also
+ * checks for mouse inputs and acts accordingly. Only the input handling runs with
+ * interrupts off, the frame itself gets copied with them on.
  * Side effects: Keypress keybind actions: killing processes, switching terminals, etc */
 void do_render(void) {
+    uint32_t flags;
+    cli_and_save(flags);
+    render_pending = 0;
 
     uint16_t *vidmap = (uint16_t*) get_vidmem_loc(get_active_terminal_id());
 
@@ -417,8 +423,13 @@ void do_render(void) {
         }
     }
 
+    was_pressed = new_pressed;
     // toggle which of two 4KB pages we use for double buffering
     gui_vga_ptr = (uint16_t*) ((uint32_t)gui_vga_ptr ^ (1 << 12));
+    restore_flags(flags);
+
+    /* the page we draw into isn't on screen, so a terminal switch or more output in
+     * the middle of this just shows up on the next frame */
     memcpy(gui_vga_ptr, vidmap, 2*VGA_WIDTH*VGA_HEIGHT);
 
     if(osk_enable) {
@@ -432,12 +443,25 @@ void do_render(void) {
     if(cursor_enable) {
         gui_vga_ptr[cursor_col + (cursor_row+1)*VGA_WIDTH] = '^' | (ATTRIB_PTR << 8);
     }
+    /* the CRTC registers are shared with the text cursor updates */
+    cli_and_save(flags);
     set_vga_start(gui_vga_ptr);
-    was_pressed = new_pressed;
+    restore_flags(flags);
+}
+
+/* gui_request_render - Marks the screen as changed, so that it gets redrawn on the
+ * next frame. Anything that changes what's on screen (terminal output, mouse movement,
+ * toggling the on screen keyboard, etc) has to call this, since the PIT doesn't tick
+ * when there's nothing to do.
+ * Side effects: Might arm the PIT */
+void gui_request_render(void) {
+    render_pending = 1;
+    pit_kick();
 }
 
 /* you like breaking userspace, don't you?
  * draws the best linux mascot to the screen; a easter egg of sorts. */
 void display_xenia(void) {
     memcpy(get_vidmem_loc(get_active_terminal_id()), xenia_vga, VGA_WIDTH*VGA_HEIGHT*2);
+    gui_request_render();
 }
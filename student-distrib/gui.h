@@ -7,9 +7,12 @@
 
 extern int osk_enable;
 extern int cursor_enable;
+/* set when the screen has changed since the last do_render */
+extern volatile int render_pending;
 
 void init_gui(void);
 void do_render(void);
+void gui_request_render(void);
 void display_xenia(void);
 
 #endif // ASM
@@ -4,6 +4,7 @@
 
 #include "i8259.h"
 #include "lib.h"
+#include "apic.h"
 
 /* Interrupt masks to determine which interrupts are enabled and disabled */
 // we have access to 15 IRQs because we lose one port when cascading
@@ -68,6 +69,12 @@ void enable_irq(uint32_t irq_num) {
     uint16_t port;
     uint8_t value;
 
+    if (apic_in_use) {
+        // the IOAPIC has the IRQ lines now
+        ioapic_set_masked(irq_num, 0);
+        return;
+    }
+
     if (irq_num < 8) {
         // If the IRQ is managed by the master PIC
         port = DATA_MASTER_8259_PORT;
@@ -97,6 +104,11 @@ void disable_irq(uint32_t irq_num) {
     uint16_t port;
     uint8_t value;
 
+    if (apic_in_use) {
+        ioapic_set_masked(irq_num, 1);
+        return;
+    }
+
     if (irq_num < 8) {
         // If the IRQ is managed by the master PIC
         port = DATA_MASTER_8259_PORT;
@@ -127,7 +139,10 @@ void disable_irq(uint32_t irq_num) {
 * RETURNS: void
 */
 void send_eoi(uint32_t irq_num) {
-    if (irq_num < 8) {
+    if (apic_in_use) {
+        // the local APIC takes any EOI, and it's one memory write instead of port I/O
+        lapic_eoi();
+    } else if (irq_num < 8) {
         // If the IRQ is serviced by the master PIC
         outb(EOI | irq_num, CMD_MASTER_8259_PORT);
     } else if (irq_num < 16) {
@@ -139,3 +154,17 @@ void send_eoi(uint32_t irq_num) {
         panic_msg("irq_num %d outside of valid range!", irq_num);
     }
 }
+
+/*
+* FUNCTION: i8259_handoff
+* DESCRIPTION: Masks every IRQ on both PICs, for when the IOAPIC takes over. From then
+*              on enable_irq, disable_irq and send_eoi go to the APICs instead.
+* INPUT: none
+* RETURNS: bitmap of the IRQs that were enabled, IRQ n in bit n
+*/
+uint16_t i8259_handoff(void) {
+    uint16_t enabled = ~(master_mask | (slave_mask << 8));
+    outb(0xFF, DATA_MASTER_8259_PORT);
+    outb(0xFF, DATA_SLAVE_8259_PORT);
+    return enabled;
+}
@@ -56,6 +56,10 @@ void disable_irq(uint32_t irq_num);
 
 /* Send end-of-interrupt signal for the specified IRQ */
 void send_eoi(uint32_t irq_num);
+
+/* Mask every IRQ on both PICs for good, once the IOAPIC takes over (see apic_init).
+ * Returns a bitmap of the IRQs that were enabled */
+uint16_t i8259_handoff(void);
 /* Notes that might be useful later on:
 1. Interrupts by slave delivered to master by IRQ2
  and only delivered to the processor when no other higherpriority interrupts (IR0 and IR1 on the primary PIC) are in service.
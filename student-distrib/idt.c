@@ -3,6 +3,10 @@
 #include "x86_desc.h"
 #include "process.h"
 #include "syscall.h"
+#include "sched.h"
+#include "signal.h"
+#include "apic.h"
+#include "mm.h"
 
 
 /*
@@ -37,6 +41,22 @@ char* except_lookup[IDT_NUM_EXCEP] = {
 };
 // wrapper macro defined in idtasm.S
 
+static exception_hook_t exception_hooks[IDT_NUM_EXCEP];
+
+/*
+* FUNCTION: set_exception_hook
+* DESCRIPTION: Installs a handler that gets the first chance at handling an exception,
+*              for exceptions that can be fixed up and resumed (e.g. #NM for lazy FPU
+*              switching), instead of killing the process.
+* INPUT: vect - the exception number
+*        hook - the handler, or NULL for none
+* RETURNS: void
+*/
+void set_exception_hook(uint32_t vect, exception_hook_t hook) {
+    if(vect >= IDT_NUM_EXCEP) panic_msg("exception num %d out of range!", vect);
+    exception_hooks[vect] = hook;
+}
+
 /*
 * FUNCTION: exception_handler_all
 * DESCRIPTION: This function handler handles all exceptions and interrupts. It is called specifically when 
@@ -52,10 +72,22 @@ void exception_handler_all(uint32_t vect, iret_context_base_t *context){
     if(vect >= IDT_NUM_EXCEP)
         panic_msg("weird! exception_handler_all called with out "
                 "of bounds vector index %d!", vect);
+    /* returning from here resumes the code that caused the exception */
+    if(exception_hooks[vect] && exception_hooks[vect](vect, context)) {
+        deliver_signals(context);
+        return;
+    }
     if(context->cs == USER_CS) {
-        /* Only kill user process if exception happened in user space, otherwise
-         * there is no guarantee that the kernel data structure invariants are
-         * held. If the exception happened in kernel space, the best we can do is panic. */
+        /* Only signal (or kill) the user process if exception happened in user space,
+         * otherwise there is no guarantee that the kernel data structure invariants are
+         * held. If the exception happened in kernel space, the best we can do is panic.
+         * If the process has a handler, returning runs it. */
+        signal_exception(vect, context);
+        return;
+    } else if(vect == PAGE_FAULT_VECTOR && get_current_pcb()->present &&
+            read_cr2().val >= USER_VMEM_START && read_cr2().val < USER_VMEM_END) {
+        /* a syscall touching a user buffer that couldn't be paged in, i.e. out of memory.
+         * the kernel's own state is fine, only the process has to go */
         kill_curr_process(EXCEPTION_STATUS);
     } else panic_msg("cpu exception in kernel mode! %s", except_lookup[vect]);
     /* Note: We never run past this comment, the above branches both never return. */
@@ -80,6 +112,8 @@ void syscall_handler(iret_context_base_t *context){
     // printf("SYSCALL HERE!!!\n");
     uint32_t sysnum = context->eax;
     int32_t ret_val;
+    pcb_t *current = get_current_pcb();
+    if(current->present) ++current->stats.nr_syscalls;
     if(sysnum == 0 || sysnum > NUM_SYSCALLS || !syscall_tbl[sysnum-1]) {
         ret_val = -1;
     } else {
@@ -89,6 +123,7 @@ void syscall_handler(iret_context_base_t *context){
         ret_val = syscall_tbl[sysnum-1](arg1, arg2, arg3);
     }
     *(int32_t*)&context->eax = ret_val;
+    deliver_signals(context);
 }
 
 static irq_handler_node_t *irq_handlers[IDT_NUM_PIC_IRQ];
@@ -149,6 +184,10 @@ void irq_handler(uint32_t irq, iret_context_base_t *context) {
         curr = curr->next;
     }
     if(!handled) panic_msg("unhandled enabled irq num %d!", irq);
+    /* the handlers woke up something more important than what got interrupted, most
+     * likely the worker thread with work they queued, so let it run right away */
+    if(sched_need_resched && get_current_pcb()->present) do_schedule(0);
+    deliver_signals(context);
 }
 
 /*
@@ -199,8 +238,8 @@ void init_idt_table() {
         idt[j] = idt_ent;
     }
 
-    // int 0x20 - 0x2F map to IRQ's 0 - 15
-    for ( j = 0; j < 16; j++) {
+    // int 0x20 - 0x2F map to IRQ's 0 - 15, 0x30 to the APIC timer
+    for ( j = 0; j < IDT_NUM_PIC_IRQ; j++) {
         // no need to skip entries, PIC will mask ones we don't use
         SET_IDT_ENTRY(idt_ent, pic_handler_start + j);
         idt[0x20 + j] = idt_ent;
@@ -237,6 +276,10 @@ void init_idt_table() {
     // SET_IDT_ENTRY(idt[0x28], &rtc_int);
     
 
+    // the local APIC's spurious interrupts, only once apic_init enables it
+    SET_IDT_ENTRY(idt_ent, apic_spurious_int);
+    idt[LAPIC_SPURIOUS_VECTOR] = idt_ent;
+
     // 0x80 to be defined for syscalls based on MP3 doc
     SET_IDT_ENTRY(idt_ent, &syscall_int);
     idt[0x80] = idt_ent;
@@ -3,7 +3,10 @@
 
 #define IDT_HANDLER_SIZE 48
 #define IDT_NUM_EXCEP 20
-#define IDT_NUM_PIC_IRQ 16
+/* the 16 ISA IRQs, plus the local APIC timer as IRQ 16 */
+#define IDT_NUM_PIC_IRQ 17
+/* page fault exception number */
+#define PAGE_FAULT_VECTOR 14
 
 #ifndef ASM
 
@@ -60,12 +63,13 @@ extern char* except_lookup[20];
 extern uint8_t except_handler_start[IDT_NUM_EXCEP][IDT_HANDLER_SIZE];
 extern uint8_t pic_handler_start[IDT_NUM_PIC_IRQ][IDT_HANDLER_SIZE];
 extern void syscall_int;
+extern uint8_t apic_spurious_int[];
 
 #define IRQ_HANDLED 1
 #define IRQ_UNHANDLED 0
 
 /* irq_handler_t
- * Inputs: the number of the IRQ, 0-15
+ * Inputs: the number of the IRQ, 0-16
  * Return value: 1 if it handled the interrupt and sent eoi, 0 otherwise */
 typedef int (*irq_handler_t)(uint32_t irq);
 typedef struct irq_handler_node_t {
@@ -78,6 +82,17 @@ typedef struct irq_handler_node_t {
  * this adds the node to the linked list for the given irq */
 void irq_register_handler(uint32_t irq, irq_handler_node_t *node);
 
+/* exception_hook_t
+ * Inputs: vect - the exception number, 0-19
+ *         context - the state of the code that caused the exception
+ * Return value: 1 if it handled the exception, in which case the faulting code is
+ *               resumed, 0 to fall back on killing the process/panicking */
+typedef int (*exception_hook_t)(uint32_t vect, iret_context_base_t *context);
+
+/* sets the hook that exception_handler_all tries first for the given exception,
+ * one hook per exception, NULL removes it */
+void set_exception_hook(uint32_t vect, exception_hook_t hook);
+
 
 #endif /* ASM */
 #endif /* _IDT_H */
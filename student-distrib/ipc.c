@@ -0,0 +1,174 @@
+/* ipc.c - Implements synchronous message passing, the ipc_send, ipc_receive and
+ * ipc_call syscalls.
+ * Messages are IPC_MSG_LEN bytes and unbuffered: a sender blocks until the receiver is
+ * waiting for it, then the message goes straight into the receiver's PCB and from there
+ * to its buffer once it runs. Only one process's user memory is mapped at a time, so
+ * that is as direct as copying between address spaces gets without mapping pages in.
+ * Whenever a message wakes up the receiver, the CPU is handed straight to it with
+ * sched_handoff, so a call (send a request, block for the reply) and the server's
+ * reply each cost one context switch, with no trip through the run queues. */
+
+#include "ipc.h"
+#include "lib.h"
+#include "mm.h"
+#include "process.h"
+#include "sched.h"
+#include "signal.h"
+
+/* ipc_alive
+ * Return value: whether a process can take part in message passing */
+static int ipc_alive(pcb_t *pcb) {
+    return pcb->present && !pcb->zombie && !pcb->kthread;
+}
+
+/* ipc_check_pid
+ * Return value: the PCB of the process with the given pid, NULL if there is no such
+ *               live process, or it's the current one */
+static pcb_t *ipc_check_pid(int32_t pid) {
+    pcb_t *pcb;
+    if(pid < 0 || pid >= NUM_PROCESSES) return NULL;
+    pcb = pid_to_pcb(pid);
+    if(!ipc_alive(pcb) || pcb == get_current_pcb()) return NULL;
+    return pcb;
+}
+
+/* ipc_wait
+ * Blocks the current process until a message from its receive target comes in, the
+ * target exits, or a signal comes in. Interrupts must be disabled.
+ * Inputs: next - process to hand the CPU to while waiting, NULL to let the scheduler pick
+ * Return value: 0 once a message is in the PCB, -1 if the target exited or a signal
+ *               interrupted the wait */
+static int32_t ipc_wait(pcb_t *next) {
+    pcb_t *current = get_current_pcb();
+    while(current->ipc_receiving) {
+        if((current->ipc_from != IPC_ANY && !ipc_alive(pid_to_pcb(current->ipc_from))) ||
+                signal_pending(current)) {
+            current->ipc_receiving = 0;
+            return -1;
+        }
+        if(next) sched_sleep_handoff(&current->ipc_recv_queue, next);
+        else sched_sleep(&current->ipc_recv_queue);
+        next = NULL;
+    }
+    return 0;
+}
+
+/* ipc_deliver
+ * Waits for dest to be ready to receive from the current process, then gives it the
+ * message and wakes it up. Interrupts must be disabled.
+ * Inputs: dest - the receiver
+ *         msg - the message, already copied into kernel memory
+ * Return value: 0 on success, -1 if dest exited or a signal interrupted the wait */
+static int32_t ipc_deliver(pcb_t *dest, const uint8_t *msg) {
+    pcb_t *current = get_current_pcb();
+    int32_t pid = pcb_to_pid(current);
+    while(!dest->ipc_receiving || (dest->ipc_from != IPC_ANY && dest->ipc_from != pid)) {
+        if(!ipc_alive(dest) || signal_pending(current)) return -1;
+        sched_sleep(&dest->ipc_send_queue);
+    }
+    memcpy(dest->ipc_buf, msg, IPC_MSG_LEN);
+    dest->ipc_peer = pid;
+    dest->ipc_receiving = 0;
+    sched_wake_all(&dest->ipc_recv_queue);
+    return 0;
+}
+
+/* ipc_exit
+ * See ipc.h.
+ * Inputs: pcb - the exiting process */
+void ipc_exit(pcb_t *pcb) {
+    int32_t pid = pcb_to_pid(pcb), i;
+    pcb->ipc_receiving = 0;
+    sched_wake_all(&pcb->ipc_send_queue);
+    for(i = 0; i < NUM_PROCESSES; ++i) {
+        pcb_t *other = pid_to_pcb(i);
+        if(other->present && other->ipc_receiving && other->ipc_from == pid)
+            sched_wake_all(&other->ipc_recv_queue);
+    }
+}
+
+/* syscall_ipc_send
+ * Sends a message to a process, blocking until it receives it.
+ * Inputs: arg1 - pid of the receiver
+ *         arg2 - user pointer to the IPC_MSG_LEN byte message
+ *         arg3 - not used
+ * Return value: 0 once the message is delivered, -1 on a bad pid or pointer, or if the
+ *               receiver exits first or a signal comes in
+ * Side effects: Switches straight to the receiver */
+int32_t syscall_ipc_send(int32_t arg1, int32_t arg2, int32_t arg3) {
+    uint8_t msg[IPC_MSG_LEN];
+    uint32_t flags;
+    pcb_t *dest = ipc_check_pid(arg1);
+    if(!dest || check_user_bounds((void*) arg2, IPC_MSG_LEN)) return -1;
+    memcpy(msg, (void*) arg2, IPC_MSG_LEN);
+    cli_and_save(flags);
+    if(ipc_deliver(dest, msg)) {
+        restore_flags(flags);
+        return -1;
+    }
+    /* i.e. a server replying to a client blocked in ipc_call */
+    sched_handoff(dest);
+    restore_flags(flags);
+    return 0;
+}
+
+/* syscall_ipc_receive
+ * Waits for a message.
+ * Inputs: arg1 - pid to receive from, or IPC_ANY for any process
+ *         arg2 - user pointer to an IPC_MSG_LEN byte buffer for the message
+ *         arg3 - not used
+ * Return value: the sender's pid, -1 on a bad pid or pointer, or if the process being
+ *               received from exits first, or a signal comes in
+ * Side effects: Blocks until a message comes in, or a signal does */
+int32_t syscall_ipc_receive(int32_t arg1, int32_t arg2, int32_t arg3) {
+    pcb_t *current = get_current_pcb();
+    uint32_t flags;
+    if((arg1 != IPC_ANY && !ipc_check_pid(arg1)) ||
+            check_user_bounds((void*) arg2, IPC_MSG_LEN))
+        return -1;
+    cli_and_save(flags);
+    current->ipc_from = arg1;
+    current->ipc_receiving = 1;
+    /* let whoever's waiting to send to us check whether we take their message now */
+    sched_wake_all(&current->ipc_send_queue);
+    if(ipc_wait(NULL)) {
+        restore_flags(flags);
+        return -1;
+    }
+    restore_flags(flags);
+    /* nothing else writes ipc_buf until we receive again */
+    memcpy((void*) arg2, current->ipc_buf, IPC_MSG_LEN);
+    return current->ipc_peer;
+}
+
+/* syscall_ipc_call
+ * Sends a message to a process and waits for its reply, i.e. a send followed by a
+ * receive from the same process, except the reply can't slip in between the two.
+ * Inputs: arg1 - pid of the server
+ *         arg2 - user pointer to the IPC_MSG_LEN byte request, overwritten by the reply
+ *         arg3 - not used
+ * Return value: 0 once the reply is in, -1 on a bad pid or pointer, or if the server
+ *               exits first or a signal comes in
+ * Side effects: Switches straight to the server */
+int32_t syscall_ipc_call(int32_t arg1, int32_t arg2, int32_t arg3) {
+    pcb_t *current = get_current_pcb();
+    uint8_t msg[IPC_MSG_LEN];
+    uint32_t flags;
+    pcb_t *dest = ipc_check_pid(arg1);
+    if(!dest || check_user_bounds((void*) arg2, IPC_MSG_LEN)) return -1;
+    memcpy(msg, (void*) arg2, IPC_MSG_LEN);
+    cli_and_save(flags);
+    if(ipc_deliver(dest, msg)) {
+        restore_flags(flags);
+        return -1;
+    }
+    current->ipc_from = arg1;
+    current->ipc_receiving = 1;
+    if(ipc_wait(dest)) {
+        restore_flags(flags);
+        return -1;
+    }
+    restore_flags(flags);
+    memcpy((void*) arg2, current->ipc_buf, IPC_MSG_LEN);
+    return 0;
+}
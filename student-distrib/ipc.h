@@ -0,0 +1,24 @@
+/* ipc.h - Definitions for synchronous message passing between processes */
+
+#ifndef _IPC_H
+#define _IPC_H
+
+#include "types.h"
+
+/* size of every message, in bytes. small enough to go through the kernel in a couple of
+ * cache lines, requests that need more can point into shared memory (see shm.h) */
+#define IPC_MSG_LEN 64
+/* receive's from argument that accepts a message from any process */
+#define IPC_ANY (-1)
+
+#ifndef ASM
+
+struct pcb_t;
+
+/* ipc_exit
+ * Wakes up everyone blocked sending to or receiving from an exiting process, so their
+ * syscalls can fail instead of waiting forever. Interrupts must be disabled. */
+void ipc_exit(struct pcb_t *pcb);
+
+#endif /* ASM */
+#endif /* _IPC_H */
@@ -0,0 +1,126 @@
+/* irqsoff.c - Implements the interrupts-off latency tracer.
+ * Every critical section in the kernel works by disabling interrupts, and while they're
+ * off, keypresses, mouse movement and timer deadlines all wait. With IRQSOFF_TRACE,
+ * cli_and_save and restore_flags report when they actually turn interrupts off and
+ * back on (nested ones don't), and the longest of those windows get kept along with
+ * both call sites, so the ones worth shortening are easy to find.
+ * A window opened by one process and closed by another, i.e. across a context switch,
+ * counts as one window, since interrupts really were off the whole time. Time spent in
+ * interrupt handlers isn't counted, the CPU disables interrupts for those itself. */
+
+#include "irqsoff.h"
+#include "lib.h"
+#include "ktime.h"
+#include "kthread.h"
+
+/* irqsoff_window_t
+ * A window of time with interrupts off */
+typedef struct irqsoff_window_t {
+    uint32_t cycles;
+    const int8_t *off_file;
+    int32_t off_line;
+    const int8_t *on_file;
+    int32_t on_line;
+} irqsoff_window_t;
+
+/* the longest windows, longest first, unused entries have 0 cycles */
+static irqsoff_window_t worst[IRQSOFF_NUM_WORST];
+/* windows closed since the last dump */
+static uint32_t nr_windows = 0;
+/* the window currently open, if there is one */
+static int window_open = 0;
+static uint64_t off_at;
+static const int8_t *off_file;
+static int32_t off_line;
+
+static void irqsoff_dump_work(void *data);
+static work_t dump_work = WORK_INIT(&irqsoff_dump_work, NULL);
+
+/* irqsoff_off
+ * Opens a window, called with interrupts just disabled. A window that never got closed
+ * (i.e. the process iret'd straight to user mode) gets replaced, since interrupts must
+ * have been on in between for them to be getting turned off now.
+ * Inputs: file, line - where interrupts were disabled */
+void irqsoff_off(const int8_t *file, int32_t line) {
+    off_file = file;
+    off_line = line;
+    window_open = 1;
+    off_at = rdtsc();
+}
+
+/* irqsoff_record
+ * Puts a closed window in the worst list if it's long enough. The same pair of call
+ * sites only gets one entry, so one hot path can't crowd out everything else.
+ * Interrupts must be disabled. */
+static void irqsoff_record(uint32_t cycles, const int8_t *on_file, int32_t on_line) {
+    int32_t i, slot = IRQSOFF_NUM_WORST - 1;
+    for(i = 0; i < IRQSOFF_NUM_WORST; ++i) {
+        if(worst[i].off_file == off_file && worst[i].off_line == off_line &&
+                worst[i].on_file == on_file && worst[i].on_line == on_line) {
+            if(cycles <= worst[i].cycles) return;
+            slot = i;
+            break;
+        }
+    }
+    if(cycles <= worst[slot].cycles) return;
+    /* shift the shorter ones down to make room, keeping the list sorted */
+    for(i = slot; i > 0 && worst[i - 1].cycles < cycles; --i) worst[i] = worst[i - 1];
+    worst[i].cycles = cycles;
+    worst[i].off_file = off_file;
+    worst[i].off_line = off_line;
+    worst[i].on_file = on_file;
+    worst[i].on_line = on_line;
+}
+
+/* irqsoff_on
+ * Closes the open window, called with interrupts about to be enabled.
+ * Inputs: file, line - where interrupts are being enabled */
+void irqsoff_on(const int8_t *file, int32_t line) {
+    uint64_t cycles;
+    if(!window_open) return;
+    cycles = rdtsc() - off_at;
+    window_open = 0;
+    ++nr_windows;
+    irqsoff_record(cycles >> 32 ? 0xFFFFFFFF : (uint32_t) cycles, file, line);
+}
+
+/* irqsoff_dump
+ * See irqsoff.h.
+ * Inputs: none
+ * Side effects: Prints to the screen, clears the worst list */
+void irqsoff_dump(void) {
+    irqsoff_window_t copy[IRQSOFF_NUM_WORST];
+    uint32_t flags, count, i;
+#ifndef IRQSOFF_TRACE
+    printf("[IRQSOFF] compiled without IRQSOFF_TRACE\n");
+    return;
+#endif
+    /* printing turns interrupts off too, so take a snapshot first */
+    cli_and_save(flags);
+    memcpy(copy, worst, sizeof(worst));
+    memset(worst, 0, sizeof(worst));
+    count = nr_windows;
+    nr_windows = 0;
+    restore_flags(flags);
+    printf("[IRQSOFF] %u windows, longest:\n", count);
+    for(i = 0; i < IRQSOFF_NUM_WORST && copy[i].cycles; ++i) {
+        printf("[IRQSOFF] %uns off at %s:%d, on at %s:%d\n",
+                (uint32_t) cycles_to_ns(copy[i].cycles), copy[i].off_file,
+                copy[i].off_line, copy[i].on_file, copy[i].on_line);
+    }
+}
+
+/* irqsoff_dump_work
+ * Runs irqsoff_dump in the worker thread.
+ * Inputs: data - not used */
+static void irqsoff_dump_work(void *data) {
+    irqsoff_dump();
+}
+
+/* irqsoff_request_dump
+ * See irqsoff.h.
+ * Inputs: none
+ * Side effects: Queues work */
+void irqsoff_request_dump(void) {
+    queue_work(&dump_work);
+}
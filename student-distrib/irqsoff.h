@@ -0,0 +1,25 @@
+/* irqsoff.h - Definitions for the interrupts-off latency tracer */
+
+#ifndef _IRQSOFF_H
+#define _IRQSOFF_H
+
+#include "types.h"
+
+/* how many of the longest windows get kept */
+#define IRQSOFF_NUM_WORST 8
+
+#ifndef ASM
+
+/* irqsoff_dump
+ * Prints the longest windows with interrupts off since the last dump, longest first,
+ * with where interrupts went off and where they came back on, then starts over.
+ * Does nothing useful unless IRQSOFF_TRACE is defined in lib.h. */
+void irqsoff_dump(void);
+
+/* irqsoff_request_dump
+ * Has the worker thread call irqsoff_dump, for the Ctrl+Alt+I hotkey. Safe to call
+ * from interrupt handlers. */
+void irqsoff_request_dump(void);
+
+#endif /* ASM */
+#endif /* _IRQSOFF_H */
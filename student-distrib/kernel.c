@@ -13,18 +13,66 @@
 #include "keyboard.h"
 #include "mouse.h"
 #include "mm.h"
+#include "kmalloc.h"
 #include "fs.h"
 #include "process.h"
 #include "pit.h"
+#include "sched.h"
 #include "terminal.h"
 #include "gui.h"
+#include "fpu.h"
+#include "kthread.h"
+#include "ktime.h"
+#include "smp.h"
+#include "apic.h"
 
 #define RUN_TESTS
+/* times the hot paths (context switches, syscalls, fs, rendering) instead */
+// #define RUN_BENCHMARKS
 
 /* Macros. */
 /* Check if the bit BIT in FLAGS is set. */
 #define CHECK_FLAG(flags, bit)   ((flags) & (1 << (bit)))
 
+/* boot options from the multiboot command line, 0 if not given */
+static uint32_t boot_hz = 0;
+static uint32_t boot_quantum = 0;
+static uint32_t boot_noapic = 0;
+
+/* parse_boot_options
+ * Picks the options we know out of the kernel command line, which is a list of words
+ * separated by spaces. Unknown words (like the kernel's own path) are ignored.
+ *   hz=N       jiffy rate of the PIT, see pit_setrate
+ *   quantum=N  default time slice in milliseconds
+ *   noapic     keep interrupts on the 8259s and time slices on the PIT
+ * Has to run before paging is enabled, since the command line is in low memory.
+ * Inputs: cmdline - the command line string
+ * Side effects: Sets boot_hz, boot_quantum and boot_noapic */
+static void parse_boot_options(const int8_t *cmdline) {
+    while(*cmdline) {
+        uint32_t *option = NULL;
+        uint32_t val = 0;
+        if(!strncmp(cmdline, "hz=", 3)) {
+            option = &boot_hz;
+            cmdline += 3;
+        } else if(!strncmp(cmdline, "quantum=", 8)) {
+            option = &boot_quantum;
+            cmdline += 8;
+        } else if(!strncmp(cmdline, "noapic", 6)) {
+            boot_noapic = 1;
+        }
+        if(option) {
+            while(*cmdline >= '0' && *cmdline <= '9' && val < 1000000) {
+                val = val * 10 + (*cmdline++ - '0');
+            }
+            *option = val;
+        }
+        // skip to the start of the next word
+        while(*cmdline && *cmdline != ' ') ++cmdline;
+        while(*cmdline == ' ') ++cmdline;
+    }
+}
+
 /* Check if MAGIC is valid and print the Multiboot information structure
    pointed by ADDR. */
 /* void entry(unsigned long magic, unsigned long addr)
@@ -39,6 +87,7 @@ void entry(unsigned long magic, unsigned long addr) {
 
     multiboot_info_t *mbi;
     uint8_t *fs_start, *fs_end;
+    uint32_t mem_upper = 0;
 
     /* Clear the screen. */
     clear();
@@ -56,16 +105,20 @@ void entry(unsigned long magic, unsigned long addr) {
     printf("flags = 0x%#x\n", (unsigned)mbi->flags);
 
     /* Are mem_* valid? */
-    if (CHECK_FLAG(mbi->flags, 0))
+    if (CHECK_FLAG(mbi->flags, 0)) {
         printf("mem_lower = %uKB, mem_upper = %uKB\n", (unsigned)mbi->mem_lower, (unsigned)mbi->mem_upper);
+        mem_upper = mbi->mem_upper;
+    }
 
     /* Is boot_device valid? */
     if (CHECK_FLAG(mbi->flags, 1))
         printf("boot_device = 0x%#x\n", (unsigned)mbi->boot_device);
 
     /* Is the command line passed? */
-    if (CHECK_FLAG(mbi->flags, 2))
+    if (CHECK_FLAG(mbi->flags, 2)) {
         printf("cmdline = %s\n", (char *)mbi->cmdline);
+        parse_boot_options((int8_t *)mbi->cmdline);
+    }
 
     if (CHECK_FLAG(mbi->flags, 3)) { // modules loading like drivers and file systems
         int mod_count = 0;
@@ -171,11 +224,27 @@ void entry(unsigned long magic, unsigned long addr) {
     // 6.1.5. If errors happen, we know exactly what exeception happens.
     // Init paging next, that way out of bounds memory accesses in init code will be caught
     paging_init();
+    // hand the memory past the user pages to the frame pool, which backs the kernel heap
+    frame_pool_init(mem_upper, (uint32_t) fs_start, (uint32_t) fs_end);
+    kmalloc_init();
     // 6.1.4.
     /* Init the PIC */ 
     i8259_init();
     // Checkpoint 5
+    // the jiffy rate can't change once the PIT is running
+    if(boot_hz && pit_setrate(boot_hz))
+        log_msg("ignoring hz=%u, must be %u to %u", boot_hz, PIT_MIN_HZ, PIT_MAX_HZ);
     pit_init();
+    tsc_init();
+    if(boot_quantum >= SCHED_MIN_TIMESLICE && boot_quantum <= SCHED_MAX_TIMESLICE)
+        sched_default_timeslice = boot_quantum;
+    else if(boot_quantum)
+        log_msg("ignoring quantum=%u, must be %u to %u", boot_quantum,
+                SCHED_MIN_TIMESLICE, SCHED_MAX_TIMESLICE);
+    // start the other CPUs (they just park for now), before any page directories exist
+    smp_init();
+    // move the IRQs enabled so far (the PIT's) over to the IOAPIC, later ones follow
+    if(!boot_noapic) apic_init();
 
     /* most other initialization can happen at this point */
     rtc_init();
@@ -183,6 +252,8 @@ void entry(unsigned long magic, unsigned long addr) {
     mouse_init();
     fs_init(fs_start, fs_end);
     init_proc_mgmt();
+    fpu_init();
+    kthread_init();
     init_terminals();
     init_gui();
 
@@ -198,6 +269,9 @@ void entry(unsigned long magic, unsigned long addr) {
     /* Run tests */
     launch_tests();
 #endif
+#ifdef RUN_BENCHMARKS
+    launch_benchmarks();
+#endif
 
     do_render();
 
@@ -6,6 +6,8 @@
 #include "terminal.h"
 #include "process.h"
 #include "gui.h"
+#include "kthread.h"
+#include "irqsoff.h"
 
 static int shift_pressed = FALSE;
 static int ctrl_pressed = FALSE;
@@ -13,6 +15,16 @@ static int caps_lock_active = FALSE;
 static int alt_pressed = FALSE;
 
 static int keyboard_handler(uint32_t irq);
+static void keyboard_work_fn(void *data);
+static void keyboard_process_scancode(uint32_t scancode);
+
+/* scancodes the interrupt handler received that the worker thread hasn't processed
+ * yet. a ring buffer, empty when head == tail, so it holds one less than its size */
+#define SCANCODE_QUEUE_SIZE 64
+static uint8_t scancode_queue[SCANCODE_QUEUE_SIZE];
+static uint32_t scancode_head = 0;
+static uint32_t scancode_tail = 0;
+static work_t keyboard_work = WORK_INIT(&keyboard_work_fn, NULL);
 
 /*
  * FUNCTION: keyboard_init
@@ -157,23 +169,69 @@ static char scancode_to_capsshift_ascii[NUM_SCANCODES] = {
 /*
  * FUNCTION: keyboard_handler
  * DESCRIPTION: Handles the keyboard interrupt by reading a scancode from the keyboard
- *              data port and translating it to an ASCII character if it is a valid
- *              scancode. It then outputs the character to the screen.
+ *              data port and queueing it for the worker thread, which does the actual
+ *              processing in keyboard_process_scancode.
  * INPUTS: irq -- The irq number on the PIC, ranging from 0 to 15; always KEYBOARD_IRQ
  *                for this function
  *         receives input from the keyboard I/O ports
  * OUTPUTS: none
  * RETURNS: void
- * SIDE EFFECTS: Can modify the screen content.
+ * SIDE EFFECTS: Drops the scancode if too many are already waiting.
  */
 
 static int keyboard_handler(uint32_t irq){
-    int was_special = 0;
-    int kill_proc = 0;
     cli();
     send_eoi(KEYBOARD_IRQ);
     // Read the scan code from the keyboard data port
-    uint32_t scancode = inb(KEYBOARD_DATA_PORT); 
+    uint8_t scancode = inb(KEYBOARD_DATA_PORT);
+    uint32_t next = (scancode_tail + 1) % SCANCODE_QUEUE_SIZE;
+    if(next != scancode_head) {
+        scancode_queue[scancode_tail] = scancode;
+        scancode_tail = next;
+    }
+    queue_work(&keyboard_work);
+    return 1; // successfully serviced interrupt
+}
+
+/*
+ * FUNCTION: keyboard_work_fn
+ * DESCRIPTION: Processes every scancode the interrupt handler queued up, in the worker
+ *              thread. Each one is processed with interrupts off, since the terminal
+ *              line buffers expect that, but the worker can be preempted in between.
+ * INPUTS: data -- not used
+ * OUTPUTS: none
+ * RETURNS: void
+ * SIDE EFFECTS: See keyboard_process_scancode.
+ */
+static void keyboard_work_fn(void *data) {
+    uint32_t flags;
+    uint8_t scancode;
+    while(1) {
+        cli_and_save(flags);
+        if(scancode_head == scancode_tail) {
+            restore_flags(flags);
+            return;
+        }
+        scancode = scancode_queue[scancode_head];
+        scancode_head = (scancode_head + 1) % SCANCODE_QUEUE_SIZE;
+        keyboard_process_scancode(scancode);
+        restore_flags(flags);
+    }
+}
+
+/*
+ * FUNCTION: keyboard_process_scancode
+ * DESCRIPTION: Translates a scancode to an ASCII character if it is a valid
+ *              scancode, and outputs the character to the screen, or handles the
+ *              modifier keys and keybinds.
+ * INPUTS: scancode -- the scancode read from the keyboard
+ * OUTPUTS: none
+ * RETURNS: void
+ * SIDE EFFECTS: Can modify the screen content, switch terminals, kill processes.
+ */
+static void keyboard_process_scancode(uint32_t scancode) {
+    int was_special = 0;
+    int kill_proc = 0;
     int active_terminal_id = get_active_terminal_id();
     int terminal_to_switch = 0;
 
@@ -251,6 +309,11 @@ static int keyboard_handler(uint32_t irq){
                     switch_terminal(terminal_to_switch);
                     was_special = 1;
                 }
+                if(alt_pressed && ctrl_pressed && scancode == 0x17) { // 0x17 is 'i'
+                    // longest interrupts-off windows, printed from the worker thread
+                    irqsoff_request_dump();
+                    was_special = 1;
+                }
                 if(alt_pressed && ctrl_pressed && shift_pressed && scancode == 0x2D) { // 0x2D is 'x'
                     display_xenia();
                     was_special = 1;
@@ -276,7 +339,9 @@ static int keyboard_handler(uint32_t irq){
                 }
             }
 
-    // we have to send eoi first before we do any process switching
+    // the on screen keyboard and cursor toggles only show up on the next frame
+    if(was_special) gui_request_render();
+
     if(kill_proc) {
         pcb_t *pcb = get_current_pcb();
         /* note: since interrupt handlers can fire before the first process is started,
@@ -285,7 +350,5 @@ static int keyboard_handler(uint32_t irq){
          * interrupts are enabled */
         if(pcb->present) kill_term_process(TERMINATED_STATUS);
     }
-    return 1; // successfully serviced interrupt
-
 }
 
@@ -0,0 +1,208 @@
+/* kmalloc.c - Implements the kernel heap as a set of slab caches, one per power of two
+ * size class, built on top of the page frame allocator in mm.c */
+
+#include "kmalloc.h"
+#include "mm.h"
+#include "lib.h"
+
+/* slab_t
+ * Header at the start of every slab frame. The objects follow it, and free objects
+ * store the pointer to the next free object in their first 4 bytes, so allocating and
+ * freeing is just popping and pushing the free list. */
+struct slab_t {
+    kmem_cache_t *cache;
+    slab_t *next;
+    slab_t *prev;
+    void *free;
+    uint32_t inuse;
+};
+
+/* alignment of objects never needs to be more than 16 bytes */
+#define KMALLOC_MAX_ALIGN 16
+
+static kmem_cache_t kmalloc_caches[KMALLOC_NUM_CACHES];
+static lock_class_t kmalloc_lock_class = LOCK_CLASS_INIT("kmalloc");
+static const int8_t *kmalloc_cache_names[KMALLOC_NUM_CACHES] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1024",
+};
+
+/* offset of the first object in a slab of the given cache */
+static inline uint32_t slab_obj_offset(const kmem_cache_t *cache) {
+    uint32_t align = cache->obj_size < KMALLOC_MAX_ALIGN ?
+            cache->obj_size : KMALLOC_MAX_ALIGN;
+    return (sizeof(slab_t) + align - 1) & ~(align - 1);
+}
+
+/* smallest size class that fits size bytes, size must be at most KMALLOC_MAX_SIZE */
+static inline uint32_t size_to_cache_idx(uint32_t size) {
+    uint32_t shift = KMALLOC_MIN_SHIFT;
+    while((1U << shift) < size) ++shift;
+    return shift - KMALLOC_MIN_SHIFT;
+}
+
+/* slab list helpers; head is one of the partial/full list heads of a cache */
+static void slab_list_add(slab_t **head, slab_t *slab) {
+    slab->prev = NULL;
+    slab->next = *head;
+    if(*head) (*head)->prev = slab;
+    *head = slab;
+}
+static void slab_list_remove(slab_t **head, slab_t *slab) {
+    if(slab->prev) slab->prev->next = slab->next;
+    else *head = slab->next;
+    if(slab->next) slab->next->prev = slab->prev;
+    slab->next = slab->prev = NULL;
+}
+
+/* new_slab
+ * Grabs a frame from the frame pool and threads all of its objects onto a free list.
+ * Return value: the new slab, NULL if the frame pool is exhausted */
+static slab_t *new_slab(kmem_cache_t *cache) {
+    slab_t *slab = alloc_frames(1);
+    if(!slab) return NULL;
+    slab->cache = cache;
+    slab->next = slab->prev = NULL;
+    slab->inuse = 0;
+    slab->free = NULL;
+    uint8_t *obj = (uint8_t*) slab + slab_obj_offset(cache) +
+            (cache->objs_per_slab - 1) * cache->obj_size;
+    uint32_t i;
+    /* build the list back to front so objects get handed out in address order */
+    for(i = 0; i < cache->objs_per_slab; ++i, obj -= cache->obj_size) {
+        *(void**)obj = slab->free;
+        slab->free = obj;
+    }
+    ++cache->num_slabs;
+    return slab;
+}
+
+/* kmalloc_init
+ * Sets up the size class caches. No slabs are allocated until they're first needed.
+ * Side effects: Initializes kmalloc_caches */
+void kmalloc_init(void) {
+    uint32_t i;
+    for(i = 0; i < KMALLOC_NUM_CACHES; ++i) {
+        kmem_cache_t *cache = &kmalloc_caches[i];
+        memset(cache, 0, sizeof(*cache));
+        cache->name = kmalloc_cache_names[i];
+        cache->lock.class = &kmalloc_lock_class;
+        cache->obj_size = 1 << (i + KMALLOC_MIN_SHIFT);
+        cache->objs_per_slab = (PAGE_SIZE - slab_obj_offset(cache)) / cache->obj_size;
+    }
+}
+
+/* kmalloc
+ * See kmalloc.h. Sizes up to KMALLOC_MAX_SIZE come from the size class caches, bigger
+ * ones get a run of whole frames.
+ * Inputs: size - number of bytes needed
+ * Return value: pointer to the memory, NULL on failure */
+void *kmalloc(uint32_t size) {
+    uint32_t flags;
+    if(size == 0) return NULL;
+    if(size > KMALLOC_MAX_SIZE) return alloc_frames((size + PAGE_SIZE - 1) / PAGE_SIZE);
+
+    kmem_cache_t *cache = &kmalloc_caches[size_to_cache_idx(size)];
+    spin_lock_irqsave(&cache->lock, flags);
+    slab_t *slab = cache->partial;
+    if(!slab) {
+        /* slow path, reuse the spare empty slab or get a new one */
+        slab = cache->empty;
+        if(slab) cache->empty = NULL;
+        else slab = new_slab(cache);
+        if(!slab) {
+            ++cache->failed_allocs;
+            spin_unlock_irqrestore(&cache->lock, flags);
+            return NULL;
+        }
+        slab_list_add(&cache->partial, slab);
+    }
+    void *obj = slab->free;
+    slab->free = *(void**)obj;
+    ++slab->inuse;
+    if(!slab->free) {
+        slab_list_remove(&cache->partial, slab);
+        slab_list_add(&cache->full, slab);
+    }
+    ++cache->num_allocs;
+    ++cache->active_objs;
+    spin_unlock_irqrestore(&cache->lock, flags);
+    return obj;
+}
+
+/* kzalloc
+ * kmalloc, but the memory is zeroed.
+ * Inputs: size - number of bytes needed
+ * Return value: pointer to the memory, NULL on failure */
+void *kzalloc(uint32_t size) {
+    void *ptr = kmalloc(size);
+    if(ptr) memset(ptr, 0, size);
+    return ptr;
+}
+
+/* kfree
+ * See kmalloc.h. Large allocations are always page aligned, while slab objects never
+ * are (the slab header sits at the start of the frame), which is how the two are told
+ * apart.
+ * Inputs: ptr - memory from kmalloc, or NULL
+ * Side effects: Panics on pointers that didn't come from kmalloc */
+void kfree(void *ptr) {
+    uint32_t flags;
+    if(!ptr) return;
+    if(!((uint32_t) ptr & (PAGE_SIZE - 1))) {
+        free_frames(ptr);
+        return;
+    }
+    slab_t *slab = (slab_t*) ((uint32_t) ptr & ~(PAGE_SIZE - 1));
+    kmem_cache_t *cache = slab->cache;
+    if(cache < kmalloc_caches || cache >= kmalloc_caches + KMALLOC_NUM_CACHES)
+        panic_msg("kfree of %#x, which is not in a slab!", ptr);
+    uint32_t offset = (uint8_t*) ptr - (uint8_t*) slab - slab_obj_offset(cache);
+    if(offset % cache->obj_size || offset / cache->obj_size >= cache->objs_per_slab)
+        panic_msg("kfree of %#x, which is not the start of a %s object!",
+                ptr, cache->name);
+
+    spin_lock_irqsave(&cache->lock, flags);
+    if(!slab->free) {
+        slab_list_remove(&cache->full, slab);
+        slab_list_add(&cache->partial, slab);
+    }
+    *(void**)ptr = slab->free;
+    slab->free = ptr;
+    --slab->inuse;
+    ++cache->num_frees;
+    --cache->active_objs;
+    if(slab->inuse == 0) {
+        slab_list_remove(&cache->partial, slab);
+        if(!cache->empty) {
+            cache->empty = slab;
+        } else {
+            --cache->num_slabs;
+            free_frames(slab);
+        }
+    }
+    spin_unlock_irqrestore(&cache->lock, flags);
+}
+
+/* kmalloc_cache_stats
+ * Inputs: idx - index of the size class cache, 0 is the smallest
+ * Return value: the cache, or NULL if idx is out of range */
+const kmem_cache_t *kmalloc_cache_stats(uint32_t idx) {
+    if(idx >= KMALLOC_NUM_CACHES) return NULL;
+    return &kmalloc_caches[idx];
+}
+
+/* kmalloc_dump_stats
+ * Prints the statistics of every size class cache, plus how much of the frame
+ * pool is left.
+ * Side effects: Prints to the screen */
+void kmalloc_dump_stats(void) {
+    uint32_t i;
+    for(i = 0; i < KMALLOC_NUM_CACHES; ++i) {
+        kmem_cache_t *cache = &kmalloc_caches[i];
+        printf("%s: active %u allocs %u frees %u slabs %u failed %u\n",
+                cache->name, cache->active_objs, cache->num_allocs,
+                cache->num_frees, cache->num_slabs, cache->failed_allocs);
+    }
+    printf("free frames: %u\n", frames_free());
+}
@@ -0,0 +1,71 @@
+/* kmalloc.h - Definitions for the kernel heap (slab allocator) */
+
+#ifndef _KMALLOC_H
+#define _KMALLOC_H
+
+#include "types.h"
+#include "spinlock.h"
+
+/* smallest size class is 16 bytes (1 << 4), largest is 1KiB (1 << 10). anything
+ * bigger than the largest size class gets whole frames straight from the frame pool */
+#define KMALLOC_MIN_SHIFT 4
+#define KMALLOC_MAX_SHIFT 10
+#define KMALLOC_NUM_CACHES (KMALLOC_MAX_SHIFT - KMALLOC_MIN_SHIFT + 1)
+#define KMALLOC_MAX_SIZE (1 << KMALLOC_MAX_SHIFT)
+
+#ifndef ASM
+
+typedef struct slab_t slab_t;
+
+/* kmem_cache_t
+ * A cache of equally sized objects, carved out of single frame slabs. Keeps track of
+ * its slabs in two lists, ones with free objects left (partial) and ones without (full).
+ * At most one completely empty slab is kept around, so a cache that bounces between
+ * zero and one objects doesn't keep going back to the frame pool. */
+typedef struct kmem_cache_t {
+    const int8_t *name;
+    uint32_t obj_size;
+    uint32_t objs_per_slab;
+    slab_t *partial;
+    slab_t *full;
+    slab_t *empty;
+    /* protects the slab lists and statistics, each cache has its own */
+    spinlock_t lock;
+    /* usage statistics */
+    uint32_t num_allocs;
+    uint32_t num_frees;
+    uint32_t active_objs;
+    uint32_t num_slabs;
+    uint32_t failed_allocs;
+} kmem_cache_t;
+
+/* init the size class caches, must be called after frame_pool_init */
+void kmalloc_init(void);
+
+/* kmalloc
+ * Allocates size bytes from the kernel heap. Objects from the size class caches are
+ * aligned to the smaller of their size class and 16 bytes, larger allocations are page
+ * aligned. Safe to call with interrupts disabled, and from interrupt handlers.
+ * Return value: pointer to the memory (not zeroed), NULL on failure or if size is 0 */
+void *kmalloc(uint32_t size);
+
+/* kzalloc
+ * Same as kmalloc, but zeroes the returned memory. */
+void *kzalloc(uint32_t size);
+
+/* kfree
+ * Frees memory returned by kmalloc/kzalloc. Does nothing for NULL. Panics when given
+ * a pointer that didn't come from kmalloc. */
+void kfree(void *ptr);
+
+/* kmalloc_cache_stats
+ * Return value: the size class cache with the given index (0 to KMALLOC_NUM_CACHES-1),
+ *               so its statistics can be inspected, NULL if out of range */
+const kmem_cache_t *kmalloc_cache_stats(uint32_t idx);
+
+/* kmalloc_dump_stats
+ * Prints the usage statistics of each size class cache to the screen */
+void kmalloc_dump_stats(void);
+
+#endif /* ASM */
+#endif /* _KMALLOC_H */
@@ -0,0 +1,151 @@
+/* kthread.c - Implements kernel threads and the deferred work queue.
+ * Interrupt handlers used to do all of their work (echoing keystrokes, redrawing the
+ * screen) right inside the handler, with interrupts off the whole time. Now they only
+ * grab what the hardware gave them and queue a work_t, which the worker thread runs
+ * with interrupts enabled. The worker sits on a reserved run queue level, so it still
+ * runs right after the interrupt returns, just not at the expense of other interrupts. */
+
+#include "kthread.h"
+#include "lib.h"
+#include "pit.h"
+#include "sched.h"
+
+/* kthread_start_t
+ * What make_context passes to kthread_entry on the new thread's stack */
+typedef struct kthread_start_t {
+    kthread_fn_t *fn;
+    void *arg;
+} kthread_start_t;
+
+/* kernel stacks of the kernel threads. same layout as process stacks, PCB at the
+ * bottom, so get_current_pcb works on them too */
+static kernel_stack_t kthread_stacks[NUM_KTHREADS]
+        __attribute__((aligned(KERNEL_STACK_SIZE)));
+
+/* queued work, oldest first, and where the worker sleeps while it's empty */
+static work_t *work_head = NULL;
+static work_t *work_tail = NULL;
+static wait_queue_t work_queue = WAIT_QUEUE_INIT;
+/* set once the worker thread has run, from then on queued work waits for it */
+static int worker_running = 0;
+
+/* kthread_entry
+ * First thing a kernel thread runs, calls its function with interrupts enabled.
+ * Inputs: buf - the kthread_start_t from kthread_create
+ *         buf_len - not used */
+static void kthread_entry(void *buf, uint32_t buf_len) {
+    kthread_start_t start = *(kthread_start_t*)buf;
+    sti();
+    start.fn(start.arg);
+    panic_msg("kernel thread %s returned!", get_current_pcb()->name);
+}
+
+/* kthread_create
+ * See kthread.h.
+ * Inputs: name - name of the thread, for debugging
+ *         fn - function the thread runs
+ *         arg - argument passed to fn
+ * Return value: the new thread's PCB, NULL if there's no free stack
+ * Side effects: Makes the thread runnable */
+pcb_t *kthread_create(const int8_t *name, kthread_fn_t *fn, void *arg) {
+    uint32_t flags;
+    kthread_start_t start;
+    pcb_t *pcb = NULL;
+    int i;
+    cli_and_save(flags);
+    for(i = 0; i < NUM_KTHREADS; ++i) {
+        if(!kthread_stacks[i].pcb.present) {
+            pcb = &kthread_stacks[i].pcb;
+            break;
+        }
+    }
+    if(!pcb) {
+        restore_flags(flags);
+        return NULL;
+    }
+
+    memset(pcb, 0, sizeof(pcb_t));
+    pcb->present = 1;
+    pcb->kthread = 1;
+    pcb->terminal_id = -1;
+    pcb->prio = KTHREAD_PRIO;
+    pcb->timeslice = SCHED_DEFAULT_TIMESLICE;
+    strncpy((int8_t*)pcb->name, name, PROC_NAME_LEN-1);
+    pcb->stats.start_jiffy = pcb->stats.last_run = pit_jiffies();
+
+    start.fn = fn;
+    start.arg = arg;
+    make_context(&pcb->context, &kthread_stacks[i].stack[KERNEL_STACK_SIZE],
+            &kthread_entry, &start, sizeof(start));
+    sched_wake(pcb);
+    restore_flags(flags);
+    return pcb;
+}
+
+/* kthread_exit
+ * See kthread.h.
+ * Side effects: Switches to the next runnable process */
+void kthread_exit(void) {
+    pcb_t *pcb = get_current_pcb();
+    if(!pcb->kthread) panic_msg("kthread_exit outside of a kernel thread!");
+    cli();
+    sched_block(pcb);
+    /* we're still on the stack, but nothing can reuse it until interrupts are back on,
+     * which happens only after we've jumped away */
+    pcb->present = 0;
+    do_schedule(1);
+}
+
+/* worker_main
+ * Body of the worker thread: runs queued work in order, sleeping while there is none.
+ * Inputs: arg - not used */
+static void worker_main(void *arg) {
+    uint32_t flags;
+    work_t *work;
+    worker_running = 1;
+    while(1) {
+        cli_and_save(flags);
+        while(!work_head) sched_sleep(&work_queue);
+        work = work_head;
+        work_head = work->next;
+        if(!work_head) work_tail = NULL;
+        work->next = NULL;
+        /* cleared before running, so the work can be queued again while it runs */
+        work->pending = 0;
+        restore_flags(flags);
+        work->fn(work->data);
+    }
+}
+
+/* kthread_init
+ * Inputs: none
+ * Outputs: none
+ * Return value: none
+ * Side effects: Creates the worker thread, panics if that fails */
+void kthread_init(void) {
+    if(!kthread_create("kworker", &worker_main, NULL)) {
+        panic_msg("unable to create worker thread!");
+    }
+}
+
+/* queue_work
+ * See kthread.h.
+ * Inputs: work - the work to queue
+ * Side effects: Wakes up the worker thread, or runs the work if it hasn't started */
+void queue_work(work_t *work) {
+    uint32_t flags;
+    if(!worker_running) {
+        work->fn(work->data);
+        return;
+    }
+    cli_and_save(flags);
+    if(!work->pending) {
+        work->pending = 1;
+        work->next = NULL;
+        if(work_tail) work_tail->next = work;
+        else work_head = work;
+        work_tail = work;
+        sched_wake_all(&work_queue);
+    }
+    restore_flags(flags);
+}
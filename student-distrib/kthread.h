@@ -0,0 +1,63 @@
+/* kthread.h - Definitions for kernel threads and the deferred work queue */
+
+#ifndef _KTHREAD_H
+#define _KTHREAD_H
+
+#include "types.h"
+#include "process.h"
+
+/* how many kernel threads there can be, their stacks are allocated statically */
+#define NUM_KTHREADS 2
+/* run queue level of kernel threads, one of the levels reserved above any user process
+ * (see sched.h), so deferred work runs as soon as the interrupt that queued it returns */
+#define KTHREAD_PRIO 0
+
+#ifndef ASM
+
+/* kthread_fn_t
+ * Function run by a kernel thread, with interrupts enabled. Must never return. */
+typedef void kthread_fn_t(void *arg);
+
+/* work_fn_t
+ * Function run by the worker thread for a piece of deferred work, with interrupts
+ * enabled. */
+typedef void work_fn_t(void *data);
+
+/* work_t
+ * A piece of work an interrupt handler wants done outside of interrupt context. Usually
+ * statically allocated by the handler, and queued every time it has something to do. */
+typedef struct work_t work_t;
+struct work_t {
+    work_fn_t *fn;
+    void *data;
+    work_t *next;
+    /* set while the work is on the queue, so queueing it again does nothing */
+    int pending;
+};
+#define WORK_INIT(fn, data) { (fn), (data), NULL, 0 }
+
+/* kthread_create
+ * Makes a kernel thread running fn(arg), and makes it runnable. Kernel threads get a PCB
+ * like processes do, so the scheduler and wait queues work the same for them, but they
+ * live outside the NUM_PROCESSES slots, so they have no pid, no user memory and no
+ * file descriptors.
+ * Return value: the thread's PCB, NULL if all NUM_KTHREADS are taken */
+pcb_t *kthread_create(const int8_t *name, kthread_fn_t *fn, void *arg);
+
+/* kthread_exit
+ * Ends the current kernel thread, freeing its stack for another kthread_create.
+ * Never returns. */
+void kthread_exit(void);
+
+/* kthread_init
+ * Starts the worker thread that runs queued work. */
+void kthread_init(void);
+
+/* queue_work
+ * Queues work to be run by the worker thread, does nothing if it's already queued. Safe
+ * to call from interrupt handlers. Until the worker thread first gets scheduled (during
+ * boot, before any process runs), the work runs right away instead. */
+void queue_work(work_t *work);
+
+#endif /* ASM */
+#endif /* _KTHREAD_H */
@@ -0,0 +1,134 @@
+/* ktime.c - Implements the high resolution monotonic clock.
+ * The TSC counts CPU cycles, so it's as fine grained as time gets, but its rate isn't
+ * known up front. At boot we count how many cycles pass while PIT channel 2 (the
+ * speaker channel, which nothing else uses) counts down TSC_CALIBRATE_MS, which
+ * gives the rate as cycles per millisecond. Converting cycles to nanoseconds is then a
+ * multiply and a shift, no division. */
+
+#include "ktime.h"
+#include "lib.h"
+#include "mm.h"
+#include "pit.h"
+
+/* PIT channel 2's data port, and system control port B, whose bit 0 is channel 2's
+ * gate, bit 1 turns the speaker on, and bit 5 reads back channel 2's output */
+#define PIT_CH2_PORT 0x42
+#define PIT_CH2_GATE_PORT 0x61
+#define PIT_CH2_GATE 0x01
+#define PIT_CH2_SPEAKER 0x02
+#define PIT_CH2_OUT 0x20
+/* CPUID.1:EDX TSC feature bit */
+#define CPUID_TSC (1 << 4)
+/* give up on calibrating after polling this many times, in case channel 2's output
+ * never goes high */
+#define TSC_CALIBRATE_POLLS 100000000
+
+uint32_t tsc_khz = 0;
+/* TSC at boot, and ns = cycles * tsc_mult >> tsc_shift */
+static uint64_t tsc_boot = 0;
+static uint32_t tsc_mult = 0;
+static uint32_t tsc_shift = 0;
+
+/* tsc_calibrate
+ * Counts TSC cycles over TSC_CALIBRATE_MS of PIT channel 2 time.
+ * Return value: the TSC rate in cycles per millisecond, 0 if it couldn't be measured
+ * Side effects: Uses PIT channel 2, spins for TSC_CALIBRATE_MS with interrupts off */
+static uint32_t tsc_calibrate(void) {
+    uint32_t latch = PIT_FREQ / 1000 * TSC_CALIBRATE_MS;
+    uint32_t flags, polls = 0;
+    uint64_t start, cycles;
+    cli_and_save(flags);
+    /* gate high so channel 2 counts, speaker off */
+    outb((inb(PIT_CH2_GATE_PORT) & ~PIT_CH2_SPEAKER) | PIT_CH2_GATE, PIT_CH2_GATE_PORT);
+    outb(0xB0, PIT_CMD_PORT); // 1011 0000 - channel 2, lobyte/hibyte, interrupt on terminal count
+    outb(latch & 0xFF, PIT_CH2_PORT);
+    outb((latch >> 8) & 0xFF, PIT_CH2_PORT);
+    start = rdtsc();
+    /* in mode 0 the output goes high once the count hits zero */
+    while(!(inb(PIT_CH2_GATE_PORT) & PIT_CH2_OUT) && polls < TSC_CALIBRATE_POLLS) ++polls;
+    cycles = rdtsc() - start;
+    restore_flags(flags);
+    if(polls == TSC_CALIBRATE_POLLS) return 0;
+    /* latch isn't exactly TSC_CALIBRATE_MS worth of PIT cycles, so scale by the real
+     * length, cycles * PIT_FREQ / (latch * 1000) */
+    cycles *= PIT_FREQ;
+    div64_32(&cycles, latch * 1000);
+    return (uint32_t) cycles;
+}
+
+/* tsc_init
+ * Inputs: none
+ * Outputs: none
+ * Return value: none
+ * Side effects: See ktime.h
+ */
+void tsc_init(void) {
+    uint32_t eax, ebx, ecx, edx;
+    uint64_t mult;
+    asm volatile("cpuid"
+        : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+        : "a"(1));
+    if(!(edx & CPUID_TSC) || !(tsc_khz = tsc_calibrate())) {
+        tsc_khz = 0;
+        log_msg("ktime: no usable TSC, using jiffies");
+        return;
+    }
+    /* the biggest shift (most precision) whose multiplier still fits in 32 bits */
+    for(tsc_shift = 32; tsc_shift > 0; --tsc_shift) {
+        mult = (uint64_t)NSEC_PER_MSEC << tsc_shift;
+        div64_32(&mult, tsc_khz);
+        if(!(mult >> 32)) break;
+    }
+    tsc_mult = (uint32_t) mult;
+    tsc_boot = rdtsc();
+    log_msg("ktime: TSC at %u kHz", tsc_khz);
+}
+
+/* cycles_to_ns
+ * Inputs: cycles - a number of TSC cycles
+ * Return value: how long they take in nanoseconds, 0 without a TSC */
+uint64_t cycles_to_ns(uint64_t cycles) {
+    uint32_t low = (uint32_t) cycles, high = (uint32_t)(cycles >> 32);
+    /* cycles * tsc_mult is up to 96 bits, so do it in two halves */
+    return (((uint64_t)low * tsc_mult) >> tsc_shift) +
+            (((uint64_t)high * tsc_mult) << (32 - tsc_shift));
+}
+
+/* tsc_delay_us
+ * Inputs: us - how long to wait in microseconds
+ * Side effects: Spins */
+void tsc_delay_us(uint32_t us) {
+    uint64_t cycles = (uint64_t) tsc_khz * us;
+    uint64_t start = rdtsc();
+    div64_32(&cycles, 1000);
+    while(tsc_khz && rdtsc() - start < cycles);
+}
+
+/* ktime_ns
+ * Inputs: none
+ * Return value: nanoseconds since boot
+ * Side effects: Reads the PIT without a TSC */
+uint64_t ktime_ns(void) {
+    if(!tsc_khz) return (uint64_t)pit_jiffies() * (NSEC_PER_SEC / pit_hz);
+    return cycles_to_ns(rdtsc() - tsc_boot);
+}
+
+/* syscall_clock_gettime
+ * Reads a clock with nanosecond resolution.
+ * Inputs: arg1 - clock id, CLOCK_MONOTONIC is the only one, time since boot
+ *         arg2 - pointer to a timespec_t to fill in
+ *         arg3 - not used
+ * Return value: 0 on success, -1 on a bad clock id or pointer
+ * Side effects: Writes to user memory */
+int32_t syscall_clock_gettime(int32_t arg1, int32_t arg2, int32_t arg3) {
+    timespec_t *user_ts = (timespec_t*) arg2;
+    timespec_t ts;
+    uint64_t ns;
+    if(arg1 != CLOCK_MONOTONIC) return -1;
+    if(!user_ts || check_user_bounds(user_ts, sizeof(ts))) return -1;
+    ns = ktime_ns();
+    ts.tv_nsec = div64_32(&ns, NSEC_PER_SEC);
+    ts.tv_sec = (uint32_t) ns;
+    memcpy(user_ts, &ts, sizeof(ts));
+    return 0;
+}
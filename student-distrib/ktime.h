@@ -0,0 +1,73 @@
+/* ktime.h - Definitions for the TSC based high resolution clock */
+
+#ifndef _KTIME_H
+#define _KTIME_H
+
+#include "types.h"
+
+#define NSEC_PER_SEC 1000000000
+#define NSEC_PER_MSEC 1000000
+/* how long to count TSC cycles against PIT channel 2 for at boot */
+#define TSC_CALIBRATE_MS 10
+
+/* clock ids for clock_gettime, numbered like POSIX. only the monotonic clock (time
+ * since boot) exists so far */
+#define CLOCK_MONOTONIC 1
+
+#ifndef ASM
+
+/* timespec_t
+ * What clock_gettime copies out to user space. */
+typedef struct timespec_t {
+    uint32_t tv_sec;
+    uint32_t tv_nsec;
+} timespec_t;
+
+/* cycles per millisecond of the TSC, 0 if there's no usable TSC */
+extern uint32_t tsc_khz;
+
+/* rdtsc
+ * Return value: the CPU's time stamp counter, in cycles */
+static inline uint64_t rdtsc(void) {
+    uint64_t tsc;
+    asm volatile ("rdtsc" : "=A"(tsc));
+    return tsc;
+}
+
+/* div64_32
+ * Divides a 64 bit number by a 32 bit one with two divl's, since gcc wants libgcc's
+ * __udivdi3 for a plain 64 bit division.
+ * Inputs: n - the dividend, replaced with the quotient
+ *         d - the divisor
+ * Return value: the remainder */
+static inline uint32_t div64_32(uint64_t *n, uint32_t d) {
+    uint32_t high = (uint32_t)(*n >> 32), low = (uint32_t)*n;
+    uint32_t quot_high = high / d, rem;
+    high %= d;
+    /* high < d now, so the quotient fits in 32 bits */
+    asm ("divl %4" : "=a"(low), "=d"(rem) : "a"(low), "d"(high), "rm"(d) : "cc");
+    *n = ((uint64_t)quot_high << 32) | low;
+    return rem;
+}
+
+/* tsc_init
+ * Checks for a TSC and measures its rate against PIT channel 2, which takes
+ * TSC_CALIBRATE_MS. Should be called once during boot, before anything uses ktime_ns. */
+void tsc_init(void);
+
+/* ktime_ns
+ * Return value: nanoseconds since tsc_init, never goes backwards. Cheap enough to
+ * bracket anything worth measuring. Falls back on jiffies without a TSC. */
+uint64_t ktime_ns(void);
+
+/* cycles_to_ns
+ * Return value: how many nanoseconds the given number of TSC cycles take */
+uint64_t cycles_to_ns(uint64_t cycles);
+
+/* tsc_delay_us
+ * Busy waits for at least us microseconds, for device setup that has to be timed
+ * before interrupts are on. Returns right away without a TSC. */
+void tsc_delay_us(uint32_t us);
+
+#endif /* ASM */
+#endif /* _KTIME_H */
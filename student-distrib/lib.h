@@ -107,7 +107,37 @@ do {                                    \
     );                                  \
 } while (0)
 
+/* uncomment to time every window with interrupts off, see irqsoff.c. costs an rdtsc
+ * and a function call on each cli/sti/cli_and_save/restore_flags that turns interrupts
+ * off or back on */
+// #define IRQSOFF_TRACE
+
+/* interrupt enable flag in EFLAGS */
+#define EFLAGS_IF 0x200
+
+#ifdef IRQSOFF_TRACE
+void irqsoff_off(const int8_t *file, int32_t line);
+void irqsoff_on(const int8_t *file, int32_t line);
+/* Tell the irqsoff tracer interrupts just got disabled, or are about to be enabled.
+ * The macros below do this on their own, only code enabling interrupts some other way
+ * (i.e. sti; hlt) needs to call these */
+#define trace_irqs_off() irqsoff_off(__FILE__, __LINE__)
+#define trace_irqs_on() irqsoff_on(__FILE__, __LINE__)
+#else
+#define trace_irqs_off() do {} while (0)
+#define trace_irqs_on() do {} while (0)
+#endif
+
 /* Clear interrupt flag - disables interrupts on this processor */
+#ifdef IRQSOFF_TRACE
+/* only tells the tracer if interrupts were on, like cli_and_save, so a cli with them
+ * already off doesn't restart the window */
+#define cli()                           \
+do {                                    \
+    uint32_t cli_flags_;                \
+    cli_and_save(cli_flags_);           \
+} while (0)
+#else
 #define cli()                           \
 do {                                    \
     asm volatile ("cli"                 \
@@ -116,6 +146,7 @@ do {                                    \
             : "memory", "cc"            \
     );                                  \
 } while (0)
+#endif
 
 /* Save flags and then clear interrupt flag
  * Saves the EFLAGS register into the variable "flags", and then
@@ -131,11 +162,13 @@ do {                                    \
             :                           \
             : "memory", "cc"            \
     );                                  \
+    if ((flags) & EFLAGS_IF) trace_irqs_off(); \
 } while (0)
 
 /* Set interrupt flag - enable interrupts on this processor */
 #define sti()                           \
 do {                                    \
+    trace_irqs_on();                    \
     asm volatile ("sti"                 \
             :                           \
             :                           \
@@ -148,6 +181,7 @@ do {                                    \
  * after a cli_and_save_flags(flags) */
 #define restore_flags(flags)            \
 do {                                    \
+    if ((flags) & EFLAGS_IF) trace_irqs_on(); \
     asm volatile ("                   \n\
             pushl %0                  \n\
             popfl                     \n\
@@ -7,16 +7,28 @@
 #include "syscall.h"
 #include "process.h"
 #include "terminal.h"
+#include "idt.h"
+#include "vma.h"
 
 #define VIDEO 0xB8000
-#define USER_MEM 0x8000000
+
+/* The page frame pool starts right after the kernel's 4MiB page, and has to end before
+ * user virtual memory, since the whole pool is identity mapped into the kernel's part
+ * of the address space. User pages, user page tables and the kernel heap all come out
+ * of it. */
+#define FRAME_POOL_START (2 * PAGE_4M_SIZE)
+#define FRAME_POOL_END USER_VMEM_START
+#define FRAME_POOL_MAX_FRAMES ((FRAME_POOL_END - FRAME_POOL_START) / PAGE_SIZE)
+/* multiboot's mem_upper counts the KiB of memory starting at 1MiB */
+#define MEM_UPPER_BASE 0x100000
 
 /* Statically allocated arrays of page directory / table entries aligned to page boundaries,
  * used as the initial page directory and low page table for the kernel */
 /* since these are initialized to all zeros, every entry will be not present */
 page_dir_t kernel_page_dir;
 page_tbl_t low_page_table;
-page_tbl_t user_vidmap_page_table;
+
+static int user_page_fault(uint32_t vect, iret_context_base_t *context);
 
 /* void paging_init(void)
  * Sets up initial page directories and tables, and turns on paging in the CPU
@@ -63,21 +75,8 @@ void paging_init(void) {
     pd_ent.base_4m = 1;
     kernel_page_dir[1] = pd_ent;
 
-    /* setup user memory page*/
-    pd_ent.val = 0; /* zero initialize reserved fields */
-    pd_ent.present = 1;
-    pd_ent.write_enable = 1;
-    pd_ent.user_access = 1;
-    pd_ent.write_through = 0;
-    pd_ent.cache_disable = 0;
-    pd_ent.accessed = 0;
-    pd_ent.dirty = 0;
-    pd_ent.page_size = 1;
-    pd_ent.global = 0;
-    pd_ent.avail = 0;
-    pd_ent.page_attr_idx = 0;
-    pd_ent.base_4m = USER_MEM >> 22;
-    kernel_page_dir[32] = pd_ent; // At 128 MB
+    /* user memory at 128 MB and the vidmap page are only mapped in the page
+     * directories of processes, see page_dir_create */
 
     /* setup video memory 4KiB page, from VIDEO to VIDEO+PAGE_SIZE-1 */
     /* technically this only covers 4KiB of the 128KiB total of video memory,
@@ -117,42 +116,15 @@ void paging_init(void) {
         low_page_table[(VIDEO >> 12) + i + 1] = pt_ent;
     }
 
-    /* setup user vidmap memory page directory entry */
-    pd_ent.val = 0; /* zero initialize reserved fields */
-    pd_ent.present = 1;
-    pd_ent.write_enable = 1;
-    pd_ent.user_access = 1;
-    pd_ent.write_through = 0;
-    pd_ent.cache_disable = 0;
-    pd_ent.accessed = 0;
-    pd_ent.page_size = 0;
-    /* the global flag here does not do anything, only the individual page table
-     * entry global flags impact TLB behaviour */
-    pd_ent.global = 1;
-    pd_ent.avail = 0;
-    pd_ent.base = ((uint32_t) &user_vidmap_page_table) >> 12;
-    kernel_page_dir[USER_VIDMAP >> 22] = pd_ent;
-
-    /* setup user video memory 4KiB page */
-    pt_ent.val = 0; /* zero initialize reserved fields */
-    pt_ent.present = 0; /* initially disabled, gets enabled by vidmap syscall */
-    pt_ent.write_enable = 1;
-    pt_ent.user_access = 1;
-    pt_ent.write_through = 1; /* make sure writes get sent out to VGA */
-    pt_ent.cache_disable = 0;
-    pt_ent.accessed = 0;
-    pt_ent.page_attr_idx = 0;
-    pt_ent.global = 0;
-    pt_ent.avail = 0;
-    pt_ent.base = VIDEO >> 12;
-    user_vidmap_page_table[(USER_VIDMAP & (PAGE_4M_SIZE-1)) >> 12] = pt_ent;
-
     cr0 = read_cr0();
     cr3 = read_cr3();
     cr4 = read_cr4();
     cr4.page_size_ext = 1;
     cr3.page_dir_base = ((uint32_t) &kernel_page_dir) >> 12;
     cr0.paging = 1;
+    /* make the kernel respect read-only pages too, otherwise a syscall writing to a
+     * copy-on-write user buffer would write straight through to the shared frame */
+    cr0.write_protect = 1;
     write_cr3(cr3);
     write_cr4(cr4);
     /* make sure we setup the flags and page directory before enabling paging bit in CR0 */
@@ -162,34 +134,548 @@ void paging_init(void) {
     cr4.page_global_enable = 1;
     write_cr4(cr4);
 
+    set_exception_hook(PAGE_FAULT_VECTOR, &user_page_fault);
+
     printf("cr0: %#x cr2: %#x cr3: %#x cr4: %#x\n",
             read_cr0().val, read_cr2().val, read_cr3().val, read_cr4().val);
 }
 
 
 
+/* bit i is set when frame i of the pool is in use (or reserved, or missing) */
+static uint32_t frame_bitmap[FRAME_POOL_MAX_FRAMES / 32];
+/* for the first frame of each alloc_frames() run, how many frames the run covers,
+ * zero for every other frame */
+static uint16_t frame_run_len[FRAME_POOL_MAX_FRAMES];
+/* for the first frame of each run, how many references there are to it, so user pages
+ * can be shared between processes (see user_space_clone) */
+static uint16_t frame_refs[FRAME_POOL_MAX_FRAMES];
+/* number of frames actually backed by memory, and how many of them are free */
+static uint32_t frame_pool_len = 0;
+static uint32_t frame_pool_free = 0;
+/* where the next search for free frames starts, so we don't rescan the start of the
+ * pool every time */
+static uint32_t frame_hint = 0;
+/* frames the idle loop zeroed ahead of time, handed out by alloc_zeroed_frame. they
+ * count as free, and go back to the pool whenever alloc_frames runs short */
+static void *zero_pool[ZERO_POOL_SIZE];
+static uint32_t zero_pool_count = 0;
+/* 1 while zero_pool_refill has a frame out being zeroed, which still counts as free */
+static uint32_t zero_pool_inflight = 0;
+
+static int zero_pool_drain(void);
+
+/* frame_pool_init
+ * Identity maps the physical memory past the user pages into the kernel's address
+ * space (supervisor only), and sets up the allocator for handing it out 4KiB at a time.
+ * Inputs: mem_upper - KiB of memory above 1MiB, as reported by multiboot
+ *         reserve_start/end - physical range that must never be handed out (i.e. the
+ *                             filesystem module), can be empty
+ * Side effects: Adds global 4MiB pages to the kernel page directory. */
+void frame_pool_init(uint32_t mem_upper, uint32_t reserve_start, uint32_t reserve_end) {
+    uint32_t mem_end = MEM_UPPER_BASE + mem_upper * 1024;
+    uint32_t i;
+    if(mem_upper > (FRAME_POOL_END - MEM_UPPER_BASE) / 1024) mem_end = FRAME_POOL_END;
+    frame_pool_len = mem_end > FRAME_POOL_START ?
+            (mem_end - FRAME_POOL_START) / PAGE_SIZE : 0;
+
+    /* map the pool with 4MiB pages, rounding up so a partial last page is mapped too */
+    pd_ent_t pd_ent;
+    for(i = FRAME_POOL_START >> 22; i < (FRAME_POOL_START >> 22) +
+            (frame_pool_len + PAGE_TBL_LEN - 1) / PAGE_TBL_LEN; ++i) {
+        pd_ent.val = 0; /* zero initialize reserved fields */
+        pd_ent.present = 1;
+        pd_ent.write_enable = 1;
+        pd_ent.user_access = 0;
+        pd_ent.page_size = 1;
+        pd_ent.global = 1;
+        pd_ent.base_4m = i;
+        kernel_page_dir[i] = pd_ent;
+    }
+
+    /* everything past the end of memory counts as permanently in use */
+    for(i = 0; i < FRAME_POOL_MAX_FRAMES; ++i) {
+        if(i >= frame_pool_len || (FRAME_POOL_START + i * PAGE_SIZE < reserve_end &&
+                FRAME_POOL_START + (i+1) * PAGE_SIZE > reserve_start)) {
+            frame_bitmap[i / 32] |= 1 << (i % 32);
+        } else {
+            frame_bitmap[i / 32] &= ~(1 << (i % 32));
+            ++frame_pool_free;
+        }
+        frame_run_len[i] = 0;
+        frame_refs[i] = 0;
+    }
+    write_cr3(read_cr3());
+    log_msg("frame pool: %u free 4KiB frames at %#x", frame_pool_free, FRAME_POOL_START);
+}
+
+/* find_free_run
+ * Finds count consecutive free frames with the first one in [from, to).
+ * Return value: the index of the first frame, or -1 if there is no such run */
+static int32_t find_free_run(uint32_t from, uint32_t to, uint32_t count) {
+    uint32_t i, run = 0;
+    for(i = from; i < frame_pool_len && i < to + count - 1; ++i) {
+        /* skip over completely used words of the bitmap quickly */
+        if(run == 0 && (i % 32) == 0 && frame_bitmap[i / 32] == ~0U) {
+            i += 31;
+            continue;
+        }
+        if(frame_bitmap[i / 32] & (1 << (i % 32))) {
+            run = 0;
+        } else if(++run == count) {
+            return i + 1 - count;
+        }
+    }
+    return -1;
+}
+
+/* alloc_frames
+ * Allocates count physically contiguous 4KiB frames from the frame pool. Safe to call
+ * with interrupts disabled, never waits.
+ * Return value: the (identity mapped) address of the first frame, NULL if there is
+ *               no run of free frames long enough
+ * Side effects: Marks the frames as used. Does not zero them. */
+void *alloc_frames(uint32_t count) {
+    uint32_t flags, i;
+    int32_t start;
+    if(count == 0 || count > 0xFFFF) return NULL;
+    cli_and_save(flags);
+    while(1) {
+        start = -1;
+        if(count <= frame_pool_free) {
+            /* next fit: search from the hint to the end, then wrap around to the start */
+            start = find_free_run(frame_hint, frame_pool_len, count);
+            if(start < 0) start = find_free_run(0, frame_hint, count);
+        }
+        /* the zero pool's frames are free memory too, take them back if we're short */
+        if(start >= 0 || !zero_pool_drain()) break;
+    }
+    if(start < 0) {
+        restore_flags(flags);
+        return NULL;
+    }
+    for(i = start; i < start + count; ++i) {
+        frame_bitmap[i / 32] |= 1 << (i % 32);
+    }
+    frame_run_len[start] = count;
+    frame_refs[start] = 1;
+    frame_pool_free -= count;
+    frame_hint = start + count;
+    restore_flags(flags);
+    return (void*)(FRAME_POOL_START + start * PAGE_SIZE);
+}
+
+/* free_frames
+ * Returns a run of frames from alloc_frames back to the pool.
+ * Inputs: frame - the address alloc_frames returned
+ * Side effects: Panics if frame isn't the start of an allocated run. */
+void free_frames(void *frame) {
+    uint32_t addr = (uint32_t) frame;
+    uint32_t flags, i, idx, count;
+    if(addr < FRAME_POOL_START || (addr & (PAGE_SIZE-1)) ||
+            (addr - FRAME_POOL_START) / PAGE_SIZE >= frame_pool_len)
+        panic_msg("freeing frame %#x outside of the frame pool!", addr);
+    idx = (addr - FRAME_POOL_START) / PAGE_SIZE;
+    cli_and_save(flags);
+    count = frame_run_len[idx];
+    if(count == 0) panic_msg("frame %#x was not allocated by alloc_frames!", addr);
+    for(i = idx; i < idx + count; ++i) {
+        frame_bitmap[i / 32] &= ~(1 << (i % 32));
+    }
+    frame_run_len[idx] = 0;
+    frame_refs[idx] = 0;
+    frame_pool_free += count;
+    restore_flags(flags);
+}
+
+/* frames_free
+ * Return value: how many frames in the pool are currently free, including the ones
+ *               waiting zeroed in the zero pool and the one being zeroed */
+uint32_t frames_free(void) {
+    return frame_pool_free + zero_pool_count + zero_pool_inflight;
+}
+
+/* zero_pool_drain
+ * Gives every frame in the zero pool back to the frame pool. Interrupts must be disabled.
+ * Return value: 1 if there were any, 0 if the zero pool was empty */
+static int zero_pool_drain(void) {
+    if(!zero_pool_count) return 0;
+    while(zero_pool_count) free_frames(zero_pool[--zero_pool_count]);
+    return 1;
+}
+
+/* alloc_zeroed_frame
+ * Allocates a single zeroed frame, like alloc_frames(1) followed by a memset. Takes one
+ * the idle loop already zeroed if there is one, so the caller doesn't wait on it. Safe
+ * to call with interrupts disabled, never waits.
+ * Return value: the frame, NULL if out of memory */
+void *alloc_zeroed_frame(void) {
+    uint32_t flags;
+    void *frame = NULL;
+    cli_and_save(flags);
+    if(zero_pool_count) frame = zero_pool[--zero_pool_count];
+    restore_flags(flags);
+    if(!frame && (frame = alloc_frames(1)) != NULL) memset_dword(frame, 0, PAGE_SIZE / 4);
+    return frame;
+}
+
+/* zero_pool_refill
+ * Zeroes a frame for the zero pool, if it isn't full. Called from the idle loop with
+ * interrupts disabled. They get enabled while the frame is being zeroed, so interrupts
+ * don't wait on it, and are disabled again before returning.
+ * Return value: 1 if it zeroed a frame, 0 (without ever enabling interrupts) if the
+ *               pool is full or there's no memory to spare */
+int zero_pool_refill(void) {
+    void *frame;
+    /* leave the last frames to whoever really needs them */
+    if(zero_pool_count >= ZERO_POOL_SIZE || frame_pool_free <= ZERO_POOL_SIZE) return 0;
+    if(!(frame = alloc_frames(1))) return 0;
+    zero_pool_inflight = 1;
+    sti();
+    memset_dword(frame, 0, PAGE_SIZE / 4);
+    cli();
+    zero_pool_inflight = 0;
+    /* an interrupt might have filled the pool (or emptied it) in the meantime */
+    if(zero_pool_count < ZERO_POOL_SIZE) zero_pool[zero_pool_count++] = frame;
+    else free_frames(frame);
+    return 1;
+}
+
+/* frame_index
+ * Return value: the pool index of frame, which must be the start of an allocated run
+ * Side effects: Panics if it isn't */
+static uint32_t frame_index(void *frame) {
+    uint32_t addr = (uint32_t) frame;
+    uint32_t idx = (addr - FRAME_POOL_START) / PAGE_SIZE;
+    if(addr < FRAME_POOL_START || (addr & (PAGE_SIZE-1)) || idx >= frame_pool_len ||
+            !frame_run_len[idx])
+        panic_msg("frame %#x was not allocated by alloc_frames!", addr);
+    return idx;
+}
+
+/* get_frame
+ * Adds a reference to a run of frames from alloc_frames, which starts out with one.
+ * Inputs: frame - the address alloc_frames returned */
+void get_frame(void *frame) {
+    uint32_t flags, idx;
+    cli_and_save(flags);
+    idx = frame_index(frame);
+    if(frame_refs[idx] == 0xFFFF) panic_msg("frame %#x refcount overflow!", frame);
+    ++frame_refs[idx];
+    restore_flags(flags);
+}
+
+/* put_frame
+ * Drops a reference to a run of frames, freeing them once the last one is gone.
+ * Inputs: frame - the address alloc_frames returned */
+void put_frame(void *frame) {
+    uint32_t flags, idx;
+    cli_and_save(flags);
+    idx = frame_index(frame);
+    if(--frame_refs[idx] == 0) free_frames(frame);
+    restore_flags(flags);
+}
+
+/* frame_refcount
+ * Return value: the number of references to a run of frames */
+uint32_t frame_refcount(void *frame) {
+    return frame_refs[frame_index(frame)];
+}
+
+/* invlpg
+ * Flushes the TLB entry for a single page */
+static inline void invlpg(uint32_t addr) {
+    asm volatile("invlpg (%0)" :: "r"(addr) : "memory");
+}
+
+/* current_page_dir
+ * Return value: the page directory CR3 points at, identity mapped like every page
+ *               directory */
+static inline pd_ent_t *current_page_dir(void) {
+    return (pd_ent_t*)(read_cr3().page_dir_base << 12);
+}
+
+/* user_pd_ent
+ * Return value: the first of the page directory entries that map user memory in the
+ *               current page directory */
+static inline pd_ent_t *user_pd_ent(void) {
+    return &current_page_dir()[USER_VMEM_START >> 22];
+}
+
+/* load_page_dir
+ * Points CR3 at a page directory, unless it already is. The kernel's mappings are
+ * global, so they stay in the TLB. Interrupts must be disabled. */
+static inline void load_page_dir(pd_ent_t *page_dir) {
+    cr3_t cr3 = read_cr3();
+    if(cr3.page_dir_base == (uint32_t) page_dir >> 12) return;
+    cr3.page_dir_base = (uint32_t) page_dir >> 12;
+    write_cr3(cr3);
+}
+
+/* page_dir_create
+ * Makes a page directory for a process: the kernel's global mappings, plus its user
+ * memory. Kernel mappings are all set up during boot, before any process exists, so
+ * copying kernel_page_dir's entries is enough to share them.
+ * Inputs: user_pt - page table of the process's user memory
+ * Return value: the page directory, NULL if out of memory */
+pd_ent_t *page_dir_create(pt_ent_t *user_pt) {
+    pd_ent_t *page_dir = alloc_frames(1);
+    uint32_t i;
+    if(!page_dir) return NULL;
+    memcpy(page_dir, kernel_page_dir, PAGE_SIZE);
+    for(i = 0; i < USER_NUM_PTS; ++i) {
+        pd_ent_t *pd_ent = &page_dir[(USER_VMEM_START >> 22) + i];
+        pd_ent->val = 0;
+        pd_ent->present = 1;
+        pd_ent->write_enable = 1; /* the pages decide what's writable */
+        pd_ent->user_access = 1;
+        pd_ent->base = ((uint32_t) user_pt >> 12) + i;
+    }
+    return page_dir;
+}
+
+/* page_dir_vidmap
+ * Maps the user video memory page at USER_VIDMAP in a page directory, giving it its
+ * own page table for it.
+ * Inputs: page_dir - page directory of the process
+ *         terminal_id - terminal whose video memory to map
+ * Return value: 0 on success, -1 if out of memory */
+int32_t page_dir_vidmap(pd_ent_t *page_dir, uint32_t terminal_id) {
+    pd_ent_t *pd_ent = &page_dir[USER_VIDMAP >> 22];
+    pt_ent_t *page_table, *pt_ent;
+    uint32_t flags;
+    if(pd_ent->present) return 0;
+    if(!(page_table = alloc_zeroed_frame())) return -1;
+    pt_ent = &page_table[(USER_VIDMAP & (PAGE_4M_SIZE-1)) >> 12];
+    pt_ent->present = 1;
+    pt_ent->write_enable = 1;
+    pt_ent->user_access = 1;
+    pt_ent->write_through = 1; /* make sure writes get sent out to VGA */
+    pt_ent->base = (VIDEO >> 12) + terminal_id + 2; // 4KB index of the terminal's vidmem page
+    cli_and_save(flags);
+    pd_ent->val = 0;
+    pd_ent->present = 1;
+    pd_ent->write_enable = 1;
+    pd_ent->user_access = 1;
+    pd_ent->base = (uint32_t) page_table >> 12;
+    /* only the one page changed, no need to flush the whole TLB */
+    if(page_dir == current_page_dir()) invlpg(USER_VIDMAP);
+    restore_flags(flags);
+    return 0;
+}
+
+/* page_dir_destroy
+ * Frees a process's page directory, and its vidmap page table. Its user memory has to be
+ * freed separately, with user_space_destroy.
+ * Inputs: page_dir - the page directory, can be NULL
+ * Side effects: Switches to kernel_page_dir if page_dir is the current one, i.e. when a
+ *               process exits, or a kernel thread that borrowed its page directory kills
+ *               it */
+void page_dir_destroy(pd_ent_t *page_dir) {
+    uint32_t flags;
+    if(!page_dir) return;
+    cli_and_save(flags);
+    if(page_dir == current_page_dir()) load_page_dir(kernel_page_dir);
+    if(page_dir[USER_VIDMAP >> 22].present)
+        free_frames((void*)(page_dir[USER_VIDMAP >> 22].base << 12));
+    free_frames(page_dir);
+    restore_flags(flags);
+}
+
+/* user_space_create
+ * Makes an empty user address space, i.e. the USER_NUM_PTS page tables covering user
+ * memory, in one run of frames. All of its pages start out not present, and get filled
+ * with zeroed frames the first time they're touched (see user_page_fault), so a process
+ * only uses memory it really needs.
+ * Return value: the page tables, NULL if out of memory */
+pt_ent_t *user_space_create(void) {
+    pt_ent_t *page_table = alloc_frames(USER_NUM_PTS);
+    if(page_table) memset_dword(page_table, 0, USER_NUM_PTS * PAGE_SIZE / 4);
+    return page_table;
+}
+
+/* user_space_clone
+ * Makes a copy-on-write copy of a user address space. Both copies share every frame
+ * read-only, and whichever process writes to a page first gets its own copy of it then.
+ * Inputs: page_table - the address space to copy
+ * Return value: the new page table, NULL if out of memory
+ * Side effects: Write protects all of page_table's pages, flushes the TLB */
+pt_ent_t *user_space_clone(pt_ent_t *page_table) {
+    uint32_t flags, i;
+    pt_ent_t *copy = alloc_frames(USER_NUM_PTS);
+    if(!copy) return NULL;
+    cli_and_save(flags);
+    for(i = 0; i < USER_NUM_PAGES; ++i) {
+        if(page_table[i].present) {
+            /* shared memory pages stay shared, writes are meant to be seen */
+            if(page_table[i].write_enable && !(page_table[i].avail & PTE_AVAIL_SHARED)) {
+                page_table[i].write_enable = 0;
+                page_table[i].avail |= PTE_AVAIL_COW;
+            }
+            get_frame((void*)(page_table[i].base << 12));
+        }
+        copy[i] = page_table[i];
+    }
+    /* the parent's pages might be cached as writable */
+    write_cr3(read_cr3());
+    restore_flags(flags);
+    return copy;
+}
+
+/* user_space_destroy
+ * Frees a user address space, along with every frame no one else shares. A process's
+ * page directory should be destroyed first, so nothing maps the page table anymore.
+ * Inputs: page_table - the address space to free, can be NULL
+ * Side effects: Unmaps user memory if page_table is the one currently mapped in */
+void user_space_destroy(pt_ent_t *page_table) {
+    uint32_t flags, i;
+    if(!page_table) return;
+    cli_and_save(flags);
+    if(user_pd_ent()->present && user_pd_ent()->base == (uint32_t) page_table >> 12) {
+        for(i = 0; i < USER_NUM_PTS; ++i) user_pd_ent()[i].val = 0;
+        write_cr3(read_cr3());
+    }
+    for(i = 0; i < USER_NUM_PAGES; ++i) {
+        if(page_table[i].present) put_frame((void*)(page_table[i].base << 12));
+    }
+    free_frames(page_table);
+    restore_flags(flags);
+}
+
+/* user_range_check
+ * Checks that a range is entirely inside user memory, whether or not anything's mapped
+ * there.
+ * Return value: 0 if it is, -1 if not */
+static int32_t user_range_check(uint32_t addr, uint32_t len) {
+    if(addr < USER_VMEM_START || addr > USER_VMEM_END) return -1;
+    return len <= USER_VMEM_END - addr ? 0 : -1;
+}
+
+/* user_space_map_shared
+ * Maps frames into a user address space so they're shared with whoever else maps them,
+ * including across fork. Each mapping holds a reference to its frame.
+ * Inputs: page_table - the address space
+ *         addr - page aligned user address to map the first frame at
+ *         frames - frames from alloc_frames(1), one per page
+ *         count - number of frames
+ * Return value: 0 on success, -1 if the range isn't page aligned, goes outside user
+ *               memory, or any page of it is already in use
+ * Side effects: Flushes the TLB entries of the mapped pages */
+int32_t user_space_map_shared(pt_ent_t *page_table, uint32_t addr, void **frames,
+        uint32_t count) {
+    uint32_t flags, i, idx = (addr - USER_VMEM_START) >> 12;
+    if((addr & (PAGE_SIZE-1)) || count == 0 || user_range_check(addr, count * PAGE_SIZE))
+        return -1;
+    cli_and_save(flags);
+    for(i = 0; i < count; ++i) {
+        if(page_table[idx + i].present) {
+            restore_flags(flags);
+            return -1;
+        }
+    }
+    for(i = 0; i < count; ++i) {
+        get_frame(frames[i]);
+        page_table[idx + i].val = 0;
+        page_table[idx + i].present = 1;
+        page_table[idx + i].write_enable = 1;
+        page_table[idx + i].user_access = 1;
+        page_table[idx + i].avail = PTE_AVAIL_SHARED;
+        page_table[idx + i].base = (uint32_t) frames[i] >> 12;
+        invlpg(addr + i * PAGE_SIZE);
+    }
+    restore_flags(flags);
+    return 0;
+}
+
+/* user_space_unmap
+ * Unmaps pages of a user address space, dropping their frames. They read back as zero
+ * the next time they're touched.
+ * Inputs: page_table - the address space
+ *         addr - page aligned user address of the first page
+ *         count - number of pages, the range has to be inside user memory
+ * Side effects: Flushes the TLB entries of the unmapped pages */
+void user_space_unmap(pt_ent_t *page_table, uint32_t addr, uint32_t count) {
+    uint32_t flags, i, idx = (addr - USER_VMEM_START) >> 12;
+    cli_and_save(flags);
+    for(i = 0; i < count; ++i) {
+        if(!page_table[idx + i].present) continue;
+        put_frame((void*)(page_table[idx + i].base << 12));
+        page_table[idx + i].val = 0;
+        invlpg(addr + i * PAGE_SIZE);
+    }
+    restore_flags(flags);
+}
+
+/* user_page_fault
+ * Page fault hook, fills in demand-zero pages inside the current process's regions and
+ * breaks copy-on-write sharing in user memory. Faults from the kernel are handled too,
+ * since syscalls access user buffers.
+ * Inputs: vect - PAGE_FAULT_VECTOR
+ *         context - state of the faulting code, for the error code
+ * Return value: 1 if the fault was fixed up, 0 if it's a real fault or there's no
+ *               memory to fix it up with
+ * Side effects: Allocates frames */
+static int user_page_fault(uint32_t vect, iret_context_base_t *context) {
+    uint32_t addr = read_cr2().val, flags;
+    pt_ent_t *pte;
+    void *frame;
+    pcb_t *pcb = get_current_pcb();
+    if(addr < USER_VMEM_START || addr >= USER_VMEM_END || !user_pd_ent()->present)
+        return 0;
+    /* the page tables are contiguous, see user_space_create */
+    pte = &((pt_ent_t*)(user_pd_ent()->base << 12))[(addr - USER_VMEM_START) >> 12];
+    /* so nothing else changes the page or its frame's sharers while we look at them */
+    cli_and_save(flags);
+    if(!pte->present) {
+        /* without a process (i.e. tests during boot) any page can be filled in */
+        if(pcb->present && !vma_find(pcb, addr)) goto fail;
+        if(!(frame = alloc_zeroed_frame())) goto out_of_memory;
+        pte->val = 0;
+        pte->present = 1;
+        pte->write_enable = 1;
+        pte->user_access = 1;
+        pte->base = (uint32_t) frame >> 12;
+    } else if((context->error_code & PF_ERR_WRITE) && (pte->avail & PTE_AVAIL_COW)) {
+        frame = (void*)(pte->base << 12);
+        /* the last one sharing a frame can just take it over */
+        if(frame_refcount(frame) > 1) {
+            void *copy = alloc_frames(1);
+            if(!copy) goto out_of_memory;
+            memcpy(copy, frame, PAGE_SIZE);
+            put_frame(frame);
+            pte->base = (uint32_t) copy >> 12;
+        }
+        pte->avail &= ~PTE_AVAIL_COW;
+        pte->write_enable = 1;
+    } else {
+        goto fail;
+    }
+    invlpg(addr);
+    restore_flags(flags);
+    return 1;
+
+out_of_memory:
+    /* exception_handler_all takes it from here, same as any other bad access */
+    log_msg("out of memory paging in %#x", addr);
+fail:
+    restore_flags(flags);
+    return 0;
+}
+
 /* void set_user_page(int32_t pid)
- * Sets up the page directory entry for user memory
+ * Switches to a process's page directory, which maps its user memory and vidmap page.
+ * That's a single CR3 load, and since kernel pages are global, their TLB entries
+ * survive it.
  * Inputs: pid - the process's pid to get user page info from
  * Outputs: none
  * Return value: none
- * Side effects: Changes the page directory entry for user memory
+ * Side effects: Loads CR3, flushing the TLB entries of the previous process
  */
 void set_user_page(uint32_t pid) {
     uint32_t flags;
     cli_and_save(flags);
     pcb_t *pcb = pid_to_pcb(pid);
-    int32_t address =  (pid + 2)  * PAGE_4M_SIZE; //TODO: make as a macro later
-    kernel_page_dir[32].base_4m = address >> 22;  // At 128 MB virtual memory
-    pt_ent_t *user_vidmap_pt_ent = &user_vidmap_page_table[
-            (USER_VIDMAP & (PAGE_4M_SIZE-1)) >> 12];
-    user_vidmap_pt_ent->present = pcb->vidmap;
-    // user_vidmap_pt_ent->base = pcb->terminal_id == get_active_terminal_id() ?
-    //         VIDEO >> 12 : (VIDEO >> 12) + pcb->terminal_id + 1; // 4KB index of vidmem page
-    user_vidmap_pt_ent->base = (VIDEO >> 12) + pcb->terminal_id + 2; // 4KB index of vidmem page
-    // need interrupts disabled because an interrupt between this read and write would be bad.
-    // plus between the above and below, yeah
-    write_cr3(read_cr3());
+    load_page_dir(pcb->page_dir ? pcb->page_dir : kernel_page_dir);
     restore_flags(flags);
 }
 
@@ -208,43 +694,101 @@ int32_t syscall_vidmap(int32_t arg1, int32_t arg2, int32_t arg3) {
     pcb_t *pcb = get_current_pcb();
     if(pcb->vidmap) return 0; // it's already mapped
     // TODO: check if the above behaviour for a double vidmap call is correct
+    if(page_dir_vidmap(pcb->page_dir, pcb->terminal_id)) return -1;
+    pcb->vidmap = 1;
+    return 0;
+}
+
+/* set_brk
+ * Moves the current process's program break. Pages between the old and new break come
+ * and go a whole page at a time: new ones are demand-zero (see user_page_fault), and
+ * ones the heap shrinks off of get unmapped, freeing their frames.
+ * Inputs: brk - the new break, from pcb->brk_start to USER_BRK_MAX
+ * Return value: 0 on success, -1 if brk is out of range, or the heap would grow into
+ *               another region */
+static int32_t set_brk(uint32_t brk) {
+    pcb_t *pcb = get_current_pcb();
+    uint32_t old_end = (pcb->brk + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    uint32_t new_end = (brk + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
     uint32_t flags;
+    if(brk < pcb->brk_start || brk > USER_BRK_MAX) return -1;
     cli_and_save(flags);
-    pcb->vidmap = 1;
-    set_user_page(pcb_to_pid(pcb));
+    if(vma_set_heap_end(pcb, new_end)) {
+        restore_flags(flags);
+        return -1;
+    }
+    if(new_end < old_end)
+        user_space_unmap(pcb->user_pt, new_end, (old_end - new_end) / PAGE_SIZE);
+    pcb->brk = brk;
     restore_flags(flags);
     return 0;
 }
 
+/* syscall_brk
+ * Sets the end of the current process's heap (the program break). The heap starts at the
+ * first page boundary after the program image, and its memory only gets used as it's
+ * touched.
+ * Inputs: arg1 - the new break, or 0 to just look it up
+ *         arg2 - not used
+ *         arg3 - not used
+ * Return value: the break, -1 if it couldn't be moved there
+ * Side effects: Frees the pages the heap shrinks off of */
+int32_t syscall_brk(int32_t arg1, int32_t arg2, int32_t arg3) {
+    if(arg1 && set_brk((uint32_t) arg1)) return -1;
+    return get_current_pcb()->brk;
+}
+
+/* syscall_sbrk
+ * Grows or shrinks the current process's heap, see syscall_brk.
+ * Inputs: arg1 - number of bytes to move the break by, can be negative
+ *         arg2 - not used
+ *         arg3 - not used
+ * Return value: the old break, i.e. the start of the new memory when growing, -1 if it
+ *               couldn't be moved
+ * Side effects: Frees the pages the heap shrinks off of */
+int32_t syscall_sbrk(int32_t arg1, int32_t arg2, int32_t arg3) {
+    uint32_t old = get_current_pcb()->brk;
+    /* both ends are well inside the address space, so this can't wrap around */
+    if(arg1 > USER_BRK_MAX - USER_VMEM_START || arg1 < USER_VMEM_START - USER_BRK_MAX ||
+            set_brk(old + arg1))
+        return -1;
+    return old;
+}
+
 /* check_user_bounds
- * Checks that the provided buffer fits entirely within the virtual user page.
+ * Checks that the provided buffer is entirely inside the current process's regions
+ * (see vma.h), or inside user memory if there is no current process.
  * Inputs: buf - Pointer to the start of the buffer. (i.e. smallest address in it)
  *         len - The length of the buffer, in bytes.
  * Returns: 0 if it does fit, -1 if not
  * Side effects + Outputs: none
- * Time complexity: Constant */
+ * Time complexity: Logarithmic in the number of regions */
 int32_t check_user_bounds(const void *buf, uint32_t len) {
+    pcb_t *pcb = get_current_pcb();
     uint32_t buf_int = (uint32_t) buf;
-    if(buf_int < USER_VMEM_START) return -1;
-    if(buf_int > USER_VMEM_END) return -1;
-    uint32_t max_len = USER_VMEM_END - buf_int;
-    return len <= max_len ? 0 : -1;
+    if(user_range_check(buf_int, len)) return -1;
+    if(!pcb->present) return 0;
+    return len <= vma_extent(pcb, buf_int) - buf_int ? 0 : -1;
 }
 
 /* check_user_str_bounds
- * Checks that there exists a null terminated string entirely in the user page at the given
- * address that is no longer than max_len.
+ * Checks that there exists a null terminated string entirely in the current process's
+ * regions (or in user memory, without a current process) at the given address that is
+ * no longer than max_len.
  * Inputs: str - Pointer to the user space C string.
  *         max_len - The maximum length that the string can be, excluding the null
  *                   terminator.
- * Returns: 0 on success, -1 on outside of user page, -2 on buffer exceeds max_len
+ * Returns: 0 on success, -1 on outside of user memory, -2 on buffer exceeds max_len
  * Side effects + Outputs: none
  * Time complexity: Linear in the length of the string */
 int32_t check_user_str_bounds(const uint8_t *str, uint32_t max_len) {
+    pcb_t *pcb = get_current_pcb();
+    uint32_t end = USER_VMEM_END;
     if((uint32_t) str < USER_VMEM_START) return -1;
+    if(pcb->present) end = vma_extent(pcb, (uint32_t) str);
     int i;
     for(i = 0; i < max_len+1; ++i, ++str) {
-        if((uint32_t) str >= USER_VMEM_END) return -1;
+        if((uint32_t) str >= end) return -1;
         if(*str == 0) return 0;
     }
     return -2;
@@ -13,15 +13,37 @@
 /* how many entries per page table/directory, 1<<10, each 4-bytes for a total of 4KiB */
 #define PAGE_TBL_LEN (1<<10)
 
-/* The start of the user page in virtual memory. */
+/* user memory is USER_NUM_PTS page tables' worth (16MiB). the tables sit in physically
+ * contiguous frames, so a process's user_pt can be indexed straight across all of them */
+#define USER_NUM_PTS 4
+#define USER_NUM_PAGES (USER_NUM_PTS * PAGE_TBL_LEN)
+/* The start of user memory in virtual memory. */
 #define USER_VMEM_START 0x08000000
-/* The end of the user page in virtual memory. */
-#define USER_VMEM_END (USER_VMEM_START+PAGE_4M_SIZE)
+/* The end of user memory in virtual memory. */
+#define USER_VMEM_END (USER_VMEM_START + USER_NUM_PTS * PAGE_4M_SIZE)
+/* size of the stack region, which grows down from USER_VMEM_END */
+#define USER_STACK_RESERVE (256 * PAGE_SIZE)
+/* how many zeroed frames the idle loop keeps ready for alloc_zeroed_frame */
+#define ZERO_POOL_SIZE 32
+/* highest the program break (end of the heap, see syscall_brk) can go */
+#define USER_BRK_MAX (USER_VMEM_END - USER_STACK_RESERVE)
+
+/* avail bit of a read-only user page table entry that marks it as copy-on-write, the
+ * first write to it gets a private copy of the frame (if it's still shared) */
+#define PTE_AVAIL_COW 0x1
+/* avail bit of a user page table entry mapping a shared memory page, which stays
+ * shared (and writable) across fork instead of becoming copy-on-write */
+#define PTE_AVAIL_SHARED 0x2
+
+/* page fault error code bits, x86 ISA manual vol 3 section 5.15 */
+#define PF_ERR_PRESENT 0x1
+#define PF_ERR_WRITE 0x2
+#define PF_ERR_USER 0x4
 
 /* Virtual address of the start of the user video memory 4Kb page.
  * Can't find any information on what this value should be, so just set it
  * to an arbitrary value past the user page. */
-#define USER_VIDMAP 0x09000000
+#define USER_VIDMAP USER_VMEM_END
 
 /* the following structs come from the x86 ISA manual vol 3 section 3.7.6,
  * "Page-Directory and Page-Table Entries" */
@@ -92,11 +114,31 @@ typedef pt_ent_t __attribute((aligned(PAGE_SIZE))) page_tbl_t[PAGE_TBL_LEN];
 
 extern page_dir_t kernel_page_dir;
 extern page_tbl_t low_page_table;
-extern page_tbl_t user_vidmap_page_table;
 
 extern void paging_init(void);
 extern void set_user_page(uint32_t pid);
 
+extern void frame_pool_init(uint32_t mem_upper, uint32_t reserve_start, uint32_t reserve_end);
+extern void *alloc_frames(uint32_t count);
+extern void free_frames(void *frame);
+extern uint32_t frames_free(void);
+extern void get_frame(void *frame);
+extern void put_frame(void *frame);
+extern uint32_t frame_refcount(void *frame);
+extern void *alloc_zeroed_frame(void);
+extern int zero_pool_refill(void);
+
+extern pd_ent_t *page_dir_create(pt_ent_t *user_pt);
+extern int32_t page_dir_vidmap(pd_ent_t *page_dir, uint32_t terminal_id);
+extern void page_dir_destroy(pd_ent_t *page_dir);
+
+extern pt_ent_t *user_space_create(void);
+extern pt_ent_t *user_space_clone(pt_ent_t *page_table);
+extern void user_space_destroy(pt_ent_t *page_table);
+extern int32_t user_space_map_shared(pt_ent_t *page_table, uint32_t addr, void **frames,
+        uint32_t count);
+extern void user_space_unmap(pt_ent_t *page_table, uint32_t addr, uint32_t count);
+
 extern int32_t check_user_bounds(const void *buf, uint32_t len);
 extern int32_t check_user_str_bounds(const uint8_t *str, uint32_t max_len);
 
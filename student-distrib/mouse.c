@@ -5,6 +5,7 @@
 #include "lib.h"
 #include "idt.h"
 #include "i8259.h"
+#include "gui.h"
 
 #define PS2_CMD_PORT 0x64 // PS2 IO port
 #define PS2_DATA_PORT 0x60 // PS2 IO port
@@ -118,6 +119,8 @@ static int mouse_handler(uint32_t irq) {
         break;
     }
     mouse_pos = (mouse_pos+1) % MOUSE_PACKET_LEN;
+    // the cursor and on screen keyboard get updated in do_render
+    if(mouse_pos == 0) gui_request_render();
 
     send_eoi(MOUSE_IRQ);
     return 1; // serviced interrupt
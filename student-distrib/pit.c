@@ -6,14 +6,134 @@
 #include "i8259.h"
 #include "lib.h"
 #include "process.h"
+#include "sched.h"
 #include "syscall.h"
 #include "gui.h"
+#include "kthread.h"
+#include "timer.h"
+#include "apic.h"
 
 volatile int enable_pit_test = 0;
+volatile uint32_t jiffies = 0;
+uint32_t pit_hz = PIT_DEFAULT_HZ;
 static int pit_handler(uint32_t irq);
+static void pit_render_work(void *data);
+
+/* redraws the screen from the worker thread, since copying a whole frame around is too
+ * much to do with interrupts off */
+static work_t render_work = WORK_INIT(&pit_render_work, NULL);
+
+/* PIT input clock cycles per jiffy, PIT_FREQ / pit_hz */
+static uint32_t counts_per_jiffy = PIT_FREQ / PIT_DEFAULT_HZ;
+/* length of the one-shot currently counting down in PIT cycles, 0 if the PIT is stopped,
+ * how many of those cycles have already been added to jiffies, and the jiffy the
+ * one-shot ends at */
+static uint32_t armed_counts = 0;
+static uint32_t armed_accounted = 0;
+static uint32_t armed_deadline = 0;
+/* PIT cycles that have passed but don't add up to a whole jiffy yet */
+static uint32_t count_remainder = 0;
+static int pit_ready = 0;
+/* when the next frame may be drawn, and when the current time slice runs out */
+static uint32_t next_render = 0;
+static uint32_t next_quantum = 0;
+
+/* pit_account
+ * Adds PIT cycles that have passed to jiffies, carrying over the leftover fraction
+ * of a jiffy. Interrupts must be disabled. */
+static void pit_account(uint32_t counts) {
+    count_remainder += counts;
+    jiffies += count_remainder / counts_per_jiffy;
+    count_remainder %= counts_per_jiffy;
+}
+
+/* pit_elapsed
+ * Return value: PIT cycles since the current one-shot was armed
+ * Side effects: Reads from the PIT. Interrupts must be disabled. */
+static uint32_t pit_elapsed(void) {
+    uint8_t status;
+    uint32_t count;
+    if(!armed_counts) return 0;
+    outb(0xC2, PIT_CMD_PORT); // 1100 0010 - read back status and count of channel 0
+    status = inb(PIT_DATA_PORT);
+    count = inb(PIT_DATA_PORT);
+    count |= inb(PIT_DATA_PORT) << 8;
+    /* in mode 0 the output pin goes high once the count hits zero, after which the
+     * counter wraps around and keeps going, so the count is meaningless */
+    if(status & 0x80) return armed_counts;
+    /* the count hasn't been loaded into the counter yet */
+    if(status & 0x40) return 0;
+    return count > armed_counts ? armed_counts : armed_counts - count;
+}
+
+/* pit_now
+ * Brings jiffies up to date with the one-shot currently counting down.
+ * Return value: the current jiffy
+ * Side effects: Reads from the PIT. Interrupts must be disabled. */
+static uint32_t pit_now(void) {
+    uint32_t elapsed = pit_elapsed();
+    pit_account(elapsed - armed_accounted);
+    armed_accounted = elapsed;
+    return jiffies;
+}
+
+/* pit_next_deadline
+ * Finds the earliest deadline that currently matters: the next frame, if the screen is
+ * dirty or anything is runnable (since processes can draw through vidmap without us
+ * knowing), the end of the time slice, if there's someone to preempt to (and the APIC
+ * timer isn't taking care of that), and the next jiffy the timer wheel needs
+ * servicing at.
+ * Inputs: deadline - where to put the deadline
+ * Return value: 1 if there is a deadline, 0 if the PIT can stay stopped */
+static int pit_next_deadline(uint32_t *deadline) {
+    uint32_t nr_running = sched_nr_running();
+    uint32_t timer_deadline;
+    int found = 0;
+    if(render_pending || nr_running > 0) {
+        *deadline = next_render;
+        found = 1;
+    }
+    if(!apic_timer_in_use && nr_running > 1 &&
+            (!found || time_after_eq(*deadline, next_quantum))) {
+        *deadline = next_quantum;
+        found = 1;
+    }
+    if(timer_next_deadline(&timer_deadline) &&
+            (!found || time_after_eq(*deadline, timer_deadline))) {
+        *deadline = timer_deadline;
+        found = 1;
+    }
+    return found;
+}
+
+/* pit_program_next
+ * Arms the PIT for the earliest deadline, replacing any one-shot that's already counting
+ * down. With no deadlines, the PIT is stopped.
+ * Side effects: Writes to the PIT. Interrupts must be disabled. */
+static void pit_program_next(void) {
+    uint32_t deadline, counts;
+    int32_t delta;
+    pit_now();
+    armed_counts = armed_accounted = 0;
+    if(!pit_next_deadline(&deadline)) {
+        outb(0x30, PIT_CMD_PORT); // mode 0 without loading a count, the countdown stops
+        return;
+    }
+    delta = deadline - jiffies;
+    if(delta < 1) delta = 1;
+    /* far off deadlines take several one-shots to get to */
+    if(delta > 0xFFFF / counts_per_jiffy) delta = 0xFFFF / counts_per_jiffy;
+    /* don't count the part of the current jiffy that already passed twice */
+    counts = delta * counts_per_jiffy - count_remainder;
+    outb(0x30, PIT_CMD_PORT); // 0011 0000 - channel 0, lobyte/hibyte, interrupt on terminal count
+    outb(counts & 0xFF, PIT_DATA_PORT);
+    outb((counts >> 8) & 0xFF, PIT_DATA_PORT);
+    armed_counts = counts;
+    armed_deadline = jiffies + delta;
+}
 
 /* pit_init
- * Initializes the PIT to a default frequency.
+ * Sets up the PIT for one-shot operation, and arms it for the first deadline.
  * Inputs: none
  * Outputs: none
  * Return value: none
@@ -22,17 +142,70 @@ static int pit_handler(uint32_t irq);
 void pit_init() {
     uint32_t flags;
     cli_and_save(flags);
-    /* set the PIT to a default frequency */
-    outb(0x36, PIT_DATA_PORT); // 0011 0110 - channel 0, lobyte/hibyte, rate generator
-    outb(PIT_DEFAULT_TIME & 0xFF, PIT_DATA_PORT);
-    outb((PIT_DEFAULT_TIME >> 8) & 0xFF, PIT_DATA_PORT);
+    /* switching to one-shot mode without loading a count stops the BIOS's periodic tick */
+    outb(0x30, PIT_CMD_PORT);
 
     enable_irq(PIT_IRQ);
-    
+
     static irq_handler_node_t pit_handler_node = IRQ_HANDLER_NODE_INIT;
     pit_handler_node.handler = &pit_handler;
     irq_register_handler(PIT_IRQ, &pit_handler_node);
 
+    pit_ready = 1;
+    pit_program_next();
+
+    restore_flags(flags);
+}
+
+/* pit_kick
+ * Rearms the PIT if something now needs it earlier than it's armed for (or at all, if
+ * it's stopped). Only touches the PIT when that's the case, since this gets called on
+ * every bit of terminal output.
+ * Side effects: Might write to the PIT */
+void pit_kick(void) {
+    uint32_t flags, deadline;
+    pcb_t *curr_pcb = get_current_pcb();
+    cli_and_save(flags);
+    /* the current process's slice might have run out while it was alone */
+    if(apic_timer_in_use && sched_nr_running() > 1)
+        apic_timer_kick(curr_pcb->present ? curr_pcb->timeslice : sched_default_timeslice);
+    if(pit_ready && pit_next_deadline(&deadline) &&
+            (!armed_counts || !time_after_eq(deadline, armed_deadline))) {
+        pit_program_next();
+    }
+    restore_flags(flags);
+}
+
+/* pit_jiffies
+ * Reads the PIT to find out how much of the current one-shot has passed, since jiffies
+ * only gets updated when the PIT is touched.
+ * Return value: the current jiffy
+ * Side effects: Reads from the PIT */
+uint32_t pit_jiffies(void) {
+    uint32_t flags, now;
+    cli_and_save(flags);
+    now = pit_ready ? pit_now() : jiffies;
+    restore_flags(flags);
+    return now;
+}
+
+/* pit_start_slice
+ * Starts a new time slice for the process about to run, on the APIC timer if there is
+ * one, which saves reprogramming the PIT on every context switch.
+ * Inputs: ms - length of the time slice in milliseconds
+ *         now - the current jiffy, from pit_jiffies, so the PIT isn't read again
+ * Side effects: Might write to the PIT or the local APIC */
+void pit_start_slice(uint32_t ms, uint32_t now) {
+    uint32_t flags;
+    cli_and_save(flags);
+    if(!apic_timer_start(ms)) {
+        restore_flags(flags);
+        return;
+    }
+    if(pit_ready) {
+        next_quantum = now + ms_to_jiffies(ms);
+        pit_kick();
+    }
     restore_flags(flags);
 }
 
@@ -41,36 +214,69 @@ void pit_init() {
  * Inputs: irq - The IRQ number that was triggered.
  * Outputs: none
  * Return value: none
- * Side effects: Calls the scheduler to switch tasks.
+ * Side effects: Queues a redraw of the screen, expires timers, calls the scheduler to
+ *               switch tasks, rearms the PIT.
  */
 int pit_handler(uint32_t irq) {
-    /* call the scheduler to switch tasks */
+    int quantum_expired = 0;
     if(enable_pit_test) printf("PIT interrupt\n");
     send_eoi(PIT_IRQ);
 
-    do_render(); // in gui.c
+    uint32_t now = pit_now();
+
+    if((render_pending || sched_nr_running()) && time_after_eq(now, next_render)) {
+        queue_work(&render_work);
+        next_render = now + ms_to_jiffies(PIT_RENDER_MS);
+    }
+    if(!apic_timer_in_use && time_after_eq(now, next_quantum)) {
+        quantum_expired = 1;
+        /* do_schedule starts the next slice, this is just in case nothing gets scheduled */
+        next_quantum = now + ms_to_jiffies(sched_default_timeslice);
+    }
+    /* wakes up sleepers, which only go on the run queues, do_schedule below or in
+     * irq_handler gets to them */
+    timer_run(now);
+    /* rearm before scheduling, since we might not come back here for a while */
+    pit_program_next();
 
     pcb_t *curr_pcb = get_current_pcb();
 
     // this check ensures we don't invoke the scheduler before processes are running
-    if(curr_pcb->present) {
+    if(quantum_expired && curr_pcb->present) {
         do_schedule(0); // switch, don't jump, so pass in 0 as arg
     }
 
     return 1; /* handled the irq */
 }
 
+/* pit_render_work
+ * Runs do_render for the PIT handler, in the worker thread.
+ * Inputs: data - not used */
+static void pit_render_work(void *data) {
+    do_render(); // in gui.c
+}
 
 /* pit_setrate
- * Sets the PIT to a specified frequency.
- * Inputs: rate - The frequency to set the PIT to.
+ * Sets how many jiffies there are per second, i.e. the resolution of every deadline the
+ * PIT gets programmed for. Higher rates give more precise time slices and frame timing,
+ * lower ones let one-shots run longer before they have to be rearmed. Only works before
+ * pit_init: after that, timer expiries, process CPU times and the scheduler's virtual
+ * times are all stored in jiffies, and would mean something else in the new unit.
+ * Inputs: rate - the new jiffy rate in Hz, PIT_MIN_HZ to PIT_MAX_HZ
  * Outputs: none
- * Return value: none
- * Side effects: Changes the PIT frequency.
+ * Return value: 0 on success, -1 if rate is out of range or the PIT is already running
+ * Side effects: Sets the unit of jiffies
  */
-// void pit_setrate(uint32_t rate) {
-//     uint16_t divisor = PIT_FREQ / rate;
-//     outb(0x36, PIT_CMD_PORT); // 0011 0110 - channel 0, lobyte/hibyte, rate generator
-//     outb(divisor & 0xFF, PIT_DATA_PORT);
-//     outb((divisor >> 8) & 0xFF, PIT_DATA_PORT);
-// }
+int32_t pit_setrate(uint32_t rate) {
+    uint32_t flags;
+    if(rate < PIT_MIN_HZ || rate > PIT_MAX_HZ) return -1;
+    cli_and_save(flags);
+    if(pit_ready) {
+        restore_flags(flags);
+        return -1;
+    }
+    pit_hz = rate;
+    counts_per_jiffy = PIT_FREQ / rate;
+    restore_flags(flags);
+    return 0;
+}
@@ -11,14 +11,59 @@
 #define PIT_DATA_PORT 0x40
 
 #define PIT_FREQ 1193182 // base frequency
-#define PIT_MAX_FREQ 50 // max frequency
-#define PIT_DEFAULT_TIME (1193182 / 50) // default frequency
+/* range of jiffy rates pit_setrate accepts. the slowest still fits a whole jiffy in the
+ * 16 bit counter, the fastest is a 100us resolution */
+#define PIT_MIN_HZ 19
+#define PIT_MAX_HZ 10000
+#define PIT_DEFAULT_HZ 1000
+/* redraw the screen at most 50 times a second, the old periodic PIT rate */
+#define PIT_RENDER_MS 20
+
+#ifndef ASM
 
 extern volatile int enable_pit_test;
 
+/* jiffies of timer time since boot. the PIT runs in one-shot mode, programmed for the
+ * next thing that actually needs doing, and isn't armed at all when there's nothing to
+ * wait for, so jiffies stands still while the system is completely idle. */
+extern volatile uint32_t jiffies;
+/* jiffies per second, set with pit_setrate */
+extern uint32_t pit_hz;
+
+/* true if jiffy a is at or after jiffy b, even across wrap around */
+#define time_after_eq(a, b) ((int32_t)((a) - (b)) >= 0)
+
 void pit_init();
 
-// void pit_setrate(uint32_t rate);
+/* pit_kick
+ * Tells the PIT that there might be a new deadline, i.e. a process became runnable or the
+ * screen needs redrawing. Arms the timer if it was stopped. Safe to call from interrupt
+ * handlers. */
+void pit_kick(void);
 
-#endif
+/* pit_jiffies
+ * Return value: the current jiffy, brought up to date with the PIT's countdown */
+uint32_t pit_jiffies(void);
 
+/* pit_start_slice
+ * Starts a time slice of ms milliseconds for the process about to be switched to, once
+ * it runs out the PIT (or the local APIC timer, see apic_init) calls do_schedule. now
+ * is the current jiffy, which the scheduler already read from pit_jiffies. */
+void pit_start_slice(uint32_t ms, uint32_t now);
+
+/* pit_setrate
+ * Sets the jiffy rate (PIT_MIN_HZ to PIT_MAX_HZ), which is the resolution of all of the
+ * PIT's deadlines. Has to be called before pit_init, the rate is fixed from then on.
+ * Return value: 0 on success, -1 if rate is out of range or pit_init already ran */
+int32_t pit_setrate(uint32_t rate);
+
+/* ms_to_jiffies
+ * Return value: the number of jiffies in ms milliseconds, at least 1 */
+static inline uint32_t ms_to_jiffies(uint32_t ms) {
+    /* split up so long delays don't overflow */
+    uint32_t j = (ms / 1000) * pit_hz + (ms % 1000) * pit_hz / 1000;
+    return j ? j : 1;
+}
+
+#endif /* ASM */
+#endif
@@ -8,11 +8,15 @@
 #include "x86_desc.h"
 #include "mm.h"
 #include "terminal.h"
+#include "sched.h"
+#include "fpu.h"
+#include "pit.h"
 
 int enable_process_switching_test = 0;
 
 static void proc_entry(void);
 static void proc_entry0(void);
+static custom_ctx_fn_t fork_entry;
 
 
 
@@ -36,6 +40,52 @@ void init_proc_mgmt() {
 
 
 
+/* find_free_stack
+ * Finds the kernel stack (and so PCB) of a process slot that isn't in use.
+ * Interrupts should be disabled, so the slot doesn't get taken in the meantime.
+ * Return value: the kernel stack, NULL if all NUM_PROCESSES slots are taken */
+static kernel_stack_t *find_free_stack(void) {
+    kernel_stack_t *stack = kernel_stacks_start-1;
+    int i;
+    // find first non-present stack
+    for(i = 0; i < NUM_PROCESSES && stack->pcb.present; ++i, --stack);
+    return i == NUM_PROCESSES ? NULL : stack;
+}
+
+/* init_proc_stats
+ * Zeroes a new process's accounting, starting its clock now. */
+static void init_proc_stats(pcb_t *pcb) {
+    memset(&pcb->stats, 0, sizeof(pcb->stats));
+    pcb->stats.start_jiffy = pcb->stats.last_run = pit_jiffies();
+}
+
+/* image_end
+ * Finds where a program's memory image ends, which is past the end of the file when it
+ * has a .bss. The file gets copied into memory as is, so the ELF program headers are only
+ * used for this.
+ * Inputs: inode - the program file
+ *         file_length - its length
+ * Return value: the first user address after the image, page aligned */
+static uint32_t image_end(uint32_t inode, uint32_t file_length) {
+    uint32_t end = USER_PROG_START + file_length, phoff, phnum, i, seg[6];
+    uint16_t half[2];
+    if(sizeof(phoff) == read_data(inode, ELF_PHOFF, (uint8_t*)&phoff, sizeof(phoff)) &&
+            sizeof(half) == read_data(inode, ELF_PHENTSIZE, (uint8_t*)half, sizeof(half)) &&
+            half[0] >= sizeof(seg)) {
+        phnum = half[1] < ELF_MAX_PHDRS ? half[1] : ELF_MAX_PHDRS;
+        for(i = 0; i < phnum; ++i) {
+            /* p_type, p_offset, p_vaddr, p_paddr, p_filesz, p_memsz */
+            if(sizeof(seg) != read_data(inode, phoff + i * half[0], (uint8_t*)seg,
+                    sizeof(seg)))
+                break;
+            if(seg[0] == ELF_PT_LOAD && seg[2] >= USER_PROG_START && seg[2] < USER_VMEM_END &&
+                    seg[5] < USER_VMEM_END - seg[2] && seg[2] + seg[5] > end)
+                end = seg[2] + seg[5];
+        }
+    }
+    return (end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+}
+
 /* alloc_process
  * Allocates a process and PCB, partially initializing it, but does not switch to it
  * Inputs: parent - pointer to the parent process's PCB, can be null to indicate no parent
@@ -49,14 +99,12 @@ void init_proc_mgmt() {
  * Side effects: Allocates a new process and kernel stack, reads from file system,
  *               opens some file descriptors. */
 pcb_t *alloc_process(pcb_t *parent, const uint8_t *cmdline, int terminal) {
-    kernel_stack_t *stack = kernel_stacks_start-1;
+    kernel_stack_t *stack = find_free_stack();
     int i;
     // uint32_t flags;
     // save interrupt flag since while we're modifying the PCB's
     // cli_and_save(flags);
-    // find first non-present stack
-    for(i = 0; i < NUM_PROCESSES && stack->pcb.present; ++i, --stack);
-    if(i == NUM_PROCESSES) {
+    if(!stack) {
         // restore_flags(flags);
         return NULL;
     }
@@ -64,9 +112,38 @@ pcb_t *alloc_process(pcb_t *parent, const uint8_t *cmdline, int terminal) {
     pcb_t *pcb = &stack->pcb;
     pcb->terminal_id = terminal; // Store the terminal ID in the PCB
     pcb->present = 1;
-    pcb->running = 1;
+    /* not runnable until everything's set up, see the sched_wake at the end */
+    pcb->running = 0;
+    pcb->sleeping = 0;
+    pcb->fpu_used = 0;
+    pcb->background = 0;
+    pcb->zombie = 0;
+    pcb->orphan = 0;
+    /* process PCBs sit in kernel stacks that aren't zeroed, unlike kthread_create's */
+    pcb->kthread = 0;
     pcb->vidmap = 0;
     pcb->parent = parent;
+    pcb->wait_queue = NULL;
+    pcb->wait_next = NULL;
+    pcb->child_queue.head = NULL;
+    timer_init(&pcb->sleep_timer, NULL, NULL);
+    pcb->sig_pending = 0;
+    pcb->sig_masked = 0;
+    memset(pcb->sig_handlers, 0, sizeof(pcb->sig_handlers));
+    timer_init(&pcb->alarm_timer, NULL, NULL);
+    pcb->alarm_ms = 0;
+    pcb->shm_held = 0;
+    pcb->ipc_receiving = 0;
+    pcb->ipc_send_queue.head = NULL;
+    pcb->ipc_recv_queue.head = NULL;
+    pcb->fg_boost = 0;
+    pcb->policy = parent ? parent->policy : SCHED_NORMAL;
+    pcb->rt_prio = parent ? parent->rt_prio : 0;
+    pcb->nice = parent ? parent->nice : 0;
+    /* not parent->prio, a kernel thread's level isn't one a process can have */
+    pcb->prio = sched_policy_prio(pcb->policy, pcb->rt_prio, pcb->nice);
+    pcb->rt_run = 0;
+    pcb->timeslice = parent ? parent->timeslice : sched_default_timeslice;
     uint8_t prog_name[ARG_LENGTH];
     i = 0;
     // skip over spaces
@@ -133,13 +210,32 @@ pcb_t *alloc_process(pcb_t *parent, const uint8_t *cmdline, int terminal) {
         // restore_flags(flags);
         return NULL;
     }
-    if(inode_start[dentry.inode].file_length > (USER_VMEM_END - USER_PROG_START)) {
-        // program too big for page
+    if(inode_start[dentry.inode].file_length > (USER_BRK_MAX - USER_PROG_START) ||
+            image_end(dentry.inode, inode_start[dentry.inode].file_length) > USER_BRK_MAX) {
+        // program too big to fit below the stack
         pcb->present = 0;
         return NULL;
     }
 
     pcb->inode = dentry.inode;
+    pcb->brk_start = pcb->brk = image_end(dentry.inode, inode_start[dentry.inode].file_length);
+    vma_init(pcb);
+    strncpy((int8_t*) pcb->name, (int8_t*) prog_name, PROC_NAME_LEN);
+    pcb->name[PROC_NAME_LEN-1] = '\0';
+    init_proc_stats(pcb);
+
+    /* the program image gets paged in by proc_entry */
+    pcb->user_pt = user_space_create();
+    if(!pcb->user_pt) {
+        pcb->present = 0;
+        return NULL;
+    }
+    pcb->page_dir = page_dir_create(pcb->user_pt);
+    if(!pcb->page_dir) {
+        user_space_destroy(pcb->user_pt);
+        pcb->present = 0;
+        return NULL;
+    }
 
     fd_info_t *fd_info = &pcb->fds[0];
     fd_info->present = 1;
@@ -155,20 +251,76 @@ pcb_t *alloc_process(pcb_t *parent, const uint8_t *cmdline, int terminal) {
     }
     pcb->context.esp = &stack->stack[KERNEL_STACK_SIZE];
     pcb->context.eip = &proc_entry0;
+    sched_wake(pcb);
     // restore_flags(flags);
     return pcb;
 }
 
 
 
+/* exit_process
+ * Tears down a process that's exiting: closes its file descriptors, frees its memory,
+ * and hands its exit code to its parent. Children it leaves behind that already exited
+ * get freed, the rest become orphans that free themselves. A process without a parent
+ * (a terminal's shell) gets respawned.
+ * Interrupts must be disabled. Doesn't switch away, so if pcb is the current process,
+ * the caller has to jump to the next one.
+ * Inputs: pcb - the exiting process
+ *         exit_code - the exit code for the process
+ * Side effects: Frees the PCB unless the parent still has to collect the exit code,
+ *               wakes up the parent, might allocate a new shell process. */
+static void exit_process(pcb_t *pcb, int32_t exit_code) {
+    int i;
+    pcb->exit_code = exit_code;
+    sched_block(pcb);
+    timer_del(&pcb->sleep_timer);
+    timer_del(&pcb->alarm_timer);
+    ipc_exit(pcb);
+    fpu_release(pcb);
+    for(i = 0; i < FD_PER_PROC; ++i) {
+        fd_info_t *fd = &pcb->fds[i];
+        if(fd->present) fd->file_ops->close(fd);
+    }
+    /* whoever runs next loads their own page directory, until then we're on the
+     * kernel's */
+    page_dir_destroy(pcb->page_dir);
+    pcb->page_dir = NULL;
+    user_space_destroy(pcb->user_pt);
+    pcb->user_pt = NULL;
+    shm_release(pcb);
+
+    for(i = 0; i < NUM_PROCESSES; ++i) {
+        pcb_t *child = pid_to_pcb(i);
+        if(!child->present || child->parent != pcb) continue;
+        if(child->zombie) {
+            child->present = 0;
+        } else {
+            child->parent = NULL;
+            child->orphan = 1;
+        }
+    }
+
+    if(pcb->parent != NULL) {
+        pcb->zombie = 1;
+        sched_wake_all(&pcb->parent->child_queue);
+    } else if(pcb->orphan) {
+        pcb->present = 0;
+    } else {
+        pcb->present = 0;
+        pcb_t *new_shell = alloc_process(NULL, (uint8_t*) "shell", pcb->terminal_id);
+        if(!new_shell) panic_msg("unable to start new shell");
+    }
+}
+
+
 /* kill_curr_process
- * Terminates the current process and transfers control to the parent process.
- * If the current process has no parent, it starts a new shell.
+ * Terminates the current process and switches to the next runnable one. The parent (if
+ * any) gets woken up to collect the exit code. If the current process has no parent,
+ * it starts a new shell.
  * Inputs: exit_code - the exit code for the process
  * Outputs: None
  * Return value: Never returns (unless the current process is not present, then it does return)
- * Side effects: Modifies the running and present status of the current PCB. Closes all file descriptors of the process.
- *               If the current process has no parent, allocates a new PCB for a new shell and jumps to it.
+ * Side effects: See exit_process.
  */
 void kill_curr_process(int32_t exit_code) {
     pcb_t *process = get_current_pcb();
@@ -176,36 +328,21 @@ void kill_curr_process(int32_t exit_code) {
     cli();
     // interrupts have to be disabled for this whole code, otherwise pcb pointers might go
     // invalid
-    process->exit_code = exit_code;
-    process->running = 0;
-    int i;
-    for(i = 0; i < FD_PER_PROC; ++i) {
-        fd_info_t *fd = &process->fds[i];
-        if(fd->present) fd->file_ops->close(fd);
-    }
-
-    pcb_t *parent = process->parent;
-    if(parent != NULL) {
-        parent->running = 1;
-        jump_to_process(parent);
-    } else {
-        process->present = 0;
-        // TODO CP5, pass process->terminal to child
-        pcb_t *new_shell = alloc_process(NULL, (uint8_t*) "shell", process->terminal_id);
-        if(!new_shell) panic_msg("unable to start new shell");
-        jump_to_process(new_shell);
-    }
+    exit_process(process, exit_code);
+    do_schedule(1);
 }
 
 
-/* kill_curr_process
- * Terminates the current process and transfers control to the parent process.
- * If the current process has no parent, it starts a new shell.
- * Inputs: exit_code - the exit code for the process
+/* kill_term_process
+ * Terminates the foreground processes of the active terminal, i.e. the ones that are
+ * running or sleeping, except for background jobs and processes waiting on a child
+ * (which will wake up once their child is gone). Processes with an INTERRUPT handler
+ * get the signal instead.
+ * Inputs: exit_code - the exit code for the processes
  * Outputs: None
  * Return value: None
- * Side effects: Modifies the running and present status of the current PCB. Closes all file descriptors of the process.
- *               If the current process has no parent, allocates a new PCB for a new shell and jumps to it.
+ * Side effects: See exit_process. Jumps to the next runnable process if the current
+ *               one got killed.
  */
 void kill_term_process(int32_t exit_code) {
     int active_terminal_id = get_active_terminal_id();
@@ -217,25 +354,18 @@ void kill_term_process(int32_t exit_code) {
     int i;
     for(i = 0; i < NUM_PROCESSES; ++i) {
         pcb_t *pcb = pid_to_pcb(i);
-        if(pcb->running && pcb->present && pcb->terminal_id == active_terminal_id) {
-            if(curr_pcb == pcb) need_to_jump = 1;
-            // The following code is taken from kill_curr_process
-            pcb->exit_code = exit_code;
-            pcb->running = 0;
-            int j;
-            for(j = 0; j < FD_PER_PROC; ++j) {
-                fd_info_t *fd = &pcb->fds[j];
-                if(fd->present) fd->file_ops->close(fd);
-            }
-
-            pcb_t *parent = pcb->parent;
-            if(parent != NULL) {
-                parent->running = 1;
-            } else {
-                pcb->present = 0;
-                pcb_t *new_shell = alloc_process(NULL, (uint8_t*) "shell", pcb->terminal_id);
-                if(!new_shell) panic_msg("unable to start new shell");
+        /* sleeping processes count too, otherwise a shell waiting on the keyboard
+         * couldn't be killed */
+        if((pcb->running || pcb->sleeping) && pcb->present && !pcb->background &&
+                pcb->wait_queue != &pcb->child_queue &&
+                pcb->terminal_id == active_terminal_id) {
+            /* processes that handle INTERRUPT get to decide for themselves */
+            if(signal_has_handler(pcb, SIG_INTERRUPT)) {
+                send_signal(pcb, SIG_INTERRUPT);
+                continue;
             }
+            if(curr_pcb == pcb) need_to_jump = 1;
+            exit_process(pcb, exit_code);
         }
     }
 
@@ -281,7 +411,7 @@ static void proc_entry(void) {
     uint32_t pid = pcb_to_pid(pcb);
     set_user_page(pid);
 
-    if(0 > read_data(pcb->inode, 0, (uint8_t*) USER_PROG_START, PAGE_4M_SIZE)) {
+    if(0 > read_data(pcb->inode, 0, (uint8_t*) USER_PROG_START, pcb->brk_start - USER_PROG_START)) {
         panic_msg("huh? unable to read program image?");
     }
 
@@ -298,6 +428,7 @@ static void proc_entry(void) {
     uctx.base.eflags = 0x202;
     cli(); // make sure our modifications to tss don't get changed
     tss.esp0 = (uint32_t)(((kernel_stack_t*)pcb) + 1);
+    fpu_switch_in(pcb);
     // I'm pretty sure writing to tss in memory is enough and no ltr instruction is needed
     pop_iret_context(&uctx.base);
 }
@@ -338,8 +469,13 @@ int32_t switch_to_process(pcb_t *pcb) {
     uint32_t flags;
     cli_and_save(flags);
     swap_context(&curr_pcb->context, &pcb->context);
-    set_user_page(pcb_to_pid(curr_pcb));
-    tss.esp0 = (uint32_t)(((kernel_stack_t*)curr_pcb) + 1);
+    /* kernel threads never touch user memory or come in from user mode, so they just
+     * leave the last process's page directory and esp0 in place, saving a CR3 load */
+    if(!curr_pcb->kthread) {
+        set_user_page(pcb_to_pid(curr_pcb));
+        tss.esp0 = (uint32_t)(((kernel_stack_t*)curr_pcb) + 1);
+    }
+    fpu_switch_in(curr_pcb);
     restore_flags(flags);
     return 0;
 }
@@ -360,83 +496,140 @@ int32_t jump_to_process(pcb_t *pcb) {
     return 0; // never runs
 }
 
-/* do_schedule
- * Switches to the next running process after the current one so as to perform
- * round robin scheduling. If none of the processes are running, it halts, waiting for
- * an interrupt to occur, then checks again.
- * Inputs: jump - Boolean, non-zero to call jump_to_process, zero to call switch_to_process
- * Return value: void if jump is false, never returns otherwise
- * Side effects: Calls (switch|jump)_to_process, so the we must currently be switched in to a
- * process (i.e. not on the initial kernel stack). */
-void do_schedule(int jump) {
-    uint32_t flags;
-    cli_and_save(flags);
-
-    pcb_t *curr_pcb = get_current_pcb();
-    uint32_t curr_pid = pcb_to_pid(curr_pcb);
-    if(!jump && !curr_pcb->present) panic_msg("switch without current process present!");
-    do {
-        int switched = 0;
-        uint32_t i;
-        for(i = 0; i < NUM_PROCESSES; ++i) {
-            pcb_t *next = pid_to_pcb((curr_pid + i + 1) % NUM_PROCESSES);
-            if(next->present && next->running) {
-                if(jump) jump_to_process(next);
-                else switch_to_process(next);
-                switched = 1;
-                break; // break out of inner for loop and check if we're runnable
-            }
-        }
-        if(!switched) {
-            // if we didn't find any running processes, wait until next hardware interrupt
-            asm volatile ("sti; hlt; cli");
-        }
-    } while(jump || !(curr_pcb->present && curr_pcb->running));
-
-    restore_flags(flags);
+/* reap_child
+ * Collects the exit code of a zombie child process, freeing its PCB.
+ * Interrupts must be disabled.
+ * Inputs: child - the zombie
+ * Return value: its exit code */
+static int32_t reap_child(pcb_t *child) {
+    if(!child->zombie) panic_msg("reaping a process that hasn't exited!");
+    child->zombie = 0;
+    child->present = 0;
+    return child->exit_code;
 }
 
 /* syscall_execute
- * Executes a new process with the specified command.
+ * Executes a new process with the specified command, and waits for it to finish.
  * Inputs: arg1 - pointer to the command string
  *         arg2 - not used
  *         arg3 - not used
  * Outputs: None
  * Return value: the exit code of the child process, or -1 if the command is NULL or exceeds the maximum length, 
  *               or if a new process cannot be allocated
- * Side effects: Disables interrupts. Allocates a new PCB for the child process and switches to it. 
- *               Sets the running status of the current process to 0. If the new process cannot be switched to, 
- *               it causes a panic.
+ * Side effects: Disables interrupts. Allocates a new PCB for the child process, and
+ *               sleeps until it exits.
  */
 int32_t syscall_execute(int32_t arg1, int32_t arg2, int32_t arg3) {
     const uint8_t *command = *(const uint8_t**) &arg1;
     if(!command) return -1;
     if(check_user_str_bounds(command, ARG_LENGTH-1)) return -1;
+    return execute_process(command, get_current_pcb()->terminal_id);
+}
+
+
+/* execute_process
+ * Runs a command as a child of the current process (or kernel thread), and waits for it
+ * to finish. The kernel side of the execute syscall.
+ * Inputs: command - the command line, in kernel memory or already checked
+ *         terminal - terminal the child runs on
+ * Return value: the exit code of the child process, or -1 if a new process cannot be
+ *               allocated
+ * Side effects: Allocates a new PCB for the child process, and sleeps until it exits. */
+int32_t execute_process(const uint8_t *command, int terminal) {
     pcb_t *current = get_current_pcb();
 
     uint32_t flags;
     cli_and_save(flags);
-    /* disable interrupts so that processes dont disappear under our feet, and so we don't
-     * get stuck with current->running off, never to be scheduled again */
+    /* disable interrupts so that processes dont disappear under our feet, and so the
+     * child can't exit between checking on it and going to sleep */
 
-    // TODO CP5, pass current->terminal to child
-    pcb_t *child = alloc_process(get_current_pcb(), command, current->terminal_id);
+    pcb_t *child = alloc_process(current, command, terminal);
     if(!child) {
         restore_flags(flags);
         return -1;
     }
-    current->running = 0;
-    // the parent running flag gets set by kill_curr_process
-    if(switch_to_process(child)) panic_msg("unable to switch to new process!");
+    // we get woken back up by exit_process
+    while(!child->zombie) sched_sleep(&current->child_queue);
 
-    // at this point, child will have its exit_code set
-    int32_t exit_code = child->exit_code;
-    child->present = 0;
+    int32_t exit_code = reap_child(child);
     restore_flags(flags);
     return exit_code;
 }
 
 
+/* syscall_spawn
+ * Starts a new process with the specified command as a background job, without
+ * waiting for it. Collect its exit code with waitpid once it's done.
+ * Inputs: arg1 - pointer to the command string
+ *         arg2 - not used
+ *         arg3 - not used
+ * Outputs: None
+ * Return value: the pid of the new process, or -1 if the command is NULL or too long,
+ *               or if a new process cannot be allocated
+ * Side effects: Allocates a new PCB for the child process, which runs on the same
+ *               terminal. */
+int32_t syscall_spawn(int32_t arg1, int32_t arg2, int32_t arg3) {
+    const uint8_t *command = *(const uint8_t**) &arg1;
+    if(!command) return -1;
+    if(check_user_str_bounds(command, ARG_LENGTH-1)) return -1;
+    pcb_t *current = get_current_pcb();
+
+    uint32_t flags;
+    cli_and_save(flags);
+    pcb_t *child = alloc_process(current, command, current->terminal_id);
+    if(!child) {
+        restore_flags(flags);
+        return -1;
+    }
+    child->background = 1;
+    restore_flags(flags);
+    return pcb_to_pid(child);
+}
+
+
+/* syscall_waitpid
+ * Waits for a child process to exit and collects its exit code, freeing its PCB.
+ * Inputs: arg1 - pid of the child to wait for, or -1 for any child
+ *         arg2 - pointer to where to store the exit code, can be NULL
+ *         arg3 - flags, WAIT_NOHANG to return right away if no child has exited yet
+ * Outputs: *arg2 - the exit code
+ * Return value: the pid of the child that exited, 0 if WAIT_NOHANG was given and no
+ *               child has exited yet, -1 if there's no such child or on bad arguments
+ * Side effects: Might sleep until a child exits */
+int32_t syscall_waitpid(int32_t arg1, int32_t arg2, int32_t arg3) {
+    int32_t pid = arg1;
+    int32_t *status = (int32_t*) arg2;
+    if(pid < -1 || pid >= NUM_PROCESSES) return -1;
+    if(status && check_user_bounds(status, sizeof(*status))) return -1;
+    if(arg3 & ~WAIT_NOHANG) return -1;
+    pcb_t *current = get_current_pcb();
+
+    uint32_t flags;
+    cli_and_save(flags);
+    while(1) {
+        int found = 0;
+        int i;
+        for(i = 0; i < NUM_PROCESSES; ++i) {
+            pcb_t *child = pid_to_pcb(i);
+            if(!child->present || child->parent != current) continue;
+            if(pid != -1 && pid != i) continue;
+            found = 1;
+            if(child->zombie) {
+                int32_t exit_code = reap_child(child);
+                restore_flags(flags);
+                if(status) *status = exit_code;
+                return i;
+            }
+        }
+        if(!found || (arg3 & WAIT_NOHANG)) {
+            restore_flags(flags);
+            return found ? 0 : -1;
+        }
+        sched_sleep(&current->child_queue);
+    }
+}
+
+
 /* syscall_halt
  * Terminates the current process and returns control to the parent process.
  * Inputs: arg1 - the exit status of the current process
@@ -475,3 +668,174 @@ int32_t syscall_getargs(int32_t arg1, int32_t arg2, int32_t arg3) {
     strncpy((int8_t*) buf, (int8_t*) current->args, nbytes);
     return 0;
 }
+
+
+/* fork_entry
+ * Entry point of a process made by fork. Maps in its user memory and returns to user
+ * space right where the parent made the syscall.
+ * Inputs: buf - the iret_context_user_t to return to user space with
+ *         buf_len - size of buf
+ * Outputs: None
+ * Return value: Never returns
+ * Side effects: Sets up the user page and TSS for the new process. */
+static void fork_entry(void *buf, uint32_t buf_len) {
+    pcb_t *pcb = get_current_pcb();
+    // interrupts are still disabled from the context switch
+    set_user_page(pcb_to_pid(pcb));
+    tss.esp0 = (uint32_t)(((kernel_stack_t*)pcb) + 1);
+    fpu_switch_in(pcb);
+    pop_iret_context((iret_context_base_t*) buf);
+}
+
+
+/* syscall_fork
+ * Duplicates the current process. The child gets a copy of the parent's file
+ * descriptors, FPU state, and user memory, which is shared copy-on-write, so only
+ * the pages either one writes to afterwards actually get copied.
+ * Inputs: arg1 - not used
+ *         arg2 - not used
+ *         arg3 - not used
+ * Outputs: None
+ * Return value: the child's pid in the parent, 0 in the child, -1 if there's no free
+ *               process slot or not enough memory
+ * Side effects: Allocates a new PCB, makes the parent's user memory read-only until
+ *               it gets written to. The child runs on the same terminal, its exit code
+ *               can be collected with waitpid. */
+int32_t syscall_fork(int32_t arg1, int32_t arg2, int32_t arg3) {
+    pcb_t *parent = get_current_pcb();
+    /* the syscall came from user space, so its context sits at the top of the stack */
+    iret_context_user_t uctx = *((iret_context_user_t*)(((kernel_stack_t*)parent) + 1) - 1);
+    uint32_t flags;
+    int i;
+    cli_and_save(flags);
+
+    kernel_stack_t *stack = find_free_stack();
+    if(!stack) {
+        restore_flags(flags);
+        return -1;
+    }
+    pcb_t *child = &stack->pcb;
+    child->user_pt = user_space_clone(parent->user_pt);
+    if(!child->user_pt) {
+        restore_flags(flags);
+        return -1;
+    }
+    child->page_dir = page_dir_create(child->user_pt);
+    if(!child->page_dir || (parent->vidmap &&
+            page_dir_vidmap(child->page_dir, parent->terminal_id))) {
+        page_dir_destroy(child->page_dir);
+        child->page_dir = NULL;
+        user_space_destroy(child->user_pt);
+        child->user_pt = NULL;
+        restore_flags(flags);
+        return -1;
+    }
+    child->present = 1;
+    child->running = 0;
+    child->sleeping = 0;
+    child->background = parent->background;
+    child->zombie = 0;
+    child->orphan = 0;
+    child->kthread = 0;
+    child->vidmap = parent->vidmap;
+    child->parent = parent;
+    child->exit_code = 0;
+    child->terminal_id = parent->terminal_id;
+    child->inode = parent->inode;
+    memcpy(child->args, parent->args, ARG_LENGTH);
+    memcpy(child->name, parent->name, PROC_NAME_LEN);
+    init_proc_stats(child);
+    child->wait_queue = NULL;
+    child->wait_next = NULL;
+    child->child_queue.head = NULL;
+    timer_init(&child->sleep_timer, NULL, NULL);
+    /* handlers are inherited, and so is the mask in case we're in one, but pending
+     * signals and the alarm aren't */
+    child->sig_pending = 0;
+    child->sig_masked = parent->sig_masked;
+    memcpy(child->sig_handlers, parent->sig_handlers, sizeof(child->sig_handlers));
+    timer_init(&child->alarm_timer, NULL, NULL);
+    child->alarm_ms = 0;
+    shm_fork(child, parent);
+    child->brk_start = parent->brk_start;
+    child->brk = parent->brk;
+    vma_fork(child, parent);
+    child->ipc_receiving = 0;
+    child->ipc_send_queue.head = NULL;
+    child->ipc_recv_queue.head = NULL;
+    child->fg_boost = 0;
+    child->policy = parent->policy;
+    child->rt_prio = parent->rt_prio;
+    child->nice = parent->nice;
+    child->prio = sched_policy_prio(child->policy, child->rt_prio, child->nice);
+    child->rt_run = 0;
+    child->timeslice = parent->timeslice;
+    fpu_fork(child, parent);
+
+    for(i = 0; i < FD_PER_PROC; ++i) {
+        child->fds[i] = parent->fds[i];
+        if(child->fds[i].present && child->fds[i].file_ops->dup)
+            child->fds[i].file_ops->dup(&child->fds[i], &parent->fds[i]);
+    }
+
+    uctx.base.eax = 0; // fork returns 0 in the child
+    make_context(&child->context, &stack->stack[KERNEL_STACK_SIZE], &fork_entry,
+            &uctx, sizeof(uctx));
+    sched_wake(child);
+    restore_flags(flags);
+    return pcb_to_pid(child);
+}
+
+
+/* jiffies_to_ms
+ * Converts a jiffy count to milliseconds without overflowing along the way */
+static uint32_t jiffies_to_ms(uint32_t j) {
+    return (j / pit_hz) * 1000 + (j % pit_hz) * 1000 / pit_hz;
+}
+
+/* syscall_procinfo
+ * Reports what a process has been up to: CPU time, context switches, syscalls, and
+ * bytes read and written through file descriptors.
+ * Inputs: arg1 - pid of the process to look at, 0 to NUM_PROCESSES-1, or -1 for the
+ *                calling process (whose pid ends up in the info)
+ *         arg2 - pointer to a procinfo_t to fill in
+ *         arg3 - not used
+ * Outputs: *arg2 - the process's info
+ * Return value: the number of pids (NUM_PROCESSES) on success, so callers can loop
+ *               over all of them, -1 if there's no such process or on bad arguments
+ * Side effects: none */
+int32_t syscall_procinfo(int32_t arg1, int32_t arg2, int32_t arg3) {
+    procinfo_t *user_info = (procinfo_t*) arg2;
+    procinfo_t info;
+    if(arg1 == -1) arg1 = pcb_to_pid(get_current_pcb());
+    if(arg1 < 0 || arg1 >= NUM_PROCESSES) return -1;
+    if(!user_info || check_user_bounds(user_info, sizeof(info))) return -1;
+    pcb_t *pcb = pid_to_pcb(arg1);
+
+    uint32_t flags;
+    cli_and_save(flags);
+    if(!pcb->present) {
+        restore_flags(flags);
+        return -1;
+    }
+    // the caller's own CPU time is only charged up to its last switch otherwise
+    if(pcb == get_current_pcb()) sched_charge_current();
+    memset(&info, 0, sizeof(info));
+    info.pid = arg1;
+    info.parent_pid = pcb->parent ? (int32_t) pcb_to_pid(pcb->parent) : -1;
+    info.terminal = pcb->terminal_id;
+    info.nice = pcb->nice;
+    info.state = pcb->zombie ? 'Z' : pcb->running ? 'R' : 'S';
+    info.background = pcb->background;
+    info.cpu_ms = jiffies_to_ms(pcb->stats.cpu_jiffies);
+    info.age_ms = jiffies_to_ms(pit_jiffies() - pcb->stats.start_jiffy);
+    info.nr_switches = pcb->stats.nr_switches;
+    info.nr_syscalls = pcb->stats.nr_syscalls;
+    info.bytes_read = pcb->stats.bytes_read;
+    info.bytes_written = pcb->stats.bytes_written;
+    memcpy(info.name, pcb->name, PROC_NAME_LEN);
+    restore_flags(flags);
+
+    memcpy(user_info, &info, sizeof(info));
+    return NUM_PROCESSES;
+}
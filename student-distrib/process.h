@@ -7,6 +7,13 @@
 #include "fd.h"
 #include "swtch.h"
 #include "syscall.h"
+#include "fpu.h"
+#include "mm.h"
+#include "timer.h"
+#include "signal.h"
+#include "shm.h"
+#include "ipc.h"
+#include "vma.h"
 
 /* 8KiB kernel stacks */
 #define KERNEL_STACK_SIZE (1 << 13)
@@ -23,12 +30,68 @@
 #define EXCEPTION_STATUS 256
 #define TERMINATED_STATUS 257
 
+/* waitpid flag, return right away if no child has exited yet */
+#define WAIT_NOHANG 1
+
+/* how much of the program name procinfo reports, including the null terminator */
+#define PROC_NAME_LEN 32
+
 /* Address to which program image is copied. */
 #define USER_PROG_START 0x08048000
+/* ELF header fields (offsets into the file) needed to find the end of a program's .bss,
+ * see image_end in process.c */
+#define ELF_PHOFF 28
+#define ELF_PHENTSIZE 42
+#define ELF_PT_LOAD 1
+#define ELF_MAX_PHDRS 16
 
 #ifndef ASM
 
 typedef struct pcb_t pcb_t;
+
+/* proc_stats_t
+ * Per-process accounting, cheap enough to keep up to date on every switch and syscall.
+ * cpu_jiffies counts jiffies spent running (charged whenever the process gets switched
+ * away from, see sched.c) */
+typedef struct proc_stats_t {
+    uint32_t start_jiffy;
+    uint32_t cpu_jiffies;
+    /* jiffy the process last got switched in at */
+    uint32_t last_run;
+    uint32_t nr_switches;
+    uint32_t nr_syscalls;
+    uint32_t bytes_read;
+    uint32_t bytes_written;
+} proc_stats_t;
+
+/* procinfo_t
+ * What the procinfo syscall copies out to user space about a process. */
+typedef struct procinfo_t {
+    int32_t pid;
+    int32_t parent_pid; /* -1 without a parent */
+    int32_t terminal;
+    int32_t nice;
+    uint8_t state; /* 'R'unnable, 'S'leeping, 'Z'ombie */
+    uint8_t background;
+    uint16_t reserved;
+    uint32_t cpu_ms;
+    uint32_t age_ms;
+    uint32_t nr_switches;
+    uint32_t nr_syscalls;
+    uint32_t bytes_read;
+    uint32_t bytes_written;
+    uint8_t name[PROC_NAME_LEN];
+} procinfo_t;
+
+/* wait_queue_t
+ * A list of processes sleeping until some event happens, linked through the wait_next
+ * field of their PCB's. See sched.h. */
+typedef struct wait_queue_t wait_queue_t;
+struct wait_queue_t {
+    pcb_t *head;
+};
+#define WAIT_QUEUE_INIT { NULL }
+
 struct pcb_t {
     pcb_t *parent;
     context_t context;
@@ -36,13 +99,87 @@ struct pcb_t {
     /* flag for whether the process can be run by the scheduler */
     uint32_t running : 1;
     uint32_t vidmap : 1;
-    uint32_t flags : 29;
+    /* flag for whether the process is blocked on a wait queue, see sched.h */
+    uint32_t sleeping : 1;
+    /* flag for whether fpu_state holds anything, i.e. the process has used the FPU */
+    uint32_t fpu_used : 1;
+    /* flag for background jobs (started by spawn), which Ctrl+C leaves alone */
+    uint32_t background : 1;
+    /* flag for processes that have exited, but whose parent hasn't collected the exit
+     * code yet. the PCB stays allocated until then */
+    uint32_t zombie : 1;
+    /* flag for processes whose parent exited first. no one can collect their exit code,
+     * so they free their PCB themselves */
+    uint32_t orphan : 1;
+    /* flag for kernel threads, which only ever run in kernel mode, see kthread.h */
+    uint32_t kthread : 1;
+    /* flag for processes waiting for a message, see ipc.c */
+    uint32_t ipc_receiving : 1;
+    /* flag for foreground processes queued ahead of their priority after waking up,
+     * see sched_wake */
+    uint32_t fg_boost : 1;
+    uint32_t flags : 21;
     int32_t exit_code;
     fd_info_t fds[FD_PER_PROC];
     uint8_t args[ARG_LENGTH];
     uint32_t inode;
     /* terminal ID */
     int terminal_id;
+    /* scheduler state, see sched.c. policy is one of the SCHED_NORMAL/BATCH/FIFO classes
+     * in sched.h, rt_prio only means something for SCHED_FIFO */
+    uint32_t policy;
+    uint32_t rt_prio;
+    int32_t nice;
+    uint32_t prio;
+    /* level of the run queue the process is on, prio unless it's boosted */
+    uint32_t rq_prio;
+    /* jiffies a SCHED_FIFO process has run since it last blocked or yielded */
+    uint32_t rt_run;
+    /* time slice length in milliseconds */
+    uint32_t timeslice;
+    pcb_t *rq_next, *rq_prev;
+    wait_queue_t *wait_queue;
+    pcb_t *wait_next;
+    /* where the process sleeps while waiting for a child to exit */
+    wait_queue_t child_queue;
+    /* wakes the process up from the sleep syscall, see timer.c */
+    ktimer_t sleep_timer;
+    /* signal state, see signal.c. bit i of sig_pending is set while signal i waits to
+     * be delivered, sig_masked while a handler runs, sig_handlers are user addresses */
+    uint32_t sig_pending;
+    uint32_t sig_masked;
+    uint32_t sig_handlers[NUM_SIGNALS];
+    /* sends ALARM every alarm_ms milliseconds, 0 if off */
+    ktimer_t alarm_timer;
+    uint32_t alarm_ms;
+    /* the heap runs from brk_start, the page after the program image, to the program
+     * break brk, see syscall_brk */
+    uint32_t brk_start;
+    uint32_t brk;
+    /* the regions of user memory the process can use, sorted by start, see vma.c */
+    vma_t vmas[NUM_VMAS];
+    int32_t nr_vmas;
+    /* bit i is set if the process holds shared memory segment i, see shm.c */
+    uint32_t shm_held;
+    /* message passing state, see ipc.c. ipc_from is who the process is receiving from
+     * (or IPC_ANY), ipc_peer who the message in ipc_buf came from. senders blocked
+     * until the process receives from them sleep on ipc_send_queue, the process itself
+     * sleeps on ipc_recv_queue until a message comes in */
+    int32_t ipc_from;
+    int32_t ipc_peer;
+    wait_queue_t ipc_send_queue;
+    wait_queue_t ipc_recv_queue;
+    uint8_t ipc_buf[IPC_MSG_LEN];
+    /* program name, truncated */
+    uint8_t name[PROC_NAME_LEN];
+    proc_stats_t stats;
+    /* page table of the process's user memory, see user_space_create */
+    pt_ent_t *user_pt;
+    /* the process's own page directory, the kernel's mappings plus user_pt and the
+     * vidmap page, see page_dir_create */
+    pd_ent_t *page_dir;
+    /* saved FPU/SSE registers, only up to date while the process isn't fpu_owner */
+    fpu_state_t fpu_state;
 };
 
 typedef struct kernel_stack_t kernel_stack_t;
@@ -66,19 +203,26 @@ void init_proc_mgmt();
  * Return value: Returns the PCB on success, NULL on error */
 pcb_t *alloc_process(pcb_t *parent, const uint8_t *cmdline, int terminal);
 
+/* execute_process
+ * Runs a command as a child of the current process or kernel thread, on the given
+ * terminal, and waits for it to exit.
+ * Return value: its exit code, -1 if it couldn't be started */
+int32_t execute_process(const uint8_t *command, int terminal);
+
 /* kill_curr_process
  * Kills the current process.
- * Sets exit code, closes file descriptors, switches to parent process if there is one,
- * otherwise respawns the process.
+ * Sets exit code, closes file descriptors, frees its memory, and leaves it as a zombie
+ * for the parent to collect if there is one, otherwise respawns the process.
  * Never returns. */
 void kill_curr_process(int32_t exit_code);
 
 
 /* kill_term_process
- * Kills the current process on the active terminal.
- * Sets exit code, closes file descriptors, switches to parent process if there is one,
- * otherwise respawns the process.
- * Never returns. */
+ * Kills the foreground process on the active terminal, i.e. every process on it that
+ * isn't a background job or waiting for a child to exit. Ones with an INTERRUPT handler
+ * get sent INTERRUPT instead.
+ * Same as kill_curr_process for each of them. Only returns if the current process
+ * wasn't one of them. */
 void kill_term_process(int32_t exit_code);
 
 /* enable_process_switching_test
@@ -115,13 +259,6 @@ int32_t switch_to_process(pcb_t *pcb);
  * Return value: never returns */
 int32_t jump_to_process(pcb_t *pcb);
 
-/* do_schedule
- * Switches to the next running process after the current one so as to perform
- * round robin scheduling. If none of the processes are running, it halts, waiting for
- * an interrupt to occur, then checks again. Uses jump_to_process if jump is true,
- * otherwise uses switch_to_process. */
-void do_schedule(int jump);
-
 
 #endif /* ASM */
 #endif /* _PROCESS_H */
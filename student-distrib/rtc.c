@@ -7,6 +7,7 @@
 #include "idt.h"
 #include "fs.h"
 #include "fd.h"
+#include "sched.h"
 
 #define RTC_BASE_RATE 1024
 
@@ -35,6 +36,9 @@ struct rtc_driver_data_t {
 
 rtc_driver_data_t *rtc_driver_data_head = NULL;
 uint32_t rtc_driver_counter = 0;
+/* processes waiting in rtc_read, for any of the file descriptors. they get woken up
+ * whenever one of them fires, and go back to sleep if it wasn't theirs */
+static wait_queue_t rtc_read_queue = WAIT_QUEUE_INIT;
 
 // TODO: add virtualization of RTC (multiple terminals) (see appendix B of manual for details)
 // TODO: change 
@@ -65,10 +69,11 @@ void rtc_init(){
     /* set time base to max (bits 6-4 of data) and intr freq to 2Hz (bits 3-0 of data) */
     outb(RTC_MASK_NMI | RTC_REG_A, RTC_ADDR);
     outb(0x06, RTC_DATA); // TODO: change it to 1 khz (0x06) when we virtualize
-    /* enable periodic interrupts bit, all other bits can/should be zero since we don't
-     * use the date/clock functionality of the RTC */
+    /* periodic interrupts stay off until an RTC file descriptor gets opened, see
+     * rtc_set_periodic. all other bits can/should be zero since we don't use the
+     * date/clock functionality of the RTC */
     outb(RTC_MASK_NMI | RTC_REG_B, RTC_ADDR);
-    outb(0x40, RTC_DATA);
+    outb(0x00, RTC_DATA);
     enable_irq(RTC_IRQ);
 
     static irq_handler_node_t rtc_handler_node = IRQ_HANDLER_NODE_INIT;
@@ -110,6 +115,25 @@ int32_t rtc_setrate(uint32_t rate) {
     return 1;
 }
 
+/* void rtc_set_periodic(int enable)
+ * Turns the RTC's periodic interrupt on or off. It's only left on while some RTC file
+ * descriptor is open, otherwise it would keep waking up an idle CPU 1024 times a second.
+ * Inputs: enable - non-zero to turn the interrupt on, zero to turn it off
+ * Side effects: Writes to the RTC */
+void rtc_set_periodic(int enable) {
+    uint32_t flags;
+    cli_and_save(flags);
+    outb(RTC_MASK_NMI | RTC_REG_B, RTC_ADDR);
+    uint8_t prev = inb(RTC_DATA);
+    outb(RTC_MASK_NMI | RTC_REG_B, RTC_ADDR);
+    outb(enable ? (prev | 0x40) : (prev & ~0x40), RTC_DATA);
+    /* read reg C to clear any interrupt that was already pending, otherwise the RTC
+     * won't raise another one */
+    outb(RTC_MASK_NMI | RTC_REG_C, RTC_ADDR);
+    inb(RTC_DATA);
+    restore_flags(flags);
+}
+
 /* int rtc_handler(uint32_t irq)
  * Handles an RTC periodic interrupt, currently just calling a test function
  * Inputs / Outputs / Return value: See irq_handler_t in idt.h
@@ -123,12 +147,15 @@ static int rtc_handler(uint32_t irq) {
     // if(funny++ > 15) asm volatile("ud2");
 
     rtc_driver_data_t *curr = rtc_driver_data_head;
+    int any_fired = 0;
     while(curr) {
         if((rtc_driver_counter & curr->mask) == 0) {
             curr->fired = 1;
+            any_fired = 1;
         }
         curr = curr->next;
     }
+    if(any_fired) sched_wake_all(&rtc_read_queue);
 
     ++rtc_driver_counter;
 
@@ -166,6 +193,7 @@ int32_t rtc_open(fd_info_t *fd_info, const uint8_t *filename) {
     uint32_t flags;
     cli_and_save(flags);
     rtc_driver_data_t *rtc_data = (rtc_driver_data_t*) &fd_info->driver_data;
+    if(!rtc_driver_data_head) rtc_set_periodic(1); // first one open
     if(rtc_driver_data_head) rtc_driver_data_head->prev = rtc_data;
     rtc_data->prev = NULL;
     rtc_data->next = rtc_driver_data_head;
@@ -195,6 +223,7 @@ int32_t rtc_close(fd_info_t *fd_info) {
     if(old_prev) old_prev->next = old_next;
     else rtc_driver_data_head = old_next;
     if(old_next) old_next->prev = old_prev;
+    if(!rtc_driver_data_head) rtc_set_periodic(0); // last one closed
     restore_flags(flags);
     return 0; /*TODO: redo when virturalize */
 
@@ -202,6 +231,31 @@ int32_t rtc_close(fd_info_t *fd_info) {
 
 
 
+/*
+* rtc_dup
+* DESCRIPTION: Adds a copy of an RTC file descriptor to the list of open ones, keeping
+*              the same rate'
+* INPUTS: new_fd - the copy'
+*         old_fd - the original'
+* OUTPUTS: none
+* RETURNS: 0 on success, -1 on failure
+*/
+int32_t rtc_dup(fd_info_t *new_fd, fd_info_t *old_fd) {
+    if(!new_fd || !old_fd) return -1;
+    uint32_t flags;
+    cli_and_save(flags);
+    rtc_driver_data_t *rtc_data = (rtc_driver_data_t*) &new_fd->driver_data;
+    // the list can't be empty, old_fd is still on it
+    rtc_driver_data_head->prev = rtc_data;
+    rtc_data->prev = NULL;
+    rtc_data->next = rtc_driver_data_head;
+    rtc_driver_data_head = rtc_data;
+    restore_flags(flags);
+    return 0;
+}
+
+
+
 /*
 * rtc_read
 * DESCRIPTION: Reads from the RTC file'
@@ -214,11 +268,14 @@ int32_t rtc_close(fd_info_t *fd_info) {
 int32_t rtc_read(fd_info_t *fd_info, void *buf, int32_t nbytes) {
     if(!buf || !fd_info || nbytes < 0) return -1;
     rtc_driver_data_t *rtc_data = (rtc_driver_data_t*) &fd_info->driver_data;
+    uint32_t flags;
+    cli_and_save(flags);
     rtc_data->fired = 0;
     while(!rtc_data->fired) {
         // wait for rtc interrupt
-        asm volatile("hlt");
+        sched_sleep(&rtc_read_queue);
     }
+    restore_flags(flags);
     fd_info->file_pos++;
     return 0; /*TODO:*/
 }
@@ -258,4 +315,5 @@ fd_driver_t rtc_fd_driver = {
     .close = rtc_close,
     .read = rtc_read,
     .write = rtc_write,
+    .dup = rtc_dup,
 };
@@ -52,12 +52,15 @@ void rtc_init();
 
 int32_t rtc_setrate(uint32_t rate);
 
+void rtc_set_periodic(int enable);
+
 extern fd_driver_t rtc_fd_driver;
 
 extern fd_open_t rtc_open;
 extern fd_close_t rtc_close;
 extern fd_read_t rtc_read;
 extern fd_write_t rtc_write;
+extern fd_dup_t rtc_dup;
 
 
 #endif /* ASM */
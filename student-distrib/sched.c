@@ -0,0 +1,536 @@
+/* sched.c - Implements the priority scheduler, run queues, and wait queues */
+
+#include "sched.h"
+#include "ktime.h"
+#include "lib.h"
+#include "mm.h"
+#include "pit.h"
+#include "terminal.h"
+
+/* each priority level has one FIFO run queue per terminal, plus a shared one for
+ * kernel threads and the SCHED_FIFO levels (which go strictly in order), linked through
+ * the rq_next/rq_prev fields of the PCB's. bit i of rq_bitmap is set iff level i has a
+ * non-empty queue, and bit j of rq_queues[i] iff its queue j is, so finding the next
+ * process to run is a bsf plus a look at each terminal's virtual time, no matter how
+ * many processes there are. a process is on a run queue exactly when it's present and
+ * running. */
+#define RQ_SHARED NUM_TERMINALS
+#define RQ_NUM_QUEUES (NUM_TERMINALS + 1)
+static pcb_t *rq_head[SCHED_NUM_PRIOS][RQ_NUM_QUEUES];
+static pcb_t *rq_tail[SCHED_NUM_PRIOS][RQ_NUM_QUEUES];
+static uint32_t rq_queues[SCHED_NUM_PRIOS];
+static uint32_t rq_bitmap = 0;
+static uint32_t rq_nr_running = 0;
+
+/* fair share between terminals. each terminal's virtual time goes up by the CPU time
+ * its processes use, scaled down by its weight, and within a level the process whose
+ * terminal is furthest behind goes first. a terminal with nothing runnable doesn't
+ * bank credit: it gets caught up with the others when it becomes runnable again. */
+static uint32_t term_weight[NUM_TERMINALS] = {
+    SCHED_TERM_WEIGHT_DEFAULT, SCHED_TERM_WEIGHT_DEFAULT, SCHED_TERM_WEIGHT_DEFAULT
+};
+static uint32_t term_vtime[NUM_TERMINALS];
+static uint32_t term_nr_running[NUM_TERMINALS];
+
+uint32_t sched_default_timeslice = SCHED_DEFAULT_TIMESLICE;
+
+/* set while do_schedule is halting in its idle loop, so interrupts that happen in the
+ * meantime don't try to schedule from inside it */
+static int sched_idling = 0;
+
+volatile int sched_need_resched = 0;
+
+/* vtime_before
+ * Return value: whether virtual time a is behind b, allowing for wrap around */
+static inline int vtime_before(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
+/* term_catch_up
+ * Moves a terminal that just became runnable up to the least virtual time of the other
+ * runnable terminals, so it can't make up for the time it spent idle by starving them.
+ * Interrupts must be disabled. */
+static void term_catch_up(int terminal) {
+    int i, found = 0;
+    uint32_t min = 0;
+    for(i = 0; i < NUM_TERMINALS; ++i) {
+        if(i == terminal || !term_nr_running[i]) continue;
+        if(!found || vtime_before(term_vtime[i], min)) min = term_vtime[i];
+        found = 1;
+    }
+    if(found && vtime_before(term_vtime[terminal], min)) term_vtime[terminal] = min;
+}
+
+/* rq_queue_of
+ * Return value: which of the queues of its rq_prio level a process goes on */
+static inline uint32_t rq_queue_of(pcb_t *pcb) {
+    if(pcb->terminal_id < 0 || pcb->rq_prio < SCHED_NICE_BASE + SCHED_NICE_MIN)
+        return RQ_SHARED;
+    return pcb->terminal_id;
+}
+
+/* rq_enqueue / rq_dequeue
+ * Add a process to the back of the run queue for its rq_prio and terminal, and remove it
+ * from its run queue. Interrupts must be disabled. */
+static void rq_enqueue(pcb_t *pcb) {
+    uint32_t prio = pcb->rq_prio, q = rq_queue_of(pcb);
+    pcb->rq_next = NULL;
+    pcb->rq_prev = rq_tail[prio][q];
+    if(rq_tail[prio][q]) rq_tail[prio][q]->rq_next = pcb;
+    else rq_head[prio][q] = pcb;
+    rq_tail[prio][q] = pcb;
+    rq_queues[prio] |= 1 << q;
+    rq_bitmap |= 1 << prio;
+    ++rq_nr_running;
+    if(pcb->terminal_id >= 0 && !term_nr_running[pcb->terminal_id]++)
+        term_catch_up(pcb->terminal_id);
+}
+static void rq_dequeue(pcb_t *pcb) {
+    uint32_t prio = pcb->rq_prio, q = rq_queue_of(pcb);
+    if(pcb->rq_prev) pcb->rq_prev->rq_next = pcb->rq_next;
+    else rq_head[prio][q] = pcb->rq_next;
+    if(pcb->rq_next) pcb->rq_next->rq_prev = pcb->rq_prev;
+    else rq_tail[prio][q] = pcb->rq_prev;
+    pcb->rq_next = pcb->rq_prev = NULL;
+    if(!rq_head[prio][q]) rq_queues[prio] &= ~(1 << q);
+    if(!rq_queues[prio]) rq_bitmap &= ~(1 << prio);
+    --rq_nr_running;
+    if(pcb->terminal_id >= 0) --term_nr_running[pcb->terminal_id];
+}
+
+/* rq_requeue
+ * Moves a runnable process to the back of the queue for its own priority, dropping any
+ * boost it had. Interrupts must be disabled. */
+static void rq_requeue(pcb_t *pcb) {
+    rq_dequeue(pcb);
+    pcb->fg_boost = 0;
+    pcb->rq_prio = pcb->prio;
+    rq_enqueue(pcb);
+}
+
+/* sched_account
+ * Charges a process (and its terminal) for the CPU time it used since it was last
+ * switched in. Demotes a SCHED_FIFO process that went over SCHED_RT_RUNTIME_MAX.
+ * Interrupts must be disabled.
+ * Inputs: pcb - the process
+ *         now - the current jiffy */
+static void sched_account(pcb_t *pcb, uint32_t now) {
+    uint32_t delta = now - pcb->stats.last_run;
+    uint64_t scaled;
+    pcb->stats.cpu_jiffies += delta;
+    pcb->stats.last_run = now;
+    if(pcb->terminal_id >= 0 && delta) {
+        scaled = (uint64_t)delta * SCHED_TERM_WEIGHT_DEFAULT;
+        div64_32(&scaled, term_weight[pcb->terminal_id]);
+        term_vtime[pcb->terminal_id] += (uint32_t)scaled;
+    }
+    if(pcb->policy == SCHED_FIFO) {
+        pcb->rt_run += delta;
+        if(pcb->rt_run > ms_to_jiffies(SCHED_RT_RUNTIME_MAX))
+            sched_set_policy(pcb, SCHED_NORMAL, 0);
+    }
+}
+
+/* sched_charge_current
+ * See sched.h.
+ * Side effects: Reads the PIT */
+void sched_charge_current(void) {
+    uint32_t flags;
+    pcb_t *curr_pcb = get_current_pcb();
+    cli_and_save(flags);
+    if(curr_pcb->present) sched_account(curr_pcb, pit_jiffies());
+    restore_flags(flags);
+}
+
+/* sched_pick_next
+ * Return value: the first process on the highest priority level's shared queue, or if
+ *               that's empty, on the queue of the terminal with the least virtual time
+ *               out of that level's, NULL if nothing is runnable */
+static pcb_t *sched_pick_next(void) {
+    uint32_t prio, q, best = RQ_SHARED;
+    if(!rq_bitmap) return NULL;
+    asm ("bsfl %1, %0" : "=r"(prio) : "rm"(rq_bitmap) : "cc");
+    /* kernel threads don't belong to a terminal, and SCHED_FIFO levels are strictly first
+     * come first served, so both just go in order */
+    if(rq_queues[prio] & (1 << RQ_SHARED)) return rq_head[prio][RQ_SHARED];
+    for(q = 0; q < NUM_TERMINALS; ++q) {
+        if((rq_queues[prio] & (1 << q)) &&
+                (best == RQ_SHARED || vtime_before(term_vtime[q], term_vtime[best])))
+            best = q;
+    }
+    return rq_head[prio][best];
+}
+
+/* sched_nr_running
+ * Return value: the number of runnable processes, including the current one if it's
+ *               runnable */
+uint32_t sched_nr_running(void) {
+    return rq_nr_running;
+}
+
+/* sched_wake
+ * See sched.h.
+ * Inputs: pcb - process to make runnable
+ * Side effects: Modifies the run queues */
+void sched_wake(pcb_t *pcb) {
+    uint32_t flags;
+    pcb_t *curr_pcb;
+    cli_and_save(flags);
+    if(!pcb->running) {
+        pcb->running = 1;
+        pcb->rq_prio = pcb->prio;
+        /* whatever the user is looking at gets to respond right away, instead of
+         * waiting behind background jobs of the same priority */
+        pcb->fg_boost = pcb->policy == SCHED_NORMAL && pcb->terminal_id >= 0 &&
+                pcb->terminal_id == get_active_terminal_id() &&
+                pcb->prio >= SCHED_NICE_BASE + SCHED_NICE_MIN + SCHED_FG_BOOST;
+        if(pcb->fg_boost) pcb->rq_prio -= SCHED_FG_BOOST;
+        rq_enqueue(pcb);
+        curr_pcb = get_current_pcb();
+        if(curr_pcb->present && curr_pcb->running && pcb->policy != SCHED_BATCH &&
+                pcb->rq_prio < curr_pcb->rq_prio)
+            sched_need_resched = 1;
+        /* the PIT might be stopped if nothing was runnable before */
+        pit_kick();
+    }
+    restore_flags(flags);
+}
+
+/* sched_block
+ * See sched.h.
+ * Inputs: pcb - process to stop scheduling
+ * Side effects: Modifies the run queues and the wait queue pcb is sleeping on */
+void sched_block(pcb_t *pcb) {
+    uint32_t flags;
+    cli_and_save(flags);
+    if(pcb->running) {
+        pcb->running = 0;
+        rq_dequeue(pcb);
+        pcb->fg_boost = 0;
+        pcb->rt_run = 0;
+    }
+    if(pcb->sleeping) {
+        pcb_t **link = &pcb->wait_queue->head;
+        while(*link != pcb) {
+            if(!*link) panic_msg("sleeping process not on its wait queue!");
+            link = &(*link)->wait_next;
+        }
+        *link = pcb->wait_next;
+        pcb->sleeping = 0;
+        pcb->wait_queue = NULL;
+        pcb->wait_next = NULL;
+    }
+    restore_flags(flags);
+}
+
+/* sched_wait_on
+ * Blocks a process and puts it on a wait queue. Interrupts must be disabled. */
+static void sched_wait_on(pcb_t *pcb, wait_queue_t *queue) {
+    sched_block(pcb);
+    pcb->sleeping = 1;
+    pcb->wait_queue = queue;
+    pcb->wait_next = queue->head;
+    queue->head = pcb;
+}
+
+/* sched_sleep
+ * See sched.h.
+ * Inputs: queue - wait queue to sleep on
+ * Side effects: Switches to other processes until woken up */
+void sched_sleep(wait_queue_t *queue) {
+    pcb_t *curr_pcb = get_current_pcb();
+    if(!curr_pcb->present) {
+        /* no process to block yet (i.e. tests running during boot), just wait for the
+         * next interrupt, the caller checks its condition again anyways */
+        trace_irqs_on();
+        asm volatile ("sti; hlt; cli");
+        trace_irqs_off();
+        return;
+    }
+    sched_wait_on(curr_pcb, queue);
+    do_schedule(0);
+}
+
+/* sched_sleep_handoff
+ * See sched.h.
+ * Inputs: queue - wait queue to sleep on
+ *         next - process to run in the meantime
+ * Side effects: Switches to next, or other processes, until woken up */
+void sched_sleep_handoff(wait_queue_t *queue, pcb_t *next) {
+    pcb_t *curr_pcb = get_current_pcb();
+    if(!curr_pcb->present) panic_msg("handoff without current process present!");
+    sched_wait_on(curr_pcb, queue);
+    sched_handoff(next);
+}
+
+/* sched_wake_all
+ * See sched.h.
+ * Inputs: queue - wait queue to empty out
+ * Side effects: Modifies the run queues */
+void sched_wake_all(wait_queue_t *queue) {
+    uint32_t flags;
+    cli_and_save(flags);
+    pcb_t *pcb = queue->head;
+    queue->head = NULL;
+    while(pcb) {
+        pcb_t *next = pcb->wait_next;
+        pcb->sleeping = 0;
+        pcb->wait_queue = NULL;
+        pcb->wait_next = NULL;
+        sched_wake(pcb);
+        pcb = next;
+    }
+    restore_flags(flags);
+}
+
+/* sched_set_nice
+ * See sched.h.
+ * Inputs: pcb - process to change the priority of
+ *         nice - new nice value, lower is higher priority
+ * Return value: the new (clamped) nice value
+ * Side effects: Modifies the run queues */
+int32_t sched_set_nice(pcb_t *pcb, int32_t nice) {
+    uint32_t flags;
+    if(nice < SCHED_NICE_MIN) nice = SCHED_NICE_MIN;
+    if(nice > SCHED_NICE_MAX) nice = SCHED_NICE_MAX;
+    cli_and_save(flags);
+    if(pcb->running) rq_dequeue(pcb);
+    pcb->nice = nice;
+    pcb->prio = sched_policy_prio(pcb->policy, pcb->rt_prio, nice);
+    pcb->rq_prio = pcb->prio;
+    pcb->fg_boost = 0;
+    if(pcb->running) rq_enqueue(pcb);
+    restore_flags(flags);
+    return nice;
+}
+
+/* sched_set_policy
+ * See sched.h.
+ * Inputs: pcb - process to change the class of
+ *         policy - SCHED_NORMAL, SCHED_BATCH or SCHED_FIFO
+ *         rt_prio - priority within SCHED_FIFO
+ * Return value: 0 on success, -1 on bad arguments
+ * Side effects: Modifies the run queues */
+int32_t sched_set_policy(pcb_t *pcb, int32_t policy, int32_t rt_prio) {
+    uint32_t flags;
+    if(policy == SCHED_FIFO) {
+        if(rt_prio < SCHED_RT_PRIO_MIN || rt_prio > SCHED_RT_PRIO_MAX) return -1;
+    } else if(policy != SCHED_NORMAL && policy != SCHED_BATCH) {
+        return -1;
+    } else if(rt_prio != 0) {
+        return -1;
+    }
+    cli_and_save(flags);
+    if(pcb->running) rq_dequeue(pcb);
+    pcb->policy = policy;
+    pcb->rt_prio = rt_prio;
+    pcb->prio = sched_policy_prio(policy, rt_prio, pcb->nice);
+    pcb->rq_prio = pcb->prio;
+    pcb->fg_boost = 0;
+    pcb->rt_run = 0;
+    if(pcb->running) rq_enqueue(pcb);
+    restore_flags(flags);
+    return 0;
+}
+
+/* do_schedule
+ * Switches to the highest priority runnable process. The current process goes to the
+ * back of its run queue first (losing any foreground boost), so processes of equal
+ * priority take turns, weighted by their terminals' shares. SCHED_FIFO processes stay
+ * at the front instead, so they keep running until they block or yield. If none of
+ * the processes are running, it halts, waiting for an interrupt to occur, then checks
+ * again.
+ * Inputs: jump - Boolean, non-zero to call jump_to_process, zero to call switch_to_process
+ * Return value: void if jump is false, never returns otherwise
+ * Side effects: Calls (switch|jump)_to_process, so the we must currently be switched in to a
+ * process (i.e. not on the initial kernel stack). */
+void do_schedule(int jump) {
+    uint32_t flags, now;
+    cli_and_save(flags);
+
+    pcb_t *curr_pcb = get_current_pcb();
+    if(!jump && !curr_pcb->present) panic_msg("switch without current process present!");
+    if(sched_idling && !jump) {
+        /* an interrupt came in while we were halting further down this stack, the idle
+         * loop will notice whatever it made runnable once it returns */
+        restore_flags(flags);
+        return;
+    }
+    sched_need_resched = 0;
+    if(!jump && curr_pcb->running && curr_pcb->policy != SCHED_FIFO) rq_requeue(curr_pcb);
+    /* reading the PIT is several port I/Os, so only do it once per switch */
+    now = pit_jiffies();
+    if(curr_pcb->present) sched_account(curr_pcb, now);
+    while(1) {
+        pcb_t *next = sched_pick_next();
+        if(next) {
+            if(next != curr_pcb) ++next->stats.nr_switches;
+            next->stats.last_run = now;
+            pit_start_slice(next->timeslice, now);
+            if(jump) {
+                /* the idle loop we might have been called from is never coming back */
+                sched_idling = 0;
+                jump_to_process(next);
+            }
+            switch_to_process(next);
+            if(curr_pcb->present && curr_pcb->running) break;
+        } else {
+            /* if we didn't find any running processes, zero a frame for later page
+             * faults, or if there's nothing left to zero, wait until the next hardware
+             * interrupt. either way, look at the run queues again after */
+            sched_idling = 1;
+            if(!zero_pool_refill()) {
+                trace_irqs_on();
+                asm volatile ("sti; hlt; cli");
+                trace_irqs_off();
+            }
+            sched_idling = 0;
+        }
+        /* time went by while idling, or running other processes */
+        now = pit_jiffies();
+    }
+
+    restore_flags(flags);
+}
+
+/* sched_handoff
+ * See sched.h.
+ * Inputs: next - process to switch to
+ * Side effects: Calls switch_to_process, returns once the current process gets
+ *               switched back to */
+void sched_handoff(pcb_t *next) {
+    uint32_t flags, best, now;
+    pcb_t *curr_pcb = get_current_pcb();
+    cli_and_save(flags);
+    if(!curr_pcb->present) panic_msg("switch without current process present!");
+    if(sched_idling || !next->running || next == curr_pcb) goto fallback;
+    asm ("bsfl %1, %0" : "=r"(best) : "rm"(rq_bitmap) : "cc");
+    if(next->rq_prio > best) goto fallback;
+
+    /* the same bookkeeping as do_schedule, minus picking the process */
+    sched_need_resched = 0;
+    if(curr_pcb->running && curr_pcb->policy != SCHED_FIFO) rq_requeue(curr_pcb);
+    now = pit_jiffies();
+    sched_account(curr_pcb, now);
+    ++next->stats.nr_switches;
+    next->stats.last_run = now;
+    pit_start_slice(next->timeslice, now);
+    switch_to_process(next);
+    restore_flags(flags);
+    return;
+
+fallback:
+    if(!curr_pcb->running || sched_need_resched) do_schedule(0);
+    restore_flags(flags);
+}
+
+/* syscall_nice
+ * Adds to the nice value of the current process. Higher nice values mean lower
+ * priority, and a process only gets to run when no process with a lower nice value is
+ * runnable. Child processes start with the nice value of their parent. There are no
+ * privileged processes to hand out higher priorities, so a process can only lower its
+ * own, otherwise any program could starve every other one just by asking.
+ * Inputs: arg1 - amount to add to the nice value, can't be negative
+ *         arg2 - not used
+ *         arg3 - not used
+ * Return value: the new nice value, clamped to SCHED_NICE_MAX, -1 if arg1 is negative
+ * Side effects: Moves the current process to a different run queue */
+int32_t syscall_nice(int32_t arg1, int32_t arg2, int32_t arg3) {
+    pcb_t *current = get_current_pcb();
+    if(arg1 < 0) return -1;
+    /* clamp the increment first so the addition can't overflow */
+    if(arg1 > SCHED_NICE_MAX - SCHED_NICE_MIN) arg1 = SCHED_NICE_MAX - SCHED_NICE_MIN;
+    return sched_set_nice(current, current->nice + arg1);
+}
+
+/* syscall_timeslice
+ * Sets the time slice of the current process, i.e. how long it gets to run before the
+ * scheduler gives the next process of the same priority a turn. Short slices make for
+ * snappier interactive programs, long ones cut down on context switches for batch jobs.
+ * Child processes start with the time slice of their parent.
+ * Inputs: arg1 - new time slice in milliseconds, or 0 to leave it unchanged
+ *         arg2 - not used
+ *         arg3 - not used
+ * Return value: the time slice in milliseconds, -1 if arg1 is out of range
+ *               (SCHED_MIN_TIMESLICE to SCHED_MAX_TIMESLICE)
+ * Side effects: Modifies the current PCB */
+int32_t syscall_timeslice(int32_t arg1, int32_t arg2, int32_t arg3) {
+    pcb_t *current = get_current_pcb();
+    if(arg1 == 0) return current->timeslice;
+    if(arg1 < SCHED_MIN_TIMESLICE || arg1 > SCHED_MAX_TIMESLICE) return -1;
+    current->timeslice = arg1;
+    return arg1;
+}
+
+/* sched_set_term_weight
+ * See sched.h.
+ * Inputs: terminal - terminal to change the weight of
+ *         weight - new weight, SCHED_TERM_WEIGHT_MIN to SCHED_TERM_WEIGHT_MAX, or 0 to
+ *                  only look it up */
+int32_t sched_set_term_weight(int32_t terminal, int32_t weight) {
+    uint32_t flags;
+    int32_t old;
+    if(terminal < 0 || terminal >= NUM_TERMINALS) return -1;
+    if(weight && (weight < SCHED_TERM_WEIGHT_MIN || weight > SCHED_TERM_WEIGHT_MAX))
+        return -1;
+    cli_and_save(flags);
+    old = term_weight[terminal];
+    if(weight) term_weight[terminal] = weight;
+    restore_flags(flags);
+    return old;
+}
+
+/* syscall_termweight
+ * Sets a terminal's share of the CPU. When processes of the same priority on several
+ * terminals all want to run, each terminal gets CPU time in proportion to its weight,
+ * no matter how many processes it has. All terminals start at SCHED_TERM_WEIGHT_DEFAULT.
+ * Inputs: arg1 - terminal number
+ *         arg2 - new weight, SCHED_TERM_WEIGHT_MIN to SCHED_TERM_WEIGHT_MAX, or 0 to
+ *                leave it unchanged
+ *         arg3 - not used
+ * Return value: the old weight, -1 on a bad terminal or weight
+ * Side effects: Changes how the scheduler splits CPU time */
+int32_t syscall_termweight(int32_t arg1, int32_t arg2, int32_t arg3) {
+    return sched_set_term_weight(arg1, arg2);
+}
+
+/* sched_yield
+ * See sched.h.
+ * Side effects: Switches to other processes */
+void sched_yield(void) {
+    uint32_t flags;
+    pcb_t *curr_pcb = get_current_pcb();
+    cli_and_save(flags);
+    /* do_schedule leaves SCHED_FIFO processes at the front, so move it back here */
+    if(curr_pcb->running && curr_pcb->policy == SCHED_FIFO) rq_requeue(curr_pcb);
+    curr_pcb->rt_run = 0;
+    do_schedule(0);
+    restore_flags(flags);
+}
+
+/* syscall_yield
+ * Gives up the rest of the current process's time slice, so cooperative programs can
+ * let others run without spinning or blocking on something.
+ * Inputs: none
+ * Return value: 0, once the process gets to run again
+ * Side effects: Switches to other processes */
+int32_t syscall_yield(int32_t arg1, int32_t arg2, int32_t arg3) {
+    sched_yield();
+    return 0;
+}
+
+/* syscall_sched_setparam
+ * Sets the scheduling class of the current process, which child processes inherit.
+ * SCHED_FIFO is meant for latency sensitive programs like animations, which have to
+ * keep their CPU use down themselves (e.g. by sleeping between frames), since nothing
+ * below them runs while they're runnable. One that runs for SCHED_RT_RUNTIME_MAX
+ * without blocking or yielding gets put back in SCHED_NORMAL.
+ * Inputs: arg1 - SCHED_NORMAL, SCHED_BATCH or SCHED_FIFO
+ *         arg2 - for SCHED_FIFO, SCHED_RT_PRIO_MIN to SCHED_RT_PRIO_MAX (higher goes
+ *                first), otherwise 0
+ *         arg3 - not used
+ * Return value: 0 on success, -1 on a bad class or priority
+ * Side effects: Moves the current process to a different run queue */
+int32_t syscall_sched_setparam(int32_t arg1, int32_t arg2, int32_t arg3) {
+    return sched_set_policy(get_current_pcb(), arg1, arg2);
+}
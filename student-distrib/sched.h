@@ -0,0 +1,155 @@
+/* sched.h - Definitions for the process scheduler and wait queues */
+
+#ifndef _SCHED_H
+#define _SCHED_H
+
+#include "types.h"
+#include "process.h"
+#include "syscall.h"
+
+/* number of priority levels, 0 is the highest priority. each level gets its own FIFO
+ * run queue, and a bit in a bitmap that's set when the queue is non-empty */
+#define SCHED_NUM_PRIOS 32
+/* nice values map onto levels SCHED_NICE_BASE+SCHED_NICE_MIN to SCHED_NUM_PRIOS-1,
+ * the levels above that are reserved for work that should beat any user process */
+#define SCHED_NICE_MIN (-8)
+#define SCHED_NICE_MAX 15
+#define SCHED_NICE_BASE 16
+/* scheduling classes. NORMAL processes share their level round robin. BATCH ones do
+ * too, but never get the foreground boost or preempt anything when they wake up.
+ * FIFO ones sit on the levels above the nice levels, by rt_prio (higher is more urgent),
+ * and run until they block, yield, or something more urgent wakes up, with no time
+ * slice (but see SCHED_RT_RUNTIME_MAX). level 0 stays reserved for kernel threads. */
+#define SCHED_NORMAL 0
+#define SCHED_BATCH 1
+#define SCHED_FIFO 2
+#define SCHED_RT_PRIO_MIN 1
+#define SCHED_RT_PRIO_MAX (SCHED_NICE_BASE + SCHED_NICE_MIN - 1)
+/* milliseconds of CPU time a FIFO process can use without blocking or yielding before
+ * it gets demoted to NORMAL, so a runaway one can't lock up every terminal for good */
+#define SCHED_RT_RUNTIME_MAX 500
+/* time slice lengths in milliseconds, per process, inherited from the parent */
+#define SCHED_MIN_TIMESLICE 1
+#define SCHED_MAX_TIMESLICE 1000
+#define SCHED_DEFAULT_TIMESLICE 20
+/* how many levels a process on the active terminal gets queued ahead of its priority
+ * when it wakes up, until it uses up a time slice. never into the reserved levels */
+#define SCHED_FG_BOOST 2
+/* CPU share weights of the terminals. processes of the same priority on different
+ * terminals get CPU time in proportion to their terminal's weight */
+#define SCHED_TERM_WEIGHT_MIN 1
+#define SCHED_TERM_WEIGHT_MAX 65536
+#define SCHED_TERM_WEIGHT_DEFAULT 1024
+
+#ifndef ASM
+
+/* wait_queue_t and WAIT_QUEUE_INIT are in process.h, since PCB's contain one */
+
+/* time slice of processes without a parent (i.e. the shells), can be changed with the
+ * quantum= boot option */
+extern uint32_t sched_default_timeslice;
+
+/* set by sched_wake when it wakes something with a higher priority than the current
+ * process, so irq_handler knows to call do_schedule on its way out instead of waiting
+ * for the time slice to run out. cleared by do_schedule */
+extern volatile int sched_need_resched;
+
+/* nice_to_prio
+ * Return value: the run queue level for a given nice value */
+static inline uint32_t nice_to_prio(int32_t nice) {
+    return SCHED_NICE_BASE + nice;
+}
+
+/* sched_policy_prio
+ * Return value: the run queue level a process of the given class, SCHED_FIFO priority
+ *               and nice value belongs on */
+static inline uint32_t sched_policy_prio(uint32_t policy, uint32_t rt_prio, int32_t nice) {
+    return policy == SCHED_FIFO ? SCHED_NICE_BASE + SCHED_NICE_MIN - rt_prio :
+            nice_to_prio(nice);
+}
+
+/* sched_set_term_weight
+ * Sets a terminal's CPU share weight, see SCHED_TERM_WEIGHT_DEFAULT.
+ * Inputs: weight - the new weight, or 0 to leave it unchanged
+ * Return value: the old weight, -1 on a bad terminal or weight */
+int32_t sched_set_term_weight(int32_t terminal, int32_t weight);
+
+/* sched_nr_running
+ * Return value: how many processes are runnable right now */
+uint32_t sched_nr_running(void);
+
+/* sched_wake
+ * Marks a process as runnable and puts it at the back of its run queue. Does nothing if
+ * it's already runnable. A process on the active terminal gets queued SCHED_FG_BOOST
+ * levels higher, until it next gets requeued by do_schedule. */
+void sched_wake(pcb_t *pcb);
+
+/* sched_block
+ * Takes a process out of the scheduler's hands: off its run queue, and off whatever wait
+ * queue it might be sleeping on. It won't run again until sched_wake is called on it. */
+void sched_block(pcb_t *pcb);
+
+/* sched_sleep
+ * Puts the current process to sleep on the given wait queue, returning once it's been
+ * woken up by sched_wake_all. Interrupts must be disabled when calling this, and the
+ * caller should check its wake up condition in a loop around this function, also with
+ * interrupts disabled, so a wake up can't slip in between the check and going to sleep.
+ * Outside of a process (during boot), it just halts until the next interrupt. */
+void sched_sleep(wait_queue_t *queue);
+
+/* sched_sleep_handoff
+ * Like sched_sleep, but hands the CPU straight to next (see sched_handoff) instead of
+ * picking the next process off the run queues. */
+void sched_sleep_handoff(wait_queue_t *queue, pcb_t *next);
+
+/* sched_wake_all
+ * Wakes up every process sleeping on the given wait queue. Safe to call from interrupt
+ * handlers. */
+void sched_wake_all(wait_queue_t *queue);
+
+/* sched_set_nice
+ * Sets the nice value of a process, clamped to [SCHED_NICE_MIN, SCHED_NICE_MAX], which
+ * moves it to the corresponding run queue (unless it's SCHED_FIFO, which ignores it).
+ * Return value: the new nice value */
+int32_t sched_set_nice(pcb_t *pcb, int32_t nice);
+
+/* sched_set_policy
+ * Moves a process to a scheduling class, see SCHED_NORMAL.
+ * Inputs: rt_prio - SCHED_RT_PRIO_MIN to SCHED_RT_PRIO_MAX for SCHED_FIFO, 0 otherwise
+ * Return value: 0 on success, -1 on a bad class or priority */
+int32_t sched_set_policy(pcb_t *pcb, int32_t policy, int32_t rt_prio);
+
+/* sched_yield
+ * Gives up the rest of the current process's time slice, letting the other runnable
+ * processes of its level go first. Returns once it gets switched back to. */
+void sched_yield(void);
+
+/* sched_charge_current
+ * Brings the current process's CPU time up to date, which otherwise only happens when
+ * it gets switched away from. */
+void sched_charge_current(void);
+
+/* do_schedule
+ * Switches to the first process of the highest priority non-empty run queue, moving the
+ * current process to the back of its run queue first, so processes of the same priority
+ * are scheduled round robin. If no process is runnable, it halts, waiting for an
+ * interrupt to wake one up, then checks again. Uses jump_to_process if jump is true,
+ * otherwise uses switch_to_process. */
+void do_schedule(int jump);
+
+/* sched_handoff
+ * Switches straight to next, which must be runnable (e.g. just woken up by the current
+ * process), without scanning the run queues. The current process goes to the back of
+ * its run queue if it's still runnable. Falls back to do_schedule if something more
+ * important than next is runnable, so it never undercuts priorities. Used to make
+ * request/response round trips between processes cheap, see ipc.c. */
+void sched_handoff(pcb_t *next);
+
+extern syscall_t syscall_nice; // In sched.c
+extern syscall_t syscall_timeslice; // In sched.c
+extern syscall_t syscall_termweight; // In sched.c
+extern syscall_t syscall_yield; // In sched.c
+extern syscall_t syscall_sched_setparam; // In sched.c
+
+#endif /* ASM */
+#endif /* _SCHED_H */
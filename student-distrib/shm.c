@@ -0,0 +1,152 @@
+/* shm.c - Implements shared memory segments, and the shm_create and shm_attach syscalls.
+ * A segment is a set of 4KiB frames that any number of processes can map into their
+ * user memory, so producer/consumer programs can hand data over without copying it
+ * through the kernel. Unrelated processes find a segment by a key they agree on.
+ * There are two kinds of references: a process holds one on each segment it created
+ * or looked up (tracked in its shm_held bitmap), which keeps the segment around, and
+ * each page mapped into an address space holds a reference to its frame, so the
+ * memory stays valid for as long as anything maps it. */
+
+#include "shm.h"
+#include "lib.h"
+#include "mm.h"
+#include "process.h"
+#include "vma.h"
+
+/* shm_segment_t
+ * A shared memory segment, free while refs is 0 */
+typedef struct shm_segment_t {
+    /* what shm_create looks it up by, 0 for a private segment no one can look up */
+    uint32_t key;
+    uint32_t npages;
+    /* number of processes holding the segment */
+    uint32_t refs;
+    /* the pages, each its own alloc_frames(1) run so mappings can refcount them */
+    void *frames[SHM_MAX_PAGES];
+} shm_segment_t;
+
+static shm_segment_t segments[NUM_SHM_SEGMENTS];
+
+/* shm_put
+ * Drops a process's reference to a segment, freeing its frames if it was the last.
+ * Frames still mapped somewhere stay around until they're unmapped.
+ * Interrupts must be disabled. */
+static void shm_put(shm_segment_t *seg) {
+    uint32_t i;
+    if(seg->refs == 0) panic_msg("shm segment refcount underflow!");
+    if(--seg->refs) return;
+    for(i = 0; i < seg->npages; ++i) put_frame(seg->frames[i]);
+    seg->npages = 0;
+    seg->key = 0;
+}
+
+/* shm_hold
+ * Gives a process a reference to a segment, unless it already has one.
+ * Interrupts must be disabled. */
+static void shm_hold(pcb_t *pcb, uint32_t id) {
+    if(pcb->shm_held & (1 << id)) return;
+    pcb->shm_held |= 1 << id;
+    ++segments[id].refs;
+}
+
+/* shm_fork
+ * See shm.h.
+ * Inputs: child - the new process, its shm_held gets overwritten
+ *         parent - the forking process */
+void shm_fork(pcb_t *child, pcb_t *parent) {
+    uint32_t id;
+    child->shm_held = 0;
+    for(id = 0; id < NUM_SHM_SEGMENTS; ++id) {
+        if(parent->shm_held & (1 << id)) shm_hold(child, id);
+    }
+}
+
+/* shm_release
+ * See shm.h.
+ * Inputs: pcb - the exiting process
+ * Side effects: Might free frames */
+void shm_release(pcb_t *pcb) {
+    uint32_t flags, id;
+    cli_and_save(flags);
+    for(id = 0; id < NUM_SHM_SEGMENTS; ++id) {
+        if(pcb->shm_held & (1 << id)) shm_put(&segments[id]);
+    }
+    pcb->shm_held = 0;
+    restore_flags(flags);
+}
+
+/* syscall_shm_create
+ * Creates a shared memory segment, or looks up an existing one with the same key.
+ * Inputs: arg1 - key, a nonzero key finds the segment other processes created with it,
+ *                0 always makes a new segment (which only forked children can share)
+ *         arg2 - size in bytes, up to SHM_MAX_PAGES pages, rounded up to whole pages.
+ *                when looking up a segment it can't be bigger than the segment
+ *         arg3 - not used
+ * Return value: the segment id for shm_attach, -1 on a bad size, when out of segments
+ *               or memory
+ * Side effects: Allocates zeroed frames for a new segment, the calling process holds
+ *               the segment until it exits */
+int32_t syscall_shm_create(int32_t arg1, int32_t arg2, int32_t arg3) {
+    pcb_t *current = get_current_pcb();
+    uint32_t key = (uint32_t) arg1, npages, flags, id, i;
+    shm_segment_t *seg;
+    if(arg2 <= 0 || arg2 > SHM_MAX_PAGES * PAGE_SIZE) return -1;
+    npages = (arg2 + PAGE_SIZE - 1) / PAGE_SIZE;
+    cli_and_save(flags);
+    if(key) {
+        for(id = 0; id < NUM_SHM_SEGMENTS; ++id) {
+            seg = &segments[id];
+            if(!seg->refs || seg->key != key) continue;
+            if(npages > seg->npages) id = -1;
+            else shm_hold(current, id);
+            restore_flags(flags);
+            return id;
+        }
+    }
+    for(id = 0; id < NUM_SHM_SEGMENTS && segments[id].refs; ++id);
+    if(id == NUM_SHM_SEGMENTS) {
+        restore_flags(flags);
+        return -1;
+    }
+    seg = &segments[id];
+    for(i = 0; i < npages; ++i) {
+        if(!(seg->frames[i] = alloc_zeroed_frame())) {
+            while(i--) free_frames(seg->frames[i]);
+            restore_flags(flags);
+            return -1;
+        }
+    }
+    seg->key = key;
+    seg->npages = npages;
+    shm_hold(current, id);
+    restore_flags(flags);
+    return id;
+}
+
+/* syscall_shm_attach
+ * Maps a segment into the current process's user memory, as a region of its own.
+ * Inputs: arg1 - segment id from shm_create, which this process (or its parent before
+ *                forking) has to have called
+ *         arg2 - page aligned user address to map it at. the whole range has to be
+ *                outside the process's other regions (see vma.h)
+ *         arg3 - not used
+ * Return value: 0 on success, -1 on a bad id or address, or if the process has too
+ *               many regions
+ * Side effects: Maps the segment, it stays mapped (and shared with forked children)
+ *               until the process exits */
+int32_t syscall_shm_attach(int32_t arg1, int32_t arg2, int32_t arg3) {
+    pcb_t *current = get_current_pcb();
+    uint32_t addr = (uint32_t) arg2, flags;
+    int32_t ret = -1;
+    if(arg1 < 0 || arg1 >= NUM_SHM_SEGMENTS || !(current->shm_held & (1 << arg1)))
+        return -1;
+    cli_and_save(flags);
+    if(addr <= USER_VMEM_END - segments[arg1].npages * PAGE_SIZE &&
+            !vma_insert(current, addr, addr + segments[arg1].npages * PAGE_SIZE, VMA_SHM)) {
+        ret = user_space_map_shared(current->user_pt, addr, segments[arg1].frames,
+                segments[arg1].npages);
+        if(ret) vma_remove(current, vma_find(current, addr));
+    }
+    restore_flags(flags);
+    return ret;
+}
@@ -0,0 +1,30 @@
+/* shm.h - Definitions for shared memory segments */
+
+#ifndef _SHM_H
+#define _SHM_H
+
+#include "types.h"
+
+/* how many segments can exist at once. a process's references fit in a uint32_t
+ * bitmap, so this can't go past 32 */
+#define NUM_SHM_SEGMENTS 16
+/* largest segment, in 4KiB pages (256KiB) */
+#define SHM_MAX_PAGES 64
+
+#ifndef ASM
+
+struct pcb_t;
+
+/* shm_fork
+ * Gives a forked child the parent's segment references. The pages themselves get
+ * shared by user_space_clone. Interrupts must be disabled. */
+void shm_fork(struct pcb_t *child, struct pcb_t *parent);
+
+/* shm_release
+ * Drops every segment reference a process holds, freeing segments no one else holds.
+ * Called when the process exits, after (or before) its page table is destroyed, since
+ * the mapped pages keep their own frame references. */
+void shm_release(struct pcb_t *pcb);
+
+#endif /* ASM */
+#endif /* _SHM_H */
@@ -0,0 +1,290 @@
+/* signal.c - Implements user signal delivery, and the set_handler, sigreturn and alarm
+ * syscalls.
+ * Signals are only ever delivered on the way back out to user mode. The handler gets
+ * called as if the interrupted code had called it: below the interrupted stack pointer
+ * goes a sig_frame_t holding the saved registers, the signal number as the handler's
+ * argument, and a return address pointing at a little piece of code in the frame
+ * that calls sigreturn. sigreturn then copies the (possibly modified) registers back.
+ * While a handler runs, every other signal stays pending. */
+
+#include "signal.h"
+#include "lib.h"
+#include "mm.h"
+#include "pit.h"
+#include "process.h"
+#include "sched.h"
+#include "x86_desc.h"
+
+/* syscall number of sigreturn, which the trampoline calls */
+#define SIGRETURN_SYSNUM 10
+#define SIG_TRAMPOLINE_SIZE 8
+/* the eflags bits a handler can change through the saved context: CF, PF, AF, ZF, SF,
+ * TF, DF and OF. the rest (IF, IOPL, ...) stay what they were */
+#define SIG_EFLAGS_USER 0xDD5
+/* longest period the alarm syscall allows, a day */
+#define ALARM_MAX_MS (24 * 60 * 60 * 1000)
+
+/* sig_frame_t
+ * What gets pushed on the user stack for a handler, lowest address first */
+typedef struct sig_frame_t {
+    /* where the handler returns to, the trampoline below */
+    uint32_t ret_addr;
+    /* the handler's argument */
+    uint32_t signum;
+    sig_context_t context;
+    uint8_t trampoline[SIG_TRAMPOLINE_SIZE];
+} sig_frame_t;
+
+/* movl $SIGRETURN_SYSNUM, %eax; int $0x80; nop */
+static const uint8_t sig_trampoline[SIG_TRAMPOLINE_SIZE] = {
+    0xB8, SIGRETURN_SYSNUM, 0x00, 0x00, 0x00, 0xCD, 0x80, 0x90
+};
+
+/* sig_setup_frame
+ * Pushes a signal frame on the user stack and points the user context at the handler.
+ * Inputs: pcb - the current process
+ *         uctx - its user context, from the interrupt, exception or syscall
+ *         signum - signal to handle
+ * Side effects: Writes to the user stack, masks signals. Kills the process if the frame
+ *               doesn't fit on its stack. */
+static void sig_setup_frame(pcb_t *pcb, iret_context_user_t *uctx, uint32_t signum) {
+    sig_frame_t frame;
+    sig_frame_t *user_frame = (sig_frame_t*)((uctx->esp - sizeof(sig_frame_t)) & ~3);
+    if(uctx->esp < sizeof(sig_frame_t) || check_user_bounds(user_frame, sizeof(frame)))
+        kill_curr_process(EXCEPTION_STATUS);
+
+    frame.ret_addr = (uint32_t) &user_frame->trampoline;
+    frame.signum = signum;
+    frame.context.ebx = uctx->base.ebx;
+    frame.context.ecx = uctx->base.ecx;
+    frame.context.edx = uctx->base.edx;
+    frame.context.esi = uctx->base.esi;
+    frame.context.edi = uctx->base.edi;
+    frame.context.ebp = uctx->base.ebp;
+    frame.context.eax = uctx->base.eax;
+    frame.context.ds = uctx->base.ds;
+    frame.context.es = uctx->base.es;
+    frame.context.fs = uctx->base.fs;
+    frame.context.gs = uctx->base.gs;
+    frame.context.signum = signum;
+    frame.context.error_code = uctx->base.error_code;
+    frame.context.eip = uctx->base.eip;
+    frame.context.cs = uctx->base.cs;
+    frame.context.eflags = uctx->base.eflags;
+    frame.context.esp = uctx->esp;
+    frame.context.ss = uctx->ss;
+    memcpy(frame.trampoline, sig_trampoline, SIG_TRAMPOLINE_SIZE);
+    /* might fault in a fresh stack page, which the page fault hook takes care of */
+    memcpy(user_frame, &frame, sizeof(frame));
+
+    uctx->base.eip = pcb->sig_handlers[signum];
+    uctx->esp = (uint32_t) user_frame;
+    pcb->sig_masked = 1;
+}
+
+/* send_signal
+ * See signal.h.
+ * Inputs: pcb - process to signal
+ *         signum - signal to send
+ * Side effects: Marks the signal pending */
+void send_signal(pcb_t *pcb, uint32_t signum) {
+    uint32_t flags;
+    if(signum >= NUM_SIGNALS) panic_msg("bad signal number %u!", signum);
+    cli_and_save(flags);
+    if(pcb->present && !pcb->kthread) {
+        pcb->sig_pending |= 1 << signum;
+        /* take it off its wait queue, so a syscall blocked on something that might never
+         * happen (i.e. a read from the keyboard) gets to notice */
+        if(pcb->sleeping && signal_pending(pcb)) {
+            sched_block(pcb);
+            sched_wake(pcb);
+        }
+    }
+    restore_flags(flags);
+}
+
+/* signal_pending
+ * See signal.h.
+ * Inputs: pcb - process to check
+ * Return value: 1 if a signal is waiting that will do something, 0 otherwise */
+int signal_pending(pcb_t *pcb) {
+    uint32_t pending = pcb->sig_pending, signum;
+    if(pcb->sig_masked) return 0;
+    for(signum = 0; signum < NUM_SIGNALS; ++signum) {
+        if(!(pending & (1 << signum))) continue;
+        /* ALARM and USER1 are ignored without a handler, see deliver_signals */
+        if(pcb->sig_handlers[signum] || (signum != SIG_ALARM && signum != SIG_USER1))
+            return 1;
+    }
+    return 0;
+}
+
+/* signal_has_handler
+ * See signal.h.
+ * Inputs: pcb - process to check
+ *         signum - signal to check for
+ * Return value: 1 if there is a handler, 0 if the default action applies */
+int signal_has_handler(pcb_t *pcb, uint32_t signum) {
+    return signum < NUM_SIGNALS && pcb->sig_handlers[signum] != 0;
+}
+
+/* deliver_signals
+ * See signal.h.
+ * Inputs: context - context of the code we're about to return to
+ * Side effects: Might kill the current process, or redirect it to a handler */
+void deliver_signals(iret_context_base_t *context) {
+    pcb_t *pcb = get_current_pcb();
+    uint32_t flags, signum;
+    if(context->cs != USER_CS || !pcb->present) return;
+    cli_and_save(flags);
+    while(!pcb->sig_masked && pcb->sig_pending) {
+        asm ("bsfl %1, %0" : "=r"(signum) : "rm"(pcb->sig_pending) : "cc");
+        pcb->sig_pending &= ~(1 << signum);
+        if(pcb->sig_handlers[signum]) {
+            sig_setup_frame(pcb, (iret_context_user_t*) context, signum);
+            break;
+        }
+        /* default actions: ALARM and USER1 get ignored, the rest kill the process */
+        if(signum == SIG_INTERRUPT) kill_curr_process(TERMINATED_STATUS);
+        if(signum == SIG_DIV_ZERO || signum == SIG_SEGFAULT)
+            kill_curr_process(EXCEPTION_STATUS);
+    }
+    restore_flags(flags);
+}
+
+/* signal_exception
+ * See signal.h.
+ * Inputs: vect - the exception vector, divide error becomes DIV_ZERO, the rest SEGFAULT
+ *         context - context of the faulting user code
+ * Side effects: Kills the current process, unless it has a handler */
+void signal_exception(uint32_t vect, iret_context_base_t *context) {
+    pcb_t *pcb = get_current_pcb();
+    uint32_t signum = vect == 0 ? SIG_DIV_ZERO : SIG_SEGFAULT;
+    uint32_t flags;
+    cli_and_save(flags);
+    /* a fault inside a handler can't be handled, retrying it would just fault again */
+    if(!pcb->sig_masked && pcb->sig_handlers[signum]) {
+        sig_setup_frame(pcb, (iret_context_user_t*) context, signum);
+        restore_flags(flags);
+        return;
+    }
+    kill_curr_process(EXCEPTION_STATUS);
+}
+
+/* alarm_timer_fn
+ * Sends ALARM and starts the next period.
+ * Inputs: data - the process */
+static void alarm_timer_fn(void *data) {
+    pcb_t *pcb = (pcb_t*) data;
+    send_signal(pcb, SIG_ALARM);
+    /* from when it was due, not from now, so the period doesn't drift */
+    timer_add(&pcb->alarm_timer, pcb->alarm_timer.expires + ms_to_jiffies(pcb->alarm_ms));
+}
+
+/* set_alarm
+ * Sends a process ALARM every ms milliseconds from now on, or stops it if ms is 0. */
+static void set_alarm(pcb_t *pcb, uint32_t ms) {
+    uint32_t flags;
+    cli_and_save(flags);
+    timer_del(&pcb->alarm_timer);
+    pcb->alarm_ms = ms;
+    if(ms) {
+        timer_init(&pcb->alarm_timer, &alarm_timer_fn, pcb);
+        timer_add(&pcb->alarm_timer, pit_jiffies() + ms_to_jiffies(ms));
+    }
+    restore_flags(flags);
+}
+
+/* syscall_set_handler
+ * Sets the function that handles a signal.
+ * Inputs: arg1 - signal number, 0 to NUM_SIGNALS-1
+ *         arg2 - user address of the handler, void handler(int signum), or NULL to go
+ *                back to the default action
+ *         arg3 - not used
+ * Return value: 0 on success, -1 on a bad signal number or handler address
+ * Side effects: Installing an ALARM handler starts ALARM every SIG_ALARM_DEFAULT_MS,
+ *               unless the alarm syscall already set a period. */
+int32_t syscall_set_handler(int32_t arg1, int32_t arg2, int32_t arg3) {
+    pcb_t *current = get_current_pcb();
+    uint32_t handler = (uint32_t) arg2;
+    if(arg1 < 0 || arg1 >= NUM_SIGNALS) return -1;
+    if(handler && check_user_bounds((void*) handler, 1)) return -1;
+    current->sig_handlers[arg1] = handler;
+    if(arg1 == SIG_ALARM && handler && !current->alarm_ms)
+        set_alarm(current, SIG_ALARM_DEFAULT_MS);
+    return 0;
+}
+
+/* syscall_sigreturn
+ * Returns from a signal handler, called by the trampoline in the signal frame. Puts back
+ * the registers saved in the frame, including any changes the handler made to them.
+ * Inputs: none
+ * Return value: the saved EAX, so the syscall return doesn't clobber it, -1 if not
+ *               called from a handler
+ * Side effects: Unmasks signals, modifies the user context */
+int32_t syscall_sigreturn(int32_t arg1, int32_t arg2, int32_t arg3) {
+    pcb_t *current = get_current_pcb();
+    iret_context_user_t *uctx = (iret_context_user_t*)(((kernel_stack_t*)current) + 1) - 1;
+    /* the handler's ret popped the return address, leaving esp at the signal number */
+    sig_context_t *user_ctx = (sig_context_t*)(uctx->esp + sizeof(uint32_t));
+    sig_context_t ctx;
+    if(!current->sig_masked) return -1;
+    if(check_user_bounds(user_ctx, sizeof(ctx))) kill_curr_process(EXCEPTION_STATUS);
+    memcpy(&ctx, user_ctx, sizeof(ctx));
+
+    uctx->base.ebx = ctx.ebx;
+    uctx->base.ecx = ctx.ecx;
+    uctx->base.edx = ctx.edx;
+    uctx->base.esi = ctx.esi;
+    uctx->base.edi = ctx.edi;
+    uctx->base.ebp = ctx.ebp;
+    uctx->base.eax = ctx.eax;
+    uctx->base.eip = ctx.eip;
+    uctx->esp = ctx.esp;
+    /* don't let the handler smuggle in kernel segments or privileged flags */
+    uctx->base.ds = uctx->base.es = uctx->base.fs = uctx->base.gs = uctx->ss = USER_DS;
+    uctx->base.cs = USER_CS;
+    uctx->base.eflags = (uctx->base.eflags & ~SIG_EFLAGS_USER) |
+            (ctx.eflags & SIG_EFLAGS_USER);
+    current->sig_masked = 0;
+    return ctx.eax;
+}
+
+/* syscall_alarm
+ * Sets how often the current process gets ALARM.
+ * Inputs: arg1 - the period in milliseconds, up to ALARM_MAX_MS, or 0 to stop it
+ *         arg2 - not used
+ *         arg3 - not used
+ * Return value: the previous period, 0 if it was off, -1 if arg1 is out of range
+ * Side effects: Restarts the alarm timer */
+int32_t syscall_alarm(int32_t arg1, int32_t arg2, int32_t arg3) {
+    pcb_t *current = get_current_pcb();
+    uint32_t old = current->alarm_ms;
+    if(arg1 < 0 || arg1 > ALARM_MAX_MS) return -1;
+    set_alarm(current, arg1);
+    return old;
+}
+
+/* syscall_kill
+ * Sends a signal to a process, e.g. USER1 for programs to poke each other with. It gets
+ * the same treatment as one the kernel sent: its handler runs, or the default action
+ * happens, the next time the process returns to user mode.
+ * Inputs: arg1 - pid of the process, 0 to NUM_PROCESSES-1
+ *         arg2 - signal number, 0 to NUM_SIGNALS-1
+ *         arg3 - not used
+ * Return value: 0 on success, -1 on a bad signal, or if there's no such process
+ * Side effects: Marks the signal pending */
+int32_t syscall_kill(int32_t arg1, int32_t arg2, int32_t arg3) {
+    pcb_t *pcb;
+    uint32_t flags;
+    if(arg1 < 0 || arg1 >= NUM_PROCESSES || arg2 < 0 || arg2 >= NUM_SIGNALS) return -1;
+    pcb = pid_to_pcb(arg1);
+    cli_and_save(flags);
+    if(!pcb->present || pcb->kthread || pcb->zombie) {
+        restore_flags(flags);
+        return -1;
+    }
+    send_signal(pcb, arg2);
+    restore_flags(flags);
+    return 0;
+}
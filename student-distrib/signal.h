@@ -0,0 +1,84 @@
+/* signal.h - Definitions for user signal delivery */
+
+#ifndef _SIGNAL_H
+#define _SIGNAL_H
+
+#include "types.h"
+#include "idt.h"
+
+/* signal numbers, the same as the user side's enum signums */
+#define SIG_DIV_ZERO 0
+#define SIG_SEGFAULT 1
+#define SIG_INTERRUPT 2
+#define SIG_ALARM 3
+#define SIG_USER1 4
+#define NUM_SIGNALS 5
+
+/* how often ALARM gets sent to a process that installs a handler for it without
+ * asking for a period with the alarm syscall */
+#define SIG_ALARM_DEFAULT_MS 10000
+
+#ifndef ASM
+
+/* sig_context_t
+ * The registers of the interrupted user code, as saved on the user stack right above
+ * the signal number for the handler. The order of the general purpose registers is what
+ * handlers expect (e.g. ece391sigtest reaches EAX at &signum + 7), sigreturn puts
+ * back whatever the handler leaves here. */
+typedef struct sig_context_t {
+    uint32_t ebx;
+    uint32_t ecx;
+    uint32_t edx;
+    uint32_t esi;
+    uint32_t edi;
+    uint32_t ebp;
+    uint32_t eax;
+    uint32_t ds;
+    uint32_t es;
+    uint32_t fs;
+    uint32_t gs;
+    /* the signal being handled, and the exception's error code if there was one */
+    uint32_t signum;
+    uint32_t error_code;
+    uint32_t eip;
+    uint32_t cs;
+    uint32_t eflags;
+    uint32_t esp;
+    uint32_t ss;
+} sig_context_t;
+
+struct pcb_t;
+
+/* send_signal
+ * Marks a signal pending for a process. It gets delivered the next time the process
+ * returns to user mode. If the process is sleeping in a syscall, and the signal isn't
+ * one that would get ignored, it gets woken up: syscalls that can block indefinitely
+ * (sleep, terminal reads, ipc) check signal_pending and return -1 early, others just go
+ * back to sleep. Safe to call from interrupt handlers. */
+void send_signal(struct pcb_t *pcb, uint32_t signum);
+
+/* signal_pending
+ * Return value: whether the process has an unmasked signal pending that it has a
+ *               handler for, or whose default action kills it. Interrupts must be
+ *               disabled */
+int signal_pending(struct pcb_t *pcb);
+
+/* deliver_signals
+ * Called on the way back out of every interrupt, exception and syscall. If the
+ * interrupted code is a user process with an unmasked signal pending, either takes the
+ * default action (killing the process, or ignoring the signal) or sets up a signal frame
+ * on the user stack and points context at the handler. */
+void deliver_signals(iret_context_base_t *context);
+
+/* signal_exception
+ * Turns an exception in user mode into DIV_ZERO or SEGFAULT. If the process has a
+ * handler for it, context gets pointed at the handler and this returns, otherwise the
+ * process gets killed. */
+void signal_exception(uint32_t vect, iret_context_base_t *context);
+
+/* signal_has_handler
+ * Return value: whether the process installed a handler for signum */
+int signal_has_handler(struct pcb_t *pcb, uint32_t signum);
+
+#endif /* ASM */
+#endif /* _SIGNAL_H */
@@ -0,0 +1,384 @@
+/* smp.c - Implements bringing up the application processors (APs), the CPUs other than
+ * the one the bootloader started us on (the BSP).
+ * The BIOS describes the CPUs in the Intel MultiProcessor Specification tables: a
+ * floating pointer structure somewhere in the BIOS areas of the first MiB points at a
+ * configuration table with an entry for each CPU (by local APIC ID) and IOAPIC. Each AP
+ * gets woken with an INIT IPI followed by two startup IPIs, the sequence in section B.4
+ * of the MP spec, and starts running the real mode code in smp_asm.S.
+ * This only brings the APs up: they load their descriptor tables and park. Processes
+ * still all run on the BSP, off the one set of run queues in sched.c. Per-CPU run
+ * queues (and balancing between them) need every cli_and_save critical section turned
+ * into a lock first, since cli only keeps out interrupts on the CPU running it. */
+
+#include "smp.h"
+#include "apic.h"
+#include "ktime.h"
+#include "lib.h"
+#include "mm.h"
+#include "process.h"
+
+/* where to look for the floating pointer: the first KiB of the EBDA (whose segment is
+ * at 0x40E in the BIOS data area), the last KiB of base memory, and the BIOS ROM */
+#define BDA_EBDA_SEG 0x40E
+#define BASE_MEM_LAST_KB 0x9FC00
+#define BIOS_ROM_START 0xF0000
+#define BIOS_ROM_END 0x100000
+#define LOW_MEM_END 0x100000
+
+/* MP configuration table entry types, and their sizes */
+#define MP_ENTRY_PROCESSOR 0
+#define MP_ENTRY_BUS 1
+#define MP_ENTRY_IOAPIC 2
+#define MP_ENTRY_IO_INT 3
+#define MP_PROCESSOR_SIZE 20
+#define MP_OTHER_SIZE 8
+#define MP_CPU_ENABLED 0x1
+#define MP_CPU_BSP 0x2
+#define MP_IOAPIC_ENABLED 0x1
+/* interrupt type of a vectored interrupt, as opposed to NMI, SMI or ExtINT */
+#define MP_INT_VECTORED 0
+
+/* startup delays from the MP spec, in microseconds */
+#define SMP_INIT_DELAY_US 10000
+#define SMP_SIPI_DELAY_US 200
+/* how long to give an AP to show up before giving up on it */
+#define SMP_ONLINE_TIMEOUT_US 100000
+
+/* mp_float_t
+ * MP floating pointer structure */
+typedef struct __attribute__((packed)) mp_float_t {
+    int8_t signature[4]; /* "_MP_" */
+    uint32_t config_addr;
+    uint8_t length; /* in 16 byte units */
+    uint8_t spec_rev;
+    uint8_t checksum;
+    /* nonzero feature byte 1 means one of the default configurations, without a table */
+    uint8_t features[5];
+} mp_float_t;
+
+/* mp_config_t
+ * MP configuration table header, the entries come right after it */
+typedef struct __attribute__((packed)) mp_config_t {
+    int8_t signature[4]; /* "PCMP" */
+    uint16_t length;
+    uint8_t spec_rev;
+    uint8_t checksum;
+    int8_t oem_id[8];
+    int8_t product_id[12];
+    uint32_t oem_table_addr;
+    uint16_t oem_table_size;
+    uint16_t entry_count;
+    uint32_t lapic_addr;
+    uint16_t ext_length;
+    uint8_t ext_checksum;
+    uint8_t reserved;
+} mp_config_t;
+
+/* mp_processor_t
+ * Processor entry of the configuration table */
+typedef struct __attribute__((packed)) mp_processor_t {
+    uint8_t type;
+    uint8_t apic_id;
+    uint8_t apic_version;
+    uint8_t flags;
+    uint32_t signature;
+    uint32_t features;
+    uint32_t reserved[2];
+} mp_processor_t;
+
+/* mp_ioapic_t
+ * IOAPIC entry of the configuration table */
+typedef struct __attribute__((packed)) mp_ioapic_t {
+    uint8_t type;
+    uint8_t apic_id;
+    uint8_t apic_version;
+    uint8_t flags;
+    uint32_t addr;
+} mp_ioapic_t;
+
+/* mp_bus_t
+ * Bus entry of the configuration table */
+typedef struct __attribute__((packed)) mp_bus_t {
+    uint8_t type;
+    uint8_t bus_id;
+    int8_t bus_type[6]; /* i.e. "ISA   " or "PCI   " */
+} mp_bus_t;
+
+/* mp_io_int_t
+ * I/O interrupt assignment entry of the configuration table, which IOAPIC pin a bus's
+ * interrupt line is wired to */
+typedef struct __attribute__((packed)) mp_io_int_t {
+    uint8_t type;
+    uint8_t int_type;
+    uint16_t flags;
+    uint8_t src_bus;
+    uint8_t src_irq;
+    uint8_t dest_apic_id;
+    uint8_t dest_pin;
+} mp_io_int_t;
+
+cpu_t cpus[SMP_MAX_CPUS];
+uint32_t smp_num_cpus = 1;
+uint32_t smp_ioapic_addr = 0;
+uint32_t smp_ioapic_id = 0;
+uint8_t smp_isa_irq_pin[ISA_NUM_IRQS] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15
+};
+uint16_t smp_isa_irq_flags[ISA_NUM_IRQS];
+
+/* kernel stacks of the APs, with a PCB at the bottom like every other kernel stack.
+ * it's zeroed, so get_current_pcb on an AP finds a PCB that isn't present */
+static kernel_stack_t ap_stacks[SMP_MAX_CPUS]
+        __attribute__((aligned(KERNEL_STACK_SIZE)));
+
+/* low_mem_map / low_mem_unmap
+ * Identity map the first MiB (except what's already mapped, i.e. video memory) so the
+ * BIOS areas can be searched and the trampoline copied in, and take those mappings
+ * back out afterwards. Not global, so reloading CR3 flushes them. */
+static void low_mem_map(void) {
+    uint32_t i;
+    pt_ent_t pt_ent;
+    for(i = 0; i < LOW_MEM_END / PAGE_SIZE; ++i) {
+        if(low_page_table[i].present) continue;
+        pt_ent.val = 0; /* zero initialize reserved fields */
+        pt_ent.present = 1;
+        pt_ent.write_enable = 1;
+        pt_ent.avail = 1; /* marks it as one of ours */
+        pt_ent.base = i;
+        low_page_table[i] = pt_ent;
+    }
+    write_cr3(read_cr3());
+}
+static void low_mem_unmap(void) {
+    uint32_t i;
+    for(i = 0; i < LOW_MEM_END / PAGE_SIZE; ++i) {
+        if(low_page_table[i].present && low_page_table[i].avail == 1)
+            low_page_table[i].val = 0;
+    }
+    write_cr3(read_cr3());
+}
+
+/* mp_checksum
+ * Return value: whether the bytes add up to 0, like every MP structure has to */
+static int mp_checksum(const void *addr, uint32_t len) {
+    const uint8_t *bytes = (const uint8_t*) addr;
+    uint8_t sum = 0;
+    while(len--) sum += *bytes++;
+    return sum == 0;
+}
+
+/* mp_search
+ * Looks for the floating pointer structure, which is 16 byte aligned, in a range.
+ * Return value: the structure, NULL if it isn't there */
+static mp_float_t *mp_search(uint32_t start, uint32_t len) {
+    mp_float_t *mp;
+    uint32_t addr;
+    for(addr = start; addr + sizeof(mp_float_t) <= start + len; addr += 16) {
+        mp = (mp_float_t*) addr;
+        if(!strncmp(mp->signature, "_MP_", 4) && mp->length == 1 &&
+                mp_checksum(mp, sizeof(mp_float_t)))
+            return mp;
+    }
+    return NULL;
+}
+
+/* mp_find_config
+ * Return value: the MP configuration table, NULL if there isn't a (usable) one */
+static mp_config_t *mp_find_config(void) {
+    uint32_t ebda = (uint32_t)(*(uint16_t*) BDA_EBDA_SEG) << 4;
+    mp_float_t *mp = NULL;
+    mp_config_t *config;
+    if(ebda && ebda < LOW_MEM_END) mp = mp_search(ebda, 1024);
+    if(!mp) mp = mp_search(BASE_MEM_LAST_KB, 1024);
+    if(!mp) mp = mp_search(BIOS_ROM_START, BIOS_ROM_END - BIOS_ROM_START);
+    if(!mp) return NULL;
+    /* default configurations are for ancient dual 486 boards, not worth supporting */
+    if(mp->features[0] || !mp->config_addr) return NULL;
+    /* only the first MiB is mapped */
+    if(mp->config_addr + sizeof(mp_config_t) > LOW_MEM_END) return NULL;
+    config = (mp_config_t*) mp->config_addr;
+    if(strncmp(config->signature, "PCMP", 4) ||
+            mp->config_addr + config->length > LOW_MEM_END ||
+            !mp_checksum(config, config->length))
+        return NULL;
+    return config;
+}
+
+/* mp_parse_irqs
+ * Fills in smp_isa_irq_pin and smp_isa_irq_flags from the interrupt assignments for
+ * the ISA bus going to the IOAPIC. Has to run after mp_parse found the IOAPIC. */
+static void mp_parse_irqs(mp_config_t *config) {
+    uint8_t *entry = (uint8_t*)(config + 1);
+    uint8_t *end = (uint8_t*) config + config->length;
+    uint32_t i, isa_bus = -1;
+    mp_bus_t *bus;
+    mp_io_int_t *io_int;
+    /* bus entries come before the interrupt assignments that refer to them */
+    for(i = 0; i < config->entry_count && entry < end; ++i) {
+        if(*entry == MP_ENTRY_PROCESSOR) {
+            entry += MP_PROCESSOR_SIZE;
+            continue;
+        }
+        if(*entry == MP_ENTRY_BUS) {
+            bus = (mp_bus_t*) entry;
+            if(!strncmp(bus->bus_type, "ISA", 3)) isa_bus = bus->bus_id;
+        } else if(*entry == MP_ENTRY_IO_INT) {
+            io_int = (mp_io_int_t*) entry;
+            if(io_int->int_type == MP_INT_VECTORED && io_int->src_bus == isa_bus &&
+                    io_int->src_irq < ISA_NUM_IRQS &&
+                    io_int->dest_apic_id == smp_ioapic_id) {
+                smp_isa_irq_pin[io_int->src_irq] = io_int->dest_pin;
+                smp_isa_irq_flags[io_int->src_irq] = io_int->flags;
+            }
+        }
+        entry += MP_OTHER_SIZE;
+    }
+}
+
+/* mp_parse
+ * Fills in cpus from the configuration table, with the BSP first, and finds the IOAPIC.
+ * Return value: the local APIC base address from the table */
+static uint32_t mp_parse(mp_config_t *config) {
+    uint8_t *entry = (uint8_t*)(config + 1);
+    uint8_t *end = (uint8_t*) config + config->length;
+    uint32_t i;
+    mp_processor_t *proc;
+    mp_ioapic_t *ioapic;
+    for(i = 0; i < config->entry_count && entry < end; ++i) {
+        if(*entry == MP_ENTRY_PROCESSOR) {
+            proc = (mp_processor_t*) entry;
+            entry += MP_PROCESSOR_SIZE;
+            if(!(proc->flags & MP_CPU_ENABLED) || (proc->flags & MP_CPU_BSP)) continue;
+            if(smp_num_cpus == SMP_MAX_CPUS) {
+                log_msg("smp: ignoring cpu with apic id %u", proc->apic_id);
+                continue;
+            }
+            cpus[smp_num_cpus++].apic_id = proc->apic_id;
+        } else {
+            if(*entry == MP_ENTRY_IOAPIC) {
+                ioapic = (mp_ioapic_t*) entry;
+                if((ioapic->flags & MP_IOAPIC_ENABLED) && !smp_ioapic_addr) {
+                    smp_ioapic_addr = ioapic->addr;
+                    smp_ioapic_id = ioapic->apic_id;
+                }
+            }
+            entry += MP_OTHER_SIZE;
+        }
+    }
+    if(smp_ioapic_addr) mp_parse_irqs(config);
+    return config->lapic_addr;
+}
+
+/* cpu_setup_gdt
+ * Makes a CPU's GDT: a copy of the BSP's, with the TSS descriptor pointing at the CPU's
+ * own TSS, whose kernel stack is the top of the given stack. */
+static void cpu_setup_gdt(cpu_t *cpu, kernel_stack_t *stack) {
+    seg_desc_t tss_desc;
+    memcpy(cpu->gdt, gdt, sizeof(cpu->gdt));
+    memset(&cpu->tss, 0, sizeof(cpu->tss));
+    cpu->tss.ldt_segment_selector = KERNEL_LDT;
+    cpu->tss.ss0 = KERNEL_DS;
+    cpu->tss.esp0 = (uint32_t)(stack + 1);
+
+    /* same as the BSP's in kernel.c, except not marked busy yet */
+    tss_desc = tss_desc_ptr;
+    tss_desc.type = 0x9;
+    SET_TSS_PARAMS(tss_desc, &cpu->tss, tss_size);
+    cpu->gdt[KERNEL_TSS / sizeof(seg_desc_t)] = tss_desc;
+}
+
+/* smp_ap_entry
+ * Where an AP ends up after smp_asm.S has turned on paging. Loads its own descriptor
+ * tables and reports in, then halts for good, it never picks up any processes.
+ * Inputs: none
+ * Return value: never returns
+ * Side effects: Marks the CPU online */
+void smp_ap_entry(void) {
+    cpu_t *cpu = this_cpu();
+    x86_desc_t gdtr;
+    gdtr.size = sizeof(cpu->gdt) - 1;
+    gdtr.addr = (uint32_t) cpu->gdt;
+    /* the trampoline already loaded this GDT, but at a real mode address */
+    asm volatile("lgdt (%0)" :: "r"(&gdtr.size) : "memory");
+    /* the lidt macro's "g" constraint would turn the address into an immediate */
+    asm volatile("lidt (%0)" :: "r"(&idt_desc_ptr) : "memory");
+    lldt(KERNEL_LDT);
+    ltr(KERNEL_TSS);
+    cpu->online = 1;
+    /* interrupts stay off, there's nothing an AP is allowed to do yet */
+    while(1) asm volatile("cli; hlt");
+}
+
+/* smp_start_ap
+ * Sends an AP the INIT/startup sequence and waits for it to come online.
+ * Return value: 0 once it's online, -1 if it never showed up */
+static int smp_start_ap(cpu_t *cpu, kernel_stack_t *stack) {
+    uint8_t *tramp = (uint8_t*) SMP_TRAMPOLINE_ADDR;
+    x86_desc_t gdtr;
+    uint32_t waited;
+    cpu_setup_gdt(cpu, stack);
+    gdtr.size = sizeof(cpu->gdt) - 1;
+    gdtr.addr = (uint32_t) cpu->gdt;
+    memcpy(tramp + (smp_trampoline_gdtr - smp_trampoline), &gdtr.size, 6);
+    smp_ap_stack_top = (uint32_t)(stack + 1);
+
+    lapic_send_ipi(cpu->apic_id, LAPIC_ICR_INIT | LAPIC_ICR_ASSERT | LAPIC_ICR_LEVEL);
+    tsc_delay_us(SMP_INIT_DELAY_US);
+    lapic_send_ipi(cpu->apic_id, LAPIC_ICR_STARTUP | (SMP_TRAMPOLINE_ADDR >> 12));
+    tsc_delay_us(SMP_SIPI_DELAY_US);
+    if(!cpu->online) {
+        lapic_send_ipi(cpu->apic_id, LAPIC_ICR_STARTUP | (SMP_TRAMPOLINE_ADDR >> 12));
+        tsc_delay_us(SMP_SIPI_DELAY_US);
+    }
+    for(waited = 0; !cpu->online && waited < SMP_ONLINE_TIMEOUT_US; waited += 100)
+        tsc_delay_us(100);
+    return cpu->online ? 0 : -1;
+}
+
+/* smp_init
+ * See smp.h.
+ * Inputs: none
+ * Return value: none
+ * Side effects: Maps the local APIC, starts the APs */
+void smp_init(void) {
+    mp_config_t *config;
+    uint32_t lapic_base, i, online = 1;
+    cpus[0].online = 1;
+    if(!lapic_present() || !tsc_khz) {
+        log_msg("smp: no local APIC or TSC, staying on one cpu");
+        return;
+    }
+    low_mem_map();
+    config = mp_find_config();
+    if(!config) {
+        low_mem_unmap();
+        log_msg("smp: no MP configuration table, staying on one cpu");
+        return;
+    }
+    lapic_base = mp_parse(config);
+    if(!lapic_base) lapic_base = LAPIC_DEFAULT_BASE;
+    lapic_map(lapic_base);
+    cpus[0].apic_id = lapic_id();
+
+    memcpy((void*) SMP_TRAMPOLINE_ADDR, smp_trampoline, smp_trampoline_end - smp_trampoline);
+    for(i = 1; i < smp_num_cpus; ++i) {
+        if(smp_start_ap(&cpus[i], &ap_stacks[i])) {
+            log_msg("smp: cpu with apic id %u didn't start", cpus[i].apic_id);
+            continue;
+        }
+        ++online;
+    }
+    low_mem_unmap();
+    log_msg("smp: %u of %u cpus online", online, smp_num_cpus);
+}
+
+/* this_cpu
+ * See smp.h.
+ * Return value: the current CPU, the BSP if the local APIC isn't in use */
+cpu_t *this_cpu(void) {
+    uint32_t id = lapic_id(), i;
+    for(i = 1; i < smp_num_cpus; ++i) {
+        if(cpus[i].apic_id == id) return &cpus[i];
+    }
+    return &cpus[0];
+}
@@ -0,0 +1,74 @@
+/* smp.h - Definitions for bringing up the other CPUs */
+
+#ifndef _SMP_H
+#define _SMP_H
+
+#include "types.h"
+#include "x86_desc.h"
+
+/* most CPUs we keep track of, extra ones in the MP table are left alone */
+#define SMP_MAX_CPUS 8
+/* number of GDT entries, up to and including the LDT descriptor */
+#define SMP_GDT_ENTRIES 8
+/* physical address the AP startup code gets copied to. the startup IPI's vector is the
+ * page number, and it has to be in the first MiB, since the APs start in real mode */
+#define SMP_TRAMPOLINE_ADDR 0x8000
+
+/* IRQ lines of the ISA bus, the ones the 8259s handle */
+#define ISA_NUM_IRQS 16
+/* polarity and trigger mode flags of an MP table interrupt assignment. the defaults
+ * (0) mean whatever the bus uses, for ISA that's active high and edge triggered */
+#define MP_IRQ_POLARITY_MASK 0x3
+#define MP_IRQ_ACTIVE_LOW 0x3
+#define MP_IRQ_TRIGGER_MASK 0xC
+#define MP_IRQ_LEVEL 0xC
+
+#ifndef ASM
+
+/* cpu_t
+ * Per-CPU state. Each CPU gets its own GDT so its TSS descriptor can point at its own
+ * TSS, ltr marks the descriptor busy so CPUs can't share one. */
+typedef struct cpu_t {
+    uint32_t apic_id;
+    /* set by the CPU itself once it's running kernel code */
+    volatile uint32_t online;
+    seg_desc_t gdt[SMP_GDT_ENTRIES] __attribute__((aligned(8)));
+    tss_t tss;
+} cpu_t;
+
+extern cpu_t cpus[SMP_MAX_CPUS];
+/* number of entries in cpus, the BSP (the CPU we booted on) is cpus[0] */
+extern uint32_t smp_num_cpus;
+/* physical address and APIC ID of the (first) IOAPIC from the MP table, address 0 if
+ * there wasn't one */
+extern uint32_t smp_ioapic_addr;
+extern uint32_t smp_ioapic_id;
+/* which IOAPIC pin each ISA IRQ is wired to, and its MP table flags (MP_IRQ_*), from
+ * the table's interrupt assignments. ISA IRQ n is on pin n unless the table says
+ * otherwise, usually except for the PIT, which tends to be on pin 2 */
+extern uint8_t smp_isa_irq_pin[ISA_NUM_IRQS];
+extern uint16_t smp_isa_irq_flags[ISA_NUM_IRQS];
+
+/* smp_init
+ * Finds the other CPUs in the MP configuration table and starts them up. They load
+ * their own GDT, TSS and IDT, then halt with interrupts off: everything in the kernel
+ * relies on cli for mutual exclusion, which does nothing about other CPUs, so they
+ * can't run processes yet. Has to run before interrupts get enabled, after tsc_init
+ * (the startup sequence is timed with the TSC), and before any process gets a page
+ * directory (see lapic_map). */
+void smp_init(void);
+
+/* this_cpu
+ * Return value: the current CPU's entry in cpus */
+cpu_t *this_cpu(void);
+
+/* startup code in smp_asm.S, copied to SMP_TRAMPOLINE_ADDR */
+extern uint8_t smp_trampoline[];
+extern uint8_t smp_trampoline_end[];
+/* the GDTR the startup code loads, inside the trampoline */
+extern uint8_t smp_trampoline_gdtr[];
+/* stack the next AP starts on */
+extern uint32_t smp_ap_stack_top;
+
+#endif /* ASM */
+#endif /* _SMP_H */
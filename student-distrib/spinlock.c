@@ -0,0 +1,192 @@
+/* spinlock.c - Implements spinlocks and ticket locks, and their statistics.
+ * Everything else in the kernel gets mutual exclusion by disabling interrupts, which
+ * only works with a single CPU, and makes every critical section exclude every other
+ * one. A lock only excludes the code that takes the same lock, and with LOCK_STATS (and
+ * a TSC) each kind of lock keeps count of how often it's taken, fought over and held, so it's
+ * easy to see which critical sections are worth narrowing. */
+
+#include "spinlock.h"
+#include "ktime.h"
+
+/* registered lock classes, and the lock protecting the list */
+static lock_class_t *lock_classes = NULL;
+/* cpu_relax
+ * Tells the CPU we're spinning, which saves power and keeps it from flooding the
+ * memory bus with speculative loads of the lock */
+static inline void cpu_relax(void) {
+    asm volatile("pause" ::: "memory");
+}
+
+/* xchg
+ * Atomically swaps a new value into memory.
+ * Return value: the old value */
+static inline uint32_t xchg(volatile uint32_t *addr, uint32_t val) {
+    asm volatile("xchgl %0, %1" : "+r"(val), "+m"(*addr) :: "memory");
+    return val;
+}
+
+#ifdef LOCK_STATS
+static spinlock_t lock_classes_lock = SPINLOCK_INIT(NULL);
+
+/* lock_stat_register
+ * Adds a class to the list lock_stats_print goes through, the first time it's used */
+static void lock_stat_register(lock_class_t *class) {
+    uint32_t flags;
+    spin_lock_irqsave(&lock_classes_lock, flags);
+    if(!class->registered) {
+        class->registered = 1;
+        class->next = lock_classes;
+        lock_classes = class;
+    }
+    spin_unlock_irqrestore(&lock_classes_lock, flags);
+}
+#endif
+
+/* lock_stat_acquired
+ * Counts an acquisition, right after the lock was taken.
+ * Inputs: class - the lock's class, NULL for none
+ *         acquired_at - the lock's acquired_at
+ *         spin_start - TSC when the lock turned out to be taken, 0 if it wasn't */
+static void lock_stat_acquired(lock_class_t *class, uint64_t *acquired_at,
+        uint64_t spin_start) {
+#ifdef LOCK_STATS
+    /* without a TSC rdtsc is an invalid opcode */
+    if(!class || !tsc_khz) {
+        *acquired_at = 0;
+        return;
+    }
+    if(!class->registered) lock_stat_register(class);
+    *acquired_at = rdtsc();
+    ++class->acquired;
+    if(spin_start) {
+        ++class->contended;
+        class->spin_cycles += *acquired_at - spin_start;
+    }
+#endif
+}
+
+/* lock_stat_released
+ * Counts the hold time, right before the lock gets released.
+ * Inputs: class - the lock's class, NULL for none
+ *         acquired_at - the lock's acquired_at */
+static void lock_stat_released(lock_class_t *class, uint64_t acquired_at) {
+#ifdef LOCK_STATS
+    uint64_t held;
+    /* also skips locks taken before tsc_init found the TSC */
+    if(!class || !acquired_at) return;
+    held = rdtsc() - acquired_at;
+    class->hold_cycles += held;
+    if(held > class->max_hold_cycles)
+        class->max_hold_cycles = held >> 32 ? 0xFFFFFFFF : (uint32_t) held;
+#endif
+}
+
+/* spin_lock
+ * See spinlock.h.
+ * Inputs: lock - the lock to take
+ * Side effects: Spins until it's free */
+void spin_lock(spinlock_t *lock) {
+    uint64_t spin_start = 0;
+    uint32_t loops = 0;
+    while(xchg(&lock->locked, 1)) {
+#ifdef LOCK_STATS
+        if(!spin_start && tsc_khz) spin_start = rdtsc();
+#endif
+        /* wait for it to look free before trying again, so the cache line isn't
+         * bouncing between the waiters */
+        while(lock->locked) {
+            cpu_relax();
+            if(++loops == SPIN_DEADLOCK_LOOPS)
+                panic_msg("deadlock on %s spinlock 0x%#x!",
+                        lock->class ? lock->class->name : "unnamed", lock);
+        }
+    }
+    lock_stat_acquired(lock->class, &lock->acquired_at, spin_start);
+}
+
+/* spin_trylock
+ * See spinlock.h.
+ * Inputs: lock - the lock to take
+ * Return value: 1 if it was taken, 0 otherwise */
+int spin_trylock(spinlock_t *lock) {
+    if(lock->locked || xchg(&lock->locked, 1)) return 0;
+    lock_stat_acquired(lock->class, &lock->acquired_at, 0);
+    return 1;
+}
+
+/* spin_unlock
+ * See spinlock.h.
+ * Inputs: lock - the lock to release, which we hold */
+void spin_unlock(spinlock_t *lock) {
+    if(!lock->locked) panic_msg("unlocking spinlock 0x%#x that isn't locked!", lock);
+    lock_stat_released(lock->class, lock->acquired_at);
+    /* x86 doesn't reorder stores with older loads or stores, so a plain store releases
+     * it, as long as the compiler doesn't move anything past it */
+    asm volatile("" ::: "memory");
+    lock->locked = 0;
+}
+
+/* ticket_lock
+ * See spinlock.h.
+ * Inputs: lock - the lock to take
+ * Side effects: Spins until it's our turn */
+void ticket_lock(ticket_lock_t *lock) {
+    uint64_t spin_start = 0;
+    uint32_t loops = 0;
+    uint16_t ticket = 1;
+    asm volatile("lock xaddw %0, %1" : "+r"(ticket), "+m"(lock->next) :: "memory", "cc");
+    if(lock->serving != ticket) {
+#ifdef LOCK_STATS
+        if(tsc_khz) spin_start = rdtsc();
+#endif
+        while(lock->serving != ticket) {
+            cpu_relax();
+            if(++loops == SPIN_DEADLOCK_LOOPS)
+                panic_msg("deadlock on %s ticket lock 0x%#x!",
+                        lock->class ? lock->class->name : "unnamed", lock);
+        }
+    }
+    lock_stat_acquired(lock->class, &lock->acquired_at, spin_start);
+}
+
+/* ticket_unlock
+ * See spinlock.h.
+ * Inputs: lock - the lock to release, which we hold */
+void ticket_unlock(ticket_lock_t *lock) {
+    if(lock->serving == lock->next)
+        panic_msg("unlocking ticket lock 0x%#x that isn't locked!", lock);
+    lock_stat_released(lock->class, lock->acquired_at);
+    asm volatile("" ::: "memory");
+    /* only the holder writes serving */
+    lock->serving = lock->serving + 1;
+}
+
+/* lock_stats_print
+ * See spinlock.h.
+ * Inputs: none
+ * Side effects: Prints to the screen */
+void lock_stats_print(void) {
+    lock_class_t *class;
+    uint64_t avg_hold, avg_spin;
+#ifndef LOCK_STATS
+    printf("[LOCKS] compiled without LOCK_STATS\n");
+    return;
+#endif
+    if(!tsc_khz) {
+        printf("[LOCKS] no usable TSC, nothing was counted\n");
+        return;
+    }
+    for(class = lock_classes; class; class = class->next) {
+        if(!class->acquired) continue;
+        avg_hold = cycles_to_ns(class->hold_cycles);
+        div64_32(&avg_hold, class->acquired);
+        avg_spin = 0;
+        if(class->contended) {
+            avg_spin = cycles_to_ns(class->spin_cycles);
+            div64_32(&avg_spin, class->contended);
+        }
+        printf("[LOCKS] %s: %u taken, %u contended (avg wait %uns), hold avg %uns max %uns\n",
+                class->name, class->acquired, class->contended, (uint32_t) avg_spin,
+                (uint32_t) avg_hold, (uint32_t) cycles_to_ns(class->max_hold_cycles));
+    }
+}
@@ -0,0 +1,113 @@
+/* spinlock.h - Definitions for spinlocks and ticket locks */
+
+#ifndef _SPINLOCK_H
+#define _SPINLOCK_H
+
+#include "types.h"
+#include "lib.h"
+
+/* uncomment for per lock class statistics, they cost two rdtscs per acquisition. they
+ * only get kept once tsc_init found a usable TSC */
+// #define LOCK_STATS
+/* spinning this many times on a lock is taken to mean it's never getting released, i.e.
+ * it's being taken recursively, or by an interrupt handler that interrupted its holder */
+#define SPIN_DEADLOCK_LOOPS 100000000
+
+#ifndef ASM
+
+/* lock_class_t
+ * Statistics shared by all the locks of one kind, i.e. every wait queue lock, so hot
+ * spots show up per subsystem rather than per lock. Only updated while holding one of
+ * the locks, so locks of the same class on different CPUs can lose updates: the
+ * numbers are for finding contention, not for accounting. */
+typedef struct lock_class_t {
+    const int8_t *name;
+    uint32_t acquired;
+    /* acquisitions that had to wait, and the TSC cycles spent waiting */
+    uint32_t contended;
+    uint64_t spin_cycles;
+    /* TSC cycles the locks were held for, in total and at most */
+    uint64_t hold_cycles;
+    uint32_t max_hold_cycles;
+    /* registered classes, in order of first use, for lock_stats_print */
+    struct lock_class_t *next;
+    uint32_t registered;
+} lock_class_t;
+#define LOCK_CLASS_INIT(class_name) {.name = (class_name), .acquired = 0,     \
+        .contended = 0, .spin_cycles = 0, .hold_cycles = 0, .max_hold_cycles = 0, \
+        .next = NULL, .registered = 0}
+
+/* spinlock_t
+ * Test and test-and-set lock. Taking one doesn't disable interrupts, so anything an
+ * interrupt handler also takes has to use spin_lock_irqsave. */
+typedef struct spinlock_t {
+    volatile uint32_t locked;
+    /* NULL for no statistics */
+    lock_class_t *class;
+    /* TSC when it was taken, for the hold time */
+    uint64_t acquired_at;
+} spinlock_t;
+#define SPINLOCK_INIT(lock_class) {.locked = 0, .class = (lock_class), .acquired_at = 0}
+
+/* ticket_lock_t
+ * Fair lock: everyone takes a ticket and waits for it to be served, so CPUs get the
+ * lock in the order they asked for it, and no one starves under contention. */
+typedef struct ticket_lock_t {
+    volatile uint16_t serving;
+    volatile uint16_t next;
+    lock_class_t *class;
+    uint64_t acquired_at;
+} ticket_lock_t;
+#define TICKET_LOCK_INIT(lock_class) {.serving = 0, .next = 0, .class = (lock_class), \
+        .acquired_at = 0}
+
+/* spin_lock / spin_unlock
+ * Take and release a spinlock, spinning until it's free. Panics if it looks like the
+ * lock will never be free. */
+void spin_lock(spinlock_t *lock);
+void spin_unlock(spinlock_t *lock);
+
+/* spin_trylock
+ * Return value: 1 if it took the lock, 0 if someone else holds it */
+int spin_trylock(spinlock_t *lock);
+
+/* ticket_lock / ticket_unlock
+ * Take and release a ticket lock, waiting for our turn. */
+void ticket_lock(ticket_lock_t *lock);
+void ticket_unlock(ticket_lock_t *lock);
+
+/* spin_lock_irqsave / spin_unlock_irqrestore
+ * Take a spinlock with interrupts disabled, saving the old flags the way cli_and_save
+ * does, and release it putting them back. For data interrupt handlers also touch: the
+ * lock keeps other CPUs out, disabling interrupts keeps out this CPU's handlers. */
+#define spin_lock_irqsave(lock, flags)      \
+do {                                        \
+    cli_and_save(flags);                    \
+    spin_lock(lock);                        \
+} while(0)
+#define spin_unlock_irqrestore(lock, flags) \
+do {                                        \
+    spin_unlock(lock);                      \
+    restore_flags(flags);                   \
+} while(0)
+
+/* ticket_lock_irqsave / ticket_unlock_irqrestore
+ * Same as the spinlock versions, for ticket locks */
+#define ticket_lock_irqsave(lock, flags)    \
+do {                                        \
+    cli_and_save(flags);                    \
+    ticket_lock(lock);                      \
+} while(0)
+#define ticket_unlock_irqrestore(lock, flags) \
+do {                                        \
+    ticket_unlock(lock);                    \
+    restore_flags(flags);                   \
+} while(0)
+
+/* lock_stats_print
+ * Prints the statistics of every lock class that has been used: acquisitions, how
+ * many were contended and the average wait, and the average and longest hold time. */
+void lock_stats_print(void);
+
+#endif /* ASM */
+#endif /* _SPINLOCK_H */
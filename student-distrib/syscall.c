@@ -14,4 +14,28 @@ syscall_t *syscall_tbl[NUM_SYSCALLS] = {
     &syscall_close,
     &syscall_getargs,
     &syscall_vidmap,
+    &syscall_set_handler,
+    &syscall_sigreturn,
+    &syscall_nice,
+    &syscall_timeslice,
+    &syscall_fork,
+    &syscall_spawn,
+    &syscall_waitpid,
+    &syscall_procinfo,
+    &syscall_sleep,
+    &syscall_clock_gettime,
+    &syscall_alarm,
+    &syscall_shm_create,
+    &syscall_shm_attach,
+    &syscall_ipc_send,
+    &syscall_ipc_receive,
+    &syscall_ipc_call,
+    &syscall_termweight,
+    &syscall_yield,
+    &syscall_sched_setparam,
+    &syscall_brk,
+    &syscall_sbrk,
+    &syscall_mmap,
+    &syscall_munmap,
+    &syscall_kill,
 };
@@ -5,7 +5,7 @@
 
 #include "idt.h"
 
-#define NUM_SYSCALLS 10
+#define NUM_SYSCALLS 32
 
 #ifndef ASM
 
@@ -22,6 +22,28 @@ typedef int32_t syscall_t(int32_t arg1, int32_t arg2, int32_t arg3);
 8. int32_t vidmap (uint8_t** screen start);
 9. int32_t set handler (int32_t signum, void* handler_address);
 10. int32_t sigreturn (void);
+11. int32_t nice (int32_t inc);
+12. int32_t timeslice (int32_t ms);
+13. int32_t fork (void);
+14. int32_t spawn (const uint8_t* command);
+15. int32_t waitpid (int32_t pid, int32_t* status, int32_t flags);
+16. int32_t procinfo (int32_t pid, procinfo_t* info);
+17. int32_t sleep (int32_t ms);
+18. int32_t clock_gettime (int32_t clock_id, timespec_t* ts);
+19. int32_t alarm (int32_t ms);
+20. int32_t shm_create (uint32_t key, int32_t size);
+21. int32_t shm_attach (int32_t id, void* addr);
+22. int32_t ipc_send (int32_t pid, const void* msg);
+23. int32_t ipc_receive (int32_t pid, void* msg);
+24. int32_t ipc_call (int32_t pid, void* msg);
+25. int32_t termweight (int32_t terminal, int32_t weight);
+26. int32_t yield (void);
+27. int32_t sched_setparam (int32_t policy, int32_t rt_prio);
+28. int32_t brk (void* addr);
+29. void* sbrk (int32_t increment);
+30. void* mmap (void* addr, int32_t length);
+31. int32_t munmap (void* addr, int32_t length);
+32. int32_t kill (int32_t pid, int32_t signum);
 */
 
 extern syscall_t syscall_halt; // In process.c
@@ -32,6 +54,30 @@ extern syscall_t syscall_open; // In fd.c
 extern syscall_t syscall_close; // In fd.c
 extern syscall_t syscall_getargs; // In process.c
 extern syscall_t syscall_vidmap; // In mm.c
+extern syscall_t syscall_set_handler; // In signal.c
+extern syscall_t syscall_sigreturn; // In signal.c
+extern syscall_t syscall_nice; // In sched.c
+extern syscall_t syscall_timeslice; // In sched.c
+extern syscall_t syscall_fork; // In process.c
+extern syscall_t syscall_spawn; // In process.c
+extern syscall_t syscall_waitpid; // In process.c
+extern syscall_t syscall_procinfo; // In process.c
+extern syscall_t syscall_sleep; // In timer.c
+extern syscall_t syscall_clock_gettime; // In ktime.c
+extern syscall_t syscall_alarm; // In signal.c
+extern syscall_t syscall_shm_create; // In shm.c
+extern syscall_t syscall_shm_attach; // In shm.c
+extern syscall_t syscall_ipc_send; // In ipc.c
+extern syscall_t syscall_ipc_receive; // In ipc.c
+extern syscall_t syscall_ipc_call; // In ipc.c
+extern syscall_t syscall_termweight; // In sched.c
+extern syscall_t syscall_yield; // In sched.c
+extern syscall_t syscall_sched_setparam; // In sched.c
+extern syscall_t syscall_brk; // In mm.c
+extern syscall_t syscall_sbrk; // In mm.c
+extern syscall_t syscall_mmap; // In vma.c
+extern syscall_t syscall_munmap; // In vma.c
+extern syscall_t syscall_kill; // In signal.c
 
 /* syscall_tbl
  * Jump table for the syscalls, syscall number i maps to index i-1 in this array
@@ -5,6 +5,8 @@
 #include "lib.h"
 #include "process.h"
 #include "mm.h"
+#include "gui.h"
+#include "signal.h"
 
 #define VIDEO_MEM_SIZE 4096     // 4KB block
 #define NUM_TERMINALS 3
@@ -114,6 +116,7 @@ void switch_terminal(int new_terminal_id) {
     update_cursor(terminals[active_terminal_id].screen_y, terminals[active_terminal_id].screen_x);
 
     // if(need_tlb_flush) set_user_page(pcb_to_pid(curr_pcb));
+    gui_request_render();
 
     // Restore interrupts to their previous state
     restore_flags(flags);
@@ -145,6 +148,7 @@ void term_recv_byte(char c, int terminal_id) { // gets called from keyboard.c pu
         if (c == '\n') {
             // Handle newline
            term->term_in_flag = 1;
+           sched_wake_all(&term->read_queue);
         }
     }
 }
@@ -209,10 +213,14 @@ int32_t term_read(fd_info_t *fd_info, void *buf, int32_t nbytes) {
     if (buf == NULL || nbytes < 0) return -1;
     pcb_t *curr_pcb = get_current_pcb();
     terminal_t *term = &terminals[curr_pcb->terminal_id];
+    cli_and_save(flags);
     while(!term->term_in_flag) { // wait for enter to be pressed
-        asm volatile("hlt");
+        if(signal_pending(curr_pcb)) { // i.e. ctrl+c, or a kill
+            restore_flags(flags);
+            return -1;
+        }
+        sched_sleep(&term->read_queue);
     }
-    cli_and_save(flags);
     //
     int i; // the number of bytes copied.
     for(i = 0; i < nbytes; i++) { // for nbytes wanted to be read
@@ -388,6 +396,7 @@ void term_putc(uint8_t c, int terminal_id) {
     }
 
     term_update_cursor(term->screen_y, term->screen_x, terminal_id);
+    gui_request_render();
     restore_flags(flags);
 }
 
@@ -467,6 +476,7 @@ void term_clear_screen(int terminal_id) {
         // memcpy((void*)VGA_MEM_BASE, video_buffers[terminal_id], VIDEO_MEM_SIZE);
         term_update_cursor(0, 0, terminal_id);
     }
+    gui_request_render();
 
     restore_flags(flags);
 }
@@ -525,6 +535,7 @@ void term_bksp(int terminal_id) {
         if (terminal_id == get_active_terminal_id()) {
             update_cursor(term->screen_y, term->screen_x);
         }
+        gui_request_render();
     }
 
     restore_flags(flags);
@@ -9,6 +9,7 @@
 #define NUM_TERMINALS   3
 
 #include "fd.h"
+#include "sched.h"
 
 #ifndef ASM
 
@@ -38,6 +39,8 @@ typedef struct {
     char keyboard_buffer[KEYBOARD_BUFFER_SIZE];
     int buffer_index;
     volatile int term_in_flag;
+    /* processes waiting in term_read for a line of input */
+    wait_queue_t read_queue;
 } terminal_t;
 extern terminal_t terminals[NUM_TERMINALS];    // We have 3 terminals
 
@@ -10,6 +10,16 @@
 #include "process.h"
 #include "syscall.h"
 #include "pit.h"
+#include "kmalloc.h"
+#include "fpu.h"
+#include "timer.h"
+#include "ktime.h"
+#include "gui.h"
+#include "kthread.h"
+#include "spinlock.h"
+#include "sched.h"
+#include "vma.h"
+#include "signal.h"
 
 #define PASS 1
 #define FAIL 0
@@ -129,6 +139,8 @@ int rtc_main_test() {
 
 	/* see rtc.c for what this does */
 	enable_rtc_test = 1;
+	/* the periodic interrupt is normally only on while RTC fd's are open */
+	rtc_set_periodic(1);
 
 	return PASS;
 }
@@ -1391,6 +1403,868 @@ int pit_test() {
 	return PASS;
 }
 
+/* pit_setrate_test
+ * Checks that pit_setrate rejects rates outside of its range, and any rate at all once
+ * the PIT is running, and that ms_to_jiffies follows the rate.
+ * Inputs: none
+ * Outputs: PASS/FAIL
+ * Side effects: None, the rate never changes
+ * Coverage: pit_setrate, ms_to_jiffies
+ * Files: pit.c/h */
+int pit_setrate_test() {
+	TEST_HEADER;
+	int result = PASS;
+	uint32_t old_hz = pit_hz;
+
+	if(pit_setrate(PIT_MIN_HZ - 1) != -1 || pit_setrate(PIT_MAX_HZ + 1) != -1) {
+		printf("pit_setrate accepted an out of range rate\n");
+		result = FAIL;
+	}
+	/* the tests run after pit_init, with timers possibly pending */
+	if(pit_setrate(old_hz == 100 ? PIT_DEFAULT_HZ : 100) != -1 || pit_hz != old_hz) {
+		printf("pit_setrate changed the rate of a running PIT\n");
+		result = FAIL;
+	}
+	if(ms_to_jiffies(1000) != pit_hz || ms_to_jiffies(1) != 1) {
+		printf("ms_to_jiffies doesn't follow the %uHz rate\n", pit_hz);
+		result = FAIL;
+	}
+	return result;
+}
+
+/* Kernel heap tests */
+
+/* kmalloc_test
+ * Allocates objects from every size class plus a large allocation, checks that they
+ * are aligned, don't overlap, and that freeing everything gives the memory back.
+ * Inputs: none
+ * Outputs: PASS/FAIL
+ * Side effects: none, other than leaving at most one empty slab per cache around
+ * Coverage: kmalloc, kzalloc, kfree, alloc_frames, free_frames
+ * Files: kmalloc.c/h, mm.c/h */
+int kmalloc_test() {
+	TEST_HEADER;
+	int result = PASS;
+	uint8_t *objs[64];
+	uint32_t i, j, size;
+
+	if(kmalloc(0) != NULL) {
+		printf("kmalloc(0) didn't return NULL\n");
+		result = FAIL;
+	}
+	kfree(NULL); /* should do nothing */
+
+	for(size = 1; size <= KMALLOC_MAX_SIZE * 4; size = size * 2 + 1) {
+		uint32_t align = size > KMALLOC_MAX_SIZE ? PAGE_SIZE : 16;
+		for(i = 0; i < 64; ++i) {
+			objs[i] = kzalloc(size);
+			if(!objs[i]) {
+				printf("kzalloc(%u) failed on object %u\n", size, i);
+				result = FAIL;
+				break;
+			}
+			if((uint32_t) objs[i] % align) {
+				printf("kzalloc(%u) returned misaligned %#x\n", size, objs[i]);
+				result = FAIL;
+			}
+			for(j = 0; j < size; ++j) {
+				if(objs[i][j]) {
+					printf("kzalloc(%u) returned memory that isn't zeroed\n", size);
+					result = FAIL;
+					break;
+				}
+			}
+			memset(objs[i], i, size);
+		}
+		/* if any objects overlapped, the later memset would have clobbered the earlier */
+		for(j = 0; j < i; ++j) {
+			if(objs[j][0] != (uint8_t) j || objs[j][size-1] != (uint8_t) j) {
+				printf("kmalloc(%u) objects %u overlaps another\n", size, j);
+				result = FAIL;
+			}
+		}
+		while(i--) kfree(objs[i]);
+	}
+
+	for(i = 0; i < KMALLOC_NUM_CACHES; ++i) {
+		if(kmalloc_cache_stats(i)->active_objs != 0) {
+			printf("%s still has active objects\n", kmalloc_cache_stats(i)->name);
+			result = FAIL;
+		}
+	}
+	if(kmalloc_cache_stats(KMALLOC_NUM_CACHES) != NULL) result = FAIL;
+
+	return result;
+}
+
+/* fpu_test
+ * Checks that the FPU is set up for lazy switching: usable (not emulated), but with TS
+ * set so the first process to use it traps, and that the save areas are aligned.
+ * Inputs: none
+ * Outputs: PASS/FAIL
+ * Side effects: none
+ * Coverage: fpu_init
+ * Files: fpu.c/h */
+int fpu_test() {
+	TEST_HEADER;
+	int result = PASS;
+	cr0_t cr0 = read_cr0();
+	uint32_t i;
+
+	if(cr0.emulation || !cr0.monitor_coprocessor || !cr0.task_switched) {
+		printf("bad CR0 flags %#x\n", cr0.val);
+		result = FAIL;
+	}
+	if(fpu_owner != NULL) result = FAIL;
+	for(i = 0; i < NUM_PROCESSES; ++i) {
+		if((uint32_t) &pid_to_pcb(i)->fpu_state % 16) {
+			printf("pid %u has a misaligned fpu_state\n", i);
+			result = FAIL;
+		}
+	}
+	return result;
+}
+
+/* cow_test_map
+ * Maps the given user page table in at USER_VMEM_START, like set_user_page does */
+static void cow_test_map(pt_ent_t *page_table) {
+	pd_ent_t pd_ent;
+	pd_ent.val = 0;
+	pd_ent.present = 1;
+	pd_ent.write_enable = 1;
+	pd_ent.user_access = 1;
+	pd_ent.base = (uint32_t) page_table >> 12;
+	kernel_page_dir[USER_VMEM_START >> 22] = pd_ent;
+	write_cr3(read_cr3());
+}
+
+/* cow_test
+ * Checks demand-zero paging and copy-on-write: a cloned address space shares its
+ * frames, a write gives the writer its own copy, and the last sharer takes the frame over.
+ * Inputs: none
+ * Outputs: PASS/FAIL
+ * Side effects: Temporarily maps user memory
+ * Coverage: user_space_create, user_space_clone, user_space_destroy, page fault hook
+ * Files: mm.c/h */
+int cow_test() {
+	TEST_HEADER;
+	int result = PASS;
+	pd_ent_t old_pd_ent = kernel_page_dir[USER_VMEM_START >> 22];
+	volatile uint32_t *word = (uint32_t*) USER_VMEM_START;
+	uint32_t free_before = frames_free();
+	uint32_t shared_base;
+	pt_ent_t *parent, *child;
+
+	parent = user_space_create();
+	if(!parent) return FAIL;
+	cow_test_map(parent);
+	if(*word != 0) {
+		printf("demand-zero page isn't zeroed\n");
+		result = FAIL;
+	}
+	*word = 1;
+	child = user_space_clone(parent);
+	if(!child) return FAIL;
+	shared_base = parent[0].base;
+	if(child[0].base != shared_base || parent[0].write_enable ||
+			frame_refcount((void*)(shared_base << 12)) != 2) {
+		printf("clone didn't share the page read-only\n");
+		result = FAIL;
+	}
+	*word = 2; /* parent gets a private copy */
+	if(parent[0].base == shared_base || !parent[0].write_enable) result = FAIL;
+	cow_test_map(child);
+	if(*word != 1) {
+		printf("write through a copy-on-write page leaked into the clone\n");
+		result = FAIL;
+	}
+	*word = 3; /* child is the last one sharing, so it keeps the frame */
+	if(child[0].base != shared_base) result = FAIL;
+	cow_test_map(parent);
+	if(*word != 2) result = FAIL;
+
+	user_space_destroy(child);
+	user_space_destroy(parent);
+	kernel_page_dir[USER_VMEM_START >> 22] = old_pd_ent;
+	write_cr3(read_cr3());
+	if(frames_free() != free_before) {
+		printf("leaked %d frames\n", free_before - frames_free());
+		result = FAIL;
+	}
+	return result;
+}
+
+/* shm_share_test
+ * Checks that pages mapped with user_space_map_shared stay shared and writable across a
+ * clone, instead of going copy-on-write, and that the frames outlive their first owner.
+ * Inputs: none
+ * Outputs: PASS/FAIL
+ * Side effects: Temporarily maps user memory
+ * Coverage: user_space_map_shared, user_space_clone, user_space_destroy
+ * Files: mm.c/h */
+int shm_share_test() {
+	TEST_HEADER;
+	int result = PASS;
+	pd_ent_t old_pd_ent = kernel_page_dir[USER_VMEM_START >> 22];
+	uint32_t addr = USER_VMEM_START + PAGE_SIZE;
+	volatile uint32_t *word = (uint32_t*) addr;
+	uint32_t free_before = frames_free();
+	pt_ent_t *parent, *child;
+	void *frame = alloc_frames(1);
+
+	if(!frame) return FAIL;
+	memset(frame, 0, PAGE_SIZE);
+	parent = user_space_create();
+	if(!parent) return FAIL;
+	if(user_space_map_shared(parent, addr, &frame, 1) ||
+			frame_refcount(frame) != 2) result = FAIL;
+	if(!user_space_map_shared(parent, addr, &frame, 1) ||
+			!user_space_map_shared(parent, addr + 1, &frame, 1) ||
+			!user_space_map_shared(parent, USER_VMEM_END, &frame, 1)) {
+		printf("mapped over a used page or a bad address\n");
+		result = FAIL;
+	}
+	child = user_space_clone(parent);
+	if(!child) return FAIL;
+	cow_test_map(parent);
+	*word = 1;
+	cow_test_map(child);
+	if(*word != 1 || frame_refcount(frame) != 3) {
+		printf("clone didn't keep the page shared\n");
+		result = FAIL;
+	}
+	*word = 2;
+	cow_test_map(parent);
+	if(*word != 2) result = FAIL;
+
+	user_space_destroy(parent);
+	put_frame(frame);
+	if(*(volatile uint32_t*)frame != 2 || frame_refcount(frame) != 1) result = FAIL;
+	user_space_destroy(child);
+	kernel_page_dir[USER_VMEM_START >> 22] = old_pd_ent;
+	write_cr3(read_cr3());
+	if(frames_free() != free_before) {
+		printf("leaked %d frames\n", free_before - frames_free());
+		result = FAIL;
+	}
+	return result;
+}
+
+/* proc_page_dir_test
+ * Checks that per-process page directories keep their user memory apart while sharing
+ * the kernel's mappings, and that switching between them is just a CR3 load.
+ * Inputs: none
+ * Outputs: PASS/FAIL
+ * Side effects: Temporarily loads other page directories
+ * Coverage: page_dir_create, page_dir_vidmap, page_dir_destroy
+ * Files: mm.c/h */
+int proc_page_dir_test() {
+	TEST_HEADER;
+	int result = PASS;
+	volatile uint32_t *word = (uint32_t*) USER_VMEM_START;
+	uint32_t free_before = frames_free();
+	uint32_t flags;
+	cr3_t old_cr3 = read_cr3(), cr3 = old_cr3;
+	pt_ent_t *user_a = user_space_create(), *user_b = user_space_create();
+	pd_ent_t *dir_a, *dir_b;
+
+	if(!user_a || !user_b) return FAIL;
+	dir_a = page_dir_create(user_a);
+	dir_b = page_dir_create(user_b);
+	if(!dir_a || !dir_b) return FAIL;
+	if(dir_a[1].val != kernel_page_dir[1].val || !dir_a[USER_VMEM_START >> 22].present) {
+		printf("page directory doesn't share the kernel's mappings\n");
+		result = FAIL;
+	}
+	cli_and_save(flags);
+	cr3.page_dir_base = (uint32_t) dir_a >> 12;
+	write_cr3(cr3);
+	*word = 1;
+	if(page_dir_vidmap(dir_a, 0) || !dir_a[USER_VIDMAP >> 22].present) result = FAIL;
+	cr3.page_dir_base = (uint32_t) dir_b >> 12;
+	write_cr3(cr3);
+	if(*word != 0) {
+		printf("user memory leaked between page directories\n");
+		result = FAIL;
+	}
+	*word = 2;
+	cr3.page_dir_base = (uint32_t) dir_a >> 12;
+	write_cr3(cr3);
+	if(*word != 1) result = FAIL;
+	/* destroying the current directory has to move us off of it */
+	page_dir_destroy(dir_a);
+	if(read_cr3().page_dir_base != ((uint32_t) &kernel_page_dir >> 12)) result = FAIL;
+	write_cr3(old_cr3);
+	restore_flags(flags);
+
+	page_dir_destroy(dir_b);
+	user_space_destroy(user_a);
+	user_space_destroy(user_b);
+	if(frames_free() != free_before) {
+		printf("leaked %d frames\n", free_before - frames_free());
+		result = FAIL;
+	}
+	return result;
+}
+
+/* spinlock_test
+ * Checks that spinlocks and ticket locks exclude each other's holders, that ticket
+ * locks hand out turns in order, and that the lock class counts acquisitions.
+ * Inputs: none
+ * Outputs: PASS/FAIL
+ * Side effects: Registers a lock class, which shows up in lock_stats_print
+ * Coverage: spin_lock, spin_trylock, spin_unlock, ticket_lock, ticket_unlock
+ * Files: spinlock.c/h */
+int spinlock_test() {
+	TEST_HEADER;
+	static lock_class_t test_class = LOCK_CLASS_INIT("spinlock_test");
+	spinlock_t lock = SPINLOCK_INIT(&test_class);
+	ticket_lock_t ticket = TICKET_LOCK_INIT(&test_class);
+	uint32_t flags;
+	int result = PASS;
+#ifdef LOCK_STATS
+	uint32_t taken_before = test_class.acquired;
+#endif
+
+	spin_lock_irqsave(&lock, flags);
+	if(spin_trylock(&lock)) {
+		printf("took a held spinlock\n");
+		result = FAIL;
+	}
+	spin_unlock_irqrestore(&lock, flags);
+	if(!spin_trylock(&lock)) {
+		printf("couldn't take a free spinlock\n");
+		result = FAIL;
+	} else {
+		spin_unlock(&lock);
+	}
+
+	ticket_lock_irqsave(&ticket, flags);
+	if(ticket.next != 1 || ticket.serving != 0) result = FAIL;
+	ticket_unlock_irqrestore(&ticket, flags);
+	ticket_lock(&ticket);
+	ticket_unlock(&ticket);
+	if(ticket.next != 2 || ticket.serving != 2) {
+		printf("ticket lock out of turn, next %u serving %u\n", ticket.next, ticket.serving);
+		result = FAIL;
+	}
+#ifdef LOCK_STATS
+	/* the classes only count anything with a TSC */
+	if(tsc_khz && (test_class.acquired - taken_before != 4 || test_class.contended)) {
+		printf("lock class counted %u acquisitions\n", test_class.acquired - taken_before);
+		result = FAIL;
+	}
+#endif
+	return result;
+}
+
+/* term_weight_test
+ * Checks setting and looking up terminal CPU share weights
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side effects: Changes terminal 1's weight, then puts it back
+ * Coverage: sched_set_term_weight, syscall_termweight
+ * Files: sched.c/h
+ */
+int term_weight_test() {
+	TEST_HEADER;
+	int result = PASS;
+	int32_t old = syscall_termweight(1, 0, 0);
+
+	if(syscall_termweight(-1, 0, 0) != -1 || syscall_termweight(NUM_TERMINALS, 0, 0) != -1 ||
+			syscall_termweight(1, SCHED_TERM_WEIGHT_MAX + 1, 0) != -1 ||
+			syscall_termweight(1, -5, 0) != -1) {
+		printf("bad terminal or weight accepted\n");
+		result = FAIL;
+	}
+	if(old < SCHED_TERM_WEIGHT_MIN || old > SCHED_TERM_WEIGHT_MAX) {
+		printf("weight %d out of range\n", old);
+		result = FAIL;
+	}
+	if(syscall_termweight(1, 2 * SCHED_TERM_WEIGHT_DEFAULT, 0) != old ||
+			syscall_termweight(1, 0, 0) != 2 * SCHED_TERM_WEIGHT_DEFAULT) {
+		printf("weight didn't stick\n");
+		result = FAIL;
+	}
+	sched_set_term_weight(1, old);
+	return result;
+}
+
+/* sched_policy_test
+ * Checks which run queue level each scheduling class puts a process on
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side effects: None
+ * Coverage: sched_set_policy, sched_set_nice
+ * Files: sched.c/h
+ */
+int sched_policy_test() {
+	TEST_HEADER;
+	static pcb_t pcb; /* not runnable, so it never touches the run queues */
+	int result = PASS;
+
+	pcb.nice = 3;
+	if(sched_set_policy(&pcb, SCHED_FIFO, 0) != -1 ||
+			sched_set_policy(&pcb, SCHED_FIFO, SCHED_RT_PRIO_MAX + 1) != -1 ||
+			sched_set_policy(&pcb, SCHED_NORMAL, 1) != -1 || sched_set_policy(&pcb, 7, 0) != -1) {
+		printf("bad class or priority accepted\n");
+		result = FAIL;
+	}
+	if(sched_set_policy(&pcb, SCHED_FIFO, SCHED_RT_PRIO_MAX) || pcb.prio != 1) {
+		printf("highest FIFO priority on level %u\n", pcb.prio);
+		result = FAIL;
+	}
+	/* FIFO levels ignore nice, and stay above every nice level */
+	sched_set_nice(&pcb, SCHED_NICE_MIN);
+	if(pcb.prio != 1 || sched_set_policy(&pcb, SCHED_FIFO, SCHED_RT_PRIO_MIN) ||
+			pcb.prio >= nice_to_prio(SCHED_NICE_MIN)) {
+		printf("FIFO process on level %u\n", pcb.prio);
+		result = FAIL;
+	}
+	if(sched_set_policy(&pcb, SCHED_BATCH, 0) || pcb.prio != nice_to_prio(SCHED_NICE_MIN)) {
+		printf("batch process on level %u\n", pcb.prio);
+		result = FAIL;
+	}
+	return result;
+}
+
+/* user_space_unmap_test
+ * Checks that unmapping heap pages frees their frames, and that they come back zeroed
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side effects: Maps a test address space in at USER_VMEM_START, then puts back the old
+ *               mapping
+ * Coverage: user_space_unmap, demand-zero paging
+ * Files: mm.c/h
+ */
+int user_space_unmap_test() {
+	TEST_HEADER;
+	int result = PASS;
+	pd_ent_t old_pd_ent = kernel_page_dir[USER_VMEM_START >> 22];
+	volatile uint32_t *heap = (uint32_t*)(USER_VMEM_START + 8 * PAGE_SIZE);
+	uint32_t free_before = frames_free(), i;
+	pt_ent_t *space = user_space_create();
+
+	if(!space) return FAIL;
+	cow_test_map(space);
+	for(i = 0; i < 3; ++i) heap[i * PAGE_SIZE / 4] = i + 1;
+	/* the page tables plus the three pages we touched */
+	if(free_before - frames_free() != USER_NUM_PTS + 3) {
+		printf("touching 3 pages used %d frames\n", free_before - frames_free());
+		result = FAIL;
+	}
+	user_space_unmap(space, (uint32_t) heap + PAGE_SIZE, 2);
+	if(free_before - frames_free() != USER_NUM_PTS + 1 || heap[0] != 1) result = FAIL;
+	if(heap[PAGE_SIZE / 4] != 0 || heap[2 * PAGE_SIZE / 4] != 0) {
+		printf("unmapped pages kept their contents\n");
+		result = FAIL;
+	}
+	user_space_destroy(space);
+	kernel_page_dir[USER_VMEM_START >> 22] = old_pd_ent;
+	write_cr3(read_cr3());
+	if(frames_free() != free_before) {
+		printf("leaked %d frames\n", free_before - frames_free());
+		result = FAIL;
+	}
+	return result;
+}
+
+/* zero_pool_test
+ * Checks that the idle loop's zeroed frames come out zeroed, and still count as free
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side effects: Fills the zero pool
+ * Coverage: zero_pool_refill, alloc_zeroed_frame, frames_free
+ * Files: mm.c/h
+ */
+int zero_pool_test() {
+	TEST_HEADER;
+	int result = PASS;
+	uint32_t free_before = frames_free(), flags, i;
+	uint32_t *frame;
+
+	cli_and_save(flags);
+	for(i = 0; i < ZERO_POOL_SIZE && zero_pool_refill(); ++i);
+	restore_flags(flags);
+	if(frames_free() != free_before) {
+		printf("zero pool frames don't count as free\n");
+		result = FAIL;
+	}
+	for(i = 0; i < ZERO_POOL_SIZE + 1; ++i) {
+		frame = alloc_zeroed_frame();
+		if(!frame) return FAIL;
+		if(frame[0] || frame[PAGE_SIZE / 4 - 1]) result = FAIL;
+		/* dirty it, so a reused frame that didn't get zeroed shows up */
+		memset(frame, 0xAB, PAGE_SIZE);
+		free_frames(frame);
+	}
+	if(frames_free() != free_before) {
+		printf("leaked %d frames\n", free_before - frames_free());
+		result = FAIL;
+	}
+	return result;
+}
+
+/* vma_test
+ * Checks looking up, adding and removing user memory regions
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side effects: None
+ * Coverage: vma_init, vma_find, vma_extent, vma_insert, vma_remove, vma_set_heap_end
+ * Files: vma.c/h
+ */
+int vma_test() {
+	TEST_HEADER;
+	static pcb_t pcb;
+	int result = PASS;
+	uint32_t heap = USER_PROG_START + 4 * PAGE_SIZE;
+	uint32_t map = USER_VMEM_START + 2 * PAGE_4M_SIZE;
+	vma_t *vma;
+
+	pcb.brk_start = pcb.brk = heap;
+	vma_init(&pcb);
+	if(pcb.nr_vmas != 3 || !vma_find(&pcb, USER_PROG_START) || vma_find(&pcb, heap) ||
+			vma_find(&pcb, USER_VMEM_START) || !vma_find(&pcb, USER_VMEM_END - 1)) {
+		printf("bad initial regions\n");
+		result = FAIL;
+	}
+	/* text and heap are back to back, so a buffer can run from one into the other */
+	if(vma_set_heap_end(&pcb, heap + PAGE_SIZE) ||
+			vma_extent(&pcb, USER_PROG_START + 1) != heap + PAGE_SIZE) {
+		printf("heap didn't extend the text\n");
+		result = FAIL;
+	}
+	if(vma_insert(&pcb, map, map + 2 * PAGE_SIZE, VMA_MMAP) ||
+			!vma_insert(&pcb, map + PAGE_SIZE, map + 3 * PAGE_SIZE, VMA_MMAP) ||
+			!vma_insert(&pcb, map - PAGE_SIZE, map + PAGE_SIZE, VMA_MMAP) ||
+			!vma_insert(&pcb, map + 1, map + PAGE_SIZE, VMA_MMAP) ||
+			!vma_insert(&pcb, USER_VMEM_END, USER_VMEM_END + PAGE_SIZE, VMA_MMAP)) {
+		printf("overlapping or bad region accepted\n");
+		result = FAIL;
+	}
+	if(!vma_set_heap_end(&pcb, map + PAGE_SIZE)) {
+		printf("heap grew over a mapping\n");
+		result = FAIL;
+	}
+	vma = vma_find(&pcb, map + PAGE_SIZE);
+	if(!vma || vma->start != map || vma_extent(&pcb, map) != map + 2 * PAGE_SIZE) {
+		result = FAIL;
+	} else {
+		vma_remove(&pcb, vma);
+		if(pcb.nr_vmas != 3 || vma_find(&pcb, map)) result = FAIL;
+	}
+	return result;
+}
+
+/* kill_test
+ * Checks that kill refuses bad signals and pids that aren't user processes
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side effects: None, no processes are running during the tests
+ * Coverage: syscall_kill
+ * Files: signal.c/h
+ */
+int kill_test() {
+	TEST_HEADER;
+	int result = PASS;
+	if(syscall_kill(0, -1, 0) != -1 || syscall_kill(0, NUM_SIGNALS, 0) != -1) {
+		printf("bad signal number accepted\n");
+		result = FAIL;
+	}
+	if(syscall_kill(-1, SIG_USER1, 0) != -1 || syscall_kill(NUM_PROCESSES, SIG_USER1, 0) != -1 ||
+			syscall_kill(0, SIG_USER1, 0) != -1) {
+		printf("signal sent to a pid with no process\n");
+		result = FAIL;
+	}
+	return result;
+}
+
+/* timer_test_fn
+ * Records the jiffy a timer test timer expired at */
+static void timer_test_fn(void *data) {
+	*(uint32_t*)data = pit_jiffies();
+}
+
+/* timer_wheel_test
+ * Checks that timers on every level of the timer wheel expire on time, in order, and
+ * that a deleted timer never does. Takes a few seconds.
+ * Inputs: none
+ * Outputs: PASS/FAIL
+ * Side effects: none
+ * Coverage: timer_add, timer_del, timer_run, cascading between wheel levels
+ * Files: timer.c/h */
+int timer_wheel_test() {
+	TEST_HEADER;
+	int result = PASS;
+	/* level 0, level 1, level 2, and one that gets deleted */
+	uint32_t delays[4] = {3, 2 * TIMER_WHEEL_SIZE + 5,
+			TIMER_WHEEL_SIZE * TIMER_WHEEL_SIZE + 17, 40};
+	uint32_t fired[4] = {0, 0, 0, 0};
+	ktimer_t timers[4];
+	uint32_t start, i, flags;
+
+	cli_and_save(flags);
+	start = pit_jiffies();
+	for(i = 0; i < 4; ++i) {
+		timer_init(&timers[i], &timer_test_fn, &fired[i]);
+		timer_add(&timers[i], start + delays[i]);
+	}
+	if(!timer_del(&timers[3])) result = FAIL;
+	/* long enough for the last one, with some slack */
+	while(!fired[2] && time_after_eq(start + 2 * delays[2], pit_jiffies())) {
+		asm volatile ("sti; hlt; cli");
+	}
+	for(i = 0; i < 3; ++i) {
+		if(timer_del(&timers[i])) {
+			printf("timer %u never fired\n", i);
+			result = FAIL;
+		} else if(!time_after_eq(fired[i], start + delays[i]) ||
+				time_after_eq(fired[i], start + delays[i] + 2)) {
+			printf("timer %u due at %u fired at %u\n", i, delays[i], fired[i] - start);
+			result = FAIL;
+		}
+	}
+	if(fired[3]) result = FAIL;
+	restore_flags(flags);
+	return result;
+}
+
+/* ktime_test
+ * Checks 64 bit division, and that ktime_ns never goes backwards and agrees with the
+ * PIT over a few dozen jiffies.
+ * Inputs: none
+ * Outputs: PASS/FAIL
+ * Side effects: none
+ * Coverage: div64_32, ktime_ns, TSC calibration
+ * Files: ktime.c/h */
+int ktime_test() {
+	TEST_HEADER;
+	int result = PASS;
+	uint64_t n = 0x123456789ABCDEFULL, start_ns, prev_ns, now_ns;
+	uint32_t start, flags, rem, elapsed_ns, pit_ns;
+
+	rem = div64_32(&n, 1000000007);
+	if(n != 81985528 || rem != 642588199) {
+		printf("div64_32 got %u remainder %u\n", (uint32_t) n, rem);
+		result = FAIL;
+	}
+
+	cli_and_save(flags);
+	start = pit_jiffies();
+	start_ns = prev_ns = ktime_ns();
+	/* keep the PIT going, it doesn't tick with nothing to do */
+	gui_request_render();
+	while(!time_after_eq(pit_jiffies(), start + 50)) {
+		now_ns = ktime_ns();
+		if(now_ns < prev_ns) result = FAIL;
+		prev_ns = now_ns;
+		gui_request_render();
+		asm volatile ("sti; hlt; cli");
+	}
+	pit_ns = (pit_jiffies() - start) * (NSEC_PER_SEC / pit_hz);
+	elapsed_ns = (uint32_t)(ktime_ns() - start_ns);
+	restore_flags(flags);
+	/* within 10%, since the two reads of each clock aren't quite at the same time */
+	if(elapsed_ns < pit_ns - pit_ns / 10 || elapsed_ns > pit_ns + pit_ns / 10) {
+		printf("ktime measured %u us, the PIT %u us\n", elapsed_ns / 1000, pit_ns / 1000);
+		result = FAIL;
+	}
+	return result;
+}
+
+/* Benchmarks */
+
+/* iterations per benchmark, execute+halt gets fewer since each one prints a line */
+#define BENCH_ITERS 1000
+#define BENCH_EXEC_ITERS 20
+#define BENCH_EXEC_CMD "testprint"
+/* chunk size for the read_data benchmark */
+#define BENCH_READ_CHUNK 4096
+
+/* samples of the current benchmark, in TSC cycles */
+static uint32_t bench_samples[BENCH_ITERS];
+static uint8_t bench_read_buf[BENCH_READ_CHUNK];
+/* the swap_context benchmark bounces between these */
+static context_t bench_main_ctx, bench_peer_ctx;
+static uint8_t bench_peer_stack[PAGE_SIZE];
+
+/* bench_report
+ * Sorts the samples of a benchmark and prints their min, median and 99th percentile.
+ * Inputs: name - benchmark name
+ *         samples - the samples in TSC cycles, get sorted
+ *         n - number of samples, at least 1
+ * Return value: the median in nanoseconds */
+static uint32_t bench_report(const char *name, uint32_t *samples, uint32_t n) {
+	uint32_t i, j, tmp, min, med, p99;
+	/* insertion sort is plenty for a thousand samples */
+	for(i = 1; i < n; ++i) {
+		tmp = samples[i];
+		for(j = i; j > 0 && samples[j-1] > tmp; --j) samples[j] = samples[j-1];
+		samples[j] = tmp;
+	}
+	min = samples[0];
+	med = samples[n / 2];
+	p99 = samples[n * 99 / 100];
+	printf("[BENCH %s] n=%u min/median/p99 = %u/%u/%u cycles = %u/%u/%u ns\n", name, n,
+			min, med, p99, (uint32_t) cycles_to_ns(min), (uint32_t) cycles_to_ns(med),
+			(uint32_t) cycles_to_ns(p99));
+	return (uint32_t) cycles_to_ns(med);
+}
+
+/* bench_swap_peer
+ * The other end of the swap_context benchmark, swaps straight back every time */
+static void bench_swap_peer(void *buf, uint32_t buf_len) {
+	while(1) swap_context(&bench_peer_ctx, &bench_main_ctx);
+}
+
+/* bench_swap_context
+ * Times swap_context round trips to another kernel stack and back, the core of every
+ * context switch. Interrupts stay off, the peer stack has no PCB to handle them on. */
+static void bench_swap_context(void) {
+	uint32_t flags, i;
+	uint64_t start;
+	cli_and_save(flags);
+	make_context(&bench_peer_ctx, bench_peer_stack + sizeof(bench_peer_stack),
+			&bench_swap_peer, NULL, 0);
+	for(i = 0; i < BENCH_ITERS; ++i) {
+		start = rdtsc();
+		swap_context(&bench_main_ctx, &bench_peer_ctx);
+		bench_samples[i] = (uint32_t)(rdtsc() - start);
+	}
+	restore_flags(flags);
+	bench_report("swap_context round trip", bench_samples, BENCH_ITERS);
+}
+
+/* bench_kernel_trap
+ * Times int $0x80 with an invalid syscall number, i.e. the syscall entry and exit path
+ * through syscall_handler with nothing in between. This runs in ring 0, so it leaves out
+ * the privilege change (the stack switch through the TSS, and the iret back to user
+ * mode) that a real syscall from a user program pays on top of it */
+static void bench_kernel_trap(void) {
+	uint32_t flags, i, ret;
+	uint64_t start;
+	cli_and_save(flags);
+	for(i = 0; i < BENCH_ITERS; ++i) {
+		start = rdtsc();
+		asm volatile ("int $0x80" : "=a"(ret) : "a"(0) : "memory", "cc");
+		bench_samples[i] = (uint32_t)(rdtsc() - start);
+	}
+	restore_flags(flags);
+	bench_report("int $0x80 from ring 0", bench_samples, BENCH_ITERS);
+}
+
+/* bench_execute
+ * Times running a trivial program to completion: allocating the process, loading it,
+ * switching to it, its halt, and switching back */
+static void bench_execute(void) {
+	uint32_t i;
+	uint64_t start;
+	for(i = 0; i < BENCH_EXEC_ITERS; ++i) {
+		start = rdtsc();
+		if(execute_process((uint8_t*) BENCH_EXEC_CMD, 0) < 0) {
+			printf("[BENCH execute+halt] couldn't run %s, skipped\n", BENCH_EXEC_CMD);
+			return;
+		}
+		bench_samples[i] = (uint32_t)(rdtsc() - start);
+	}
+	bench_report("execute+halt " BENCH_EXEC_CMD, bench_samples, BENCH_EXEC_ITERS);
+}
+
+/* bench_fs
+ * Times read_data going through the biggest file in BENCH_READ_CHUNK chunks, and
+ * read_dentry_by_name looking up the last file in the directory (the longest scan) */
+static void bench_fs(void) {
+	uint8_t name[FS_MAX_FNAME_LEN + 1];
+	uint32_t flags, i, offset, len = 0, inode = 0, med_ns;
+	uint64_t start, kib_per_s;
+	dentry_t dentry;
+	for(i = 0; i < fs_boot_blk->num_dentries; ++i) {
+		if(read_dentry_by_index(i, &dentry) || dentry.type != FS_DENTRY_FILE) continue;
+		if(inode_start[dentry.inode].file_length > len) {
+			len = inode_start[dentry.inode].file_length;
+			inode = dentry.inode;
+		}
+	}
+	if(len) {
+		cli_and_save(flags);
+		for(i = 0; i < BENCH_ITERS; ++i) {
+			start = rdtsc();
+			for(offset = 0; offset < len; offset += BENCH_READ_CHUNK)
+				read_data(inode, offset, bench_read_buf, BENCH_READ_CHUNK);
+			bench_samples[i] = (uint32_t)(rdtsc() - start);
+		}
+		restore_flags(flags);
+		printf("[BENCH read_data] %u byte file:\n", len);
+		med_ns = bench_report("read_data", bench_samples, BENCH_ITERS);
+		if(med_ns) {
+			kib_per_s = (uint64_t) len * (NSEC_PER_SEC / 1024);
+			div64_32(&kib_per_s, med_ns);
+			printf("[BENCH read_data] %u KiB/s\n", (uint32_t) kib_per_s);
+		}
+	}
+
+	if(read_dentry_by_index(fs_boot_blk->num_dentries - 1, &dentry)) return;
+	memcpy(name, dentry.filename, FS_MAX_FNAME_LEN);
+	name[FS_MAX_FNAME_LEN] = '\0';
+	cli_and_save(flags);
+	for(i = 0; i < BENCH_ITERS; ++i) {
+		start = rdtsc();
+		read_dentry_by_name(name, &dentry);
+		bench_samples[i] = (uint32_t)(rdtsc() - start);
+	}
+	restore_flags(flags);
+	bench_report("read_dentry_by_name", bench_samples, BENCH_ITERS);
+}
+
+/* bench_render
+ * Times term_putc on the last terminal (including the scrolling every line does once the
+ * screen is full), and do_render */
+static void bench_render(void) {
+	uint32_t flags, i;
+	uint64_t start;
+	cli_and_save(flags);
+	for(i = 0; i < BENCH_ITERS; ++i) {
+		start = rdtsc();
+		term_putc(i % 80 == 79 ? '\n' : 'a' + i % 26, NUM_TERMINALS - 1);
+		bench_samples[i] = (uint32_t)(rdtsc() - start);
+	}
+	restore_flags(flags);
+	bench_report("term_putc", bench_samples, BENCH_ITERS);
+
+	for(i = 0; i < BENCH_ITERS; ++i) {
+		start = rdtsc();
+		do_render();
+		bench_samples[i] = (uint32_t)(rdtsc() - start);
+	}
+	bench_report("do_render", bench_samples, BENCH_ITERS);
+}
+
+/* bench_main
+ * Body of the benchmark thread. Benchmarks run in a kernel thread rather than during
+ * boot, since the syscall and execute ones need a current process to charge.
+ * Inputs: arg - not used */
+static void bench_main(void *arg) {
+	if(!tsc_khz) printf("[BENCH] no usable TSC, times are in cycles only\n");
+	bench_swap_context();
+	bench_kernel_trap();
+	bench_fs();
+	bench_render();
+	bench_execute();
+	lock_stats_print();
+	kthread_exit();
+}
+
+/* void launch_benchmarks()
+ * Starts the benchmark thread, which prints min/median/p99 timings of the hot paths
+ * once the scheduler starts running it (right before the shells, since kernel threads
+ * have the highest priority). Enable with RUN_BENCHMARKS in kernel.c.
+ * Inputs / Outputs / Return value: none
+ * Side effects: Creates a kernel thread, prints a lot to terminal 0 */
+void launch_benchmarks() {
+	if(!kthread_create("bench", &bench_main, NULL))
+		printf("[BENCH] no free kernel thread, not running benchmarks\n");
+}
+
 /* Test suite entry point */
 /* void launch_tests()
  * The starting point for all test calls, devs can selectively enable tests here
@@ -1469,6 +2343,21 @@ void launch_tests(){
 	/* these tests just print their results without interfering with each other;
      * they can all be run together */
 	// TEST_OUTPUT("pit_test", pit_test());
+	// TEST_OUTPUT("pit_setrate_test", pit_setrate_test());
+	// TEST_OUTPUT("kmalloc_test", kmalloc_test());
+	// TEST_OUTPUT("fpu_test", fpu_test());
+	// TEST_OUTPUT("cow_test", cow_test());
+	// TEST_OUTPUT("timer_wheel_test", timer_wheel_test());
+	// TEST_OUTPUT("ktime_test", ktime_test());
+	// TEST_OUTPUT("shm_share_test", shm_share_test());
+	// TEST_OUTPUT("proc_page_dir_test", proc_page_dir_test());
+	// TEST_OUTPUT("spinlock_test", spinlock_test());
+	// TEST_OUTPUT("term_weight_test", term_weight_test());
+	// TEST_OUTPUT("sched_policy_test", sched_policy_test());
+	// TEST_OUTPUT("user_space_unmap_test", user_space_unmap_test());
+	// TEST_OUTPUT("zero_pool_test", zero_pool_test());
+	// TEST_OUTPUT("vma_test", vma_test());
+	// TEST_OUTPUT("kill_test", kill_test());
 
 	/* these tests will cause a fault, or otherwise obscure other
      * test results; only enable one at a time */
@@ -3,5 +3,7 @@
 
 // test launcher
 void launch_tests();
+// benchmark launcher
+void launch_benchmarks();
 
 #endif /* TESTS_H */
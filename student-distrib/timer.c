@@ -0,0 +1,281 @@
+/* timer.c - Implements kernel timers on a hierarchical timing wheel, and the sleep
+ * syscall built on top of them.
+ * Level 0 of the wheel has a slot for each of the next TIMER_WHEEL_SIZE jiffies. A timer
+ * further out goes in a coarser slot of a higher level, and gets moved down ("cascaded")
+ * a level once the wheel gets close enough, which happens every TIMER_WHEEL_SIZE^i
+ * jiffies for level i. Each timer gets cascaded at most TIMER_WHEEL_LEVELS-1 times, so
+ * servicing the wheel costs the same per jiffy whether there's one sleeper or a hundred.
+ * The PIT is tickless, so it only interrupts us for the jiffies timer_next_deadline
+ * says something is due at. */
+
+#include "timer.h"
+#include "lib.h"
+#include "pit.h"
+#include "process.h"
+#include "sched.h"
+#include "spinlock.h"
+#include "signal.h"
+
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SIZE - 1)
+/* words in level 0's bitmap, a slot per bit */
+#define LEVEL0_WORDS (TIMER_WHEEL_SIZE / 32)
+#if TIMER_WHEEL_BITS < 5
+#error "level0_bitmap needs at least 32 slots per level"
+#endif
+/* furthest out a timer can be placed, anything later gets placed here until it's in
+ * range */
+#define TIMER_WHEEL_RANGE (1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+/* longest sleep the sleep syscall allows, a day */
+#define SLEEP_MAX_MS (24 * 60 * 60 * 1000)
+
+/* the wheel's slots, each a list of timers linked through next/pprev */
+static ktimer_t *wheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SIZE];
+/* number of timers on each level, and which of level 0's slots are non-empty, so
+ * finding the next deadline doesn't have to scan the slots */
+static uint32_t level_count[TIMER_WHEEL_LEVELS];
+static uint32_t level0_bitmap[LEVEL0_WORDS];
+static uint32_t nr_timers = 0;
+/* the next jiffy the wheel has to process. everything due before it has expired */
+static uint32_t wheel_jiffy = 0;
+/* protects everything above. the wheel_* helpers expect it held */
+static lock_class_t wheel_lock_class = LOCK_CLASS_INIT("timer wheel");
+static spinlock_t wheel_lock = SPINLOCK_INIT(&wheel_lock_class);
+
+/* wheel_link / wheel_unlink
+ * Add a timer to the head of a slot, and remove it from whatever slot (or local list)
+ * it's on. Interrupts must be disabled. */
+static void wheel_link(ktimer_t *timer, uint32_t level, uint32_t slot) {
+    ktimer_t **head = &wheel[level][slot];
+    timer->level = level;
+    timer->slot = slot;
+    timer->next = *head;
+    if(*head) (*head)->pprev = &timer->next;
+    timer->pprev = head;
+    *head = timer;
+    ++level_count[level];
+    ++nr_timers;
+    if(level == 0) level0_bitmap[slot >> 5] |= 1 << (slot & 31);
+}
+static void wheel_unlink(ktimer_t *timer) {
+    uint32_t slot;
+    *timer->pprev = timer->next;
+    if(timer->next) timer->next->pprev = timer->pprev;
+    timer->next = NULL;
+    timer->pprev = NULL;
+    --level_count[timer->level];
+    --nr_timers;
+    if(timer->level == 0) {
+        slot = timer->slot;
+        if(!wheel[0][slot]) level0_bitmap[slot >> 5] &= ~(1 << (slot & 31));
+    }
+}
+
+/* wheel_insert
+ * Puts a timer in the slot for its expiry, relative to wheel_jiffy. Overdue timers go
+ * in the slot for wheel_jiffy, so they expire the next time the wheel is serviced.
+ * Interrupts must be disabled. */
+static void wheel_insert(ktimer_t *timer) {
+    int32_t delta = timer->expires - wheel_jiffy;
+    uint32_t expires = timer->expires;
+    uint32_t level, slot;
+    if(delta < 0) {
+        expires = wheel_jiffy;
+        delta = 0;
+    } else if(delta >= TIMER_WHEEL_RANGE) {
+        expires = wheel_jiffy + TIMER_WHEEL_RANGE - 1;
+        delta = TIMER_WHEEL_RANGE - 1;
+    }
+    for(level = 0; level < TIMER_WHEEL_LEVELS - 1 &&
+            delta >= 1 << (TIMER_WHEEL_BITS * (level + 1)); ++level);
+    slot = (expires >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+    wheel_link(timer, level, slot);
+}
+
+/* wheel_detach
+ * Moves the contents of a slot to a local list, so timers can be taken off it one at a
+ * time while new ones (possibly for the same slot) get added. timer_del still works on
+ * timers in the local list.
+ * Inputs: list - the local list head
+ * Interrupts must be disabled. */
+static void wheel_detach(ktimer_t **list, uint32_t level, uint32_t slot) {
+    *list = wheel[level][slot];
+    wheel[level][slot] = NULL;
+    if(*list) (*list)->pprev = list;
+    if(level == 0) level0_bitmap[slot >> 5] &= ~(1 << (slot & 31));
+}
+
+/* wheel_cascade
+ * Moves the timers in a slot of a higher level down to where they belong now.
+ * Interrupts must be disabled. */
+static void wheel_cascade(uint32_t level, uint32_t slot) {
+    ktimer_t *list, *timer;
+    wheel_detach(&list, level, slot);
+    while((timer = list) != NULL) {
+        wheel_unlink(timer);
+        wheel_insert(timer);
+    }
+}
+
+/* level0_next
+ * Return value: how many slots after start (going around) the next non-empty level 0
+ *               slot is, TIMER_WHEEL_SIZE if they're all empty */
+static uint32_t level0_next(uint32_t start) {
+    uint32_t word = start >> 5, bit = start & 31, w = word, i;
+    uint32_t bits = level0_bitmap[word] & (~0U << bit);
+    /* the rest of start's word, then the words after it going around, and last the part
+     * of start's word before start */
+    for(i = 1; !bits && i <= LEVEL0_WORDS; ++i) {
+        w = (word + i) % LEVEL0_WORDS;
+        bits = level0_bitmap[w];
+        if(i == LEVEL0_WORDS) bits &= (1U << bit) - 1;
+    }
+    if(!bits) return TIMER_WHEEL_SIZE;
+    asm ("bsfl %1, %0" : "=r"(bit) : "rm"(bits) : "cc");
+    return ((w << 5) + bit - start) & TIMER_WHEEL_MASK;
+}
+
+/* timer_init
+ * See timer.h.
+ * Inputs: timer - timer to set up
+ *         fn - function to call when it expires
+ *         data - argument for fn */
+void timer_init(ktimer_t *timer, ktimer_fn_t *fn, void *data) {
+    timer->fn = fn;
+    timer->data = data;
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->pending = 0;
+}
+
+/* timer_add
+ * See timer.h.
+ * Inputs: timer - timer to start
+ *         expires - jiffy it should expire at
+ * Side effects: Might arm the PIT */
+void timer_add(ktimer_t *timer, uint32_t expires) {
+    uint32_t flags;
+    spin_lock_irqsave(&wheel_lock, flags);
+    if(timer->pending) wheel_unlink(timer);
+    /* nothing moves an empty wheel along, so catch it up first */
+    if(!nr_timers) wheel_jiffy = pit_jiffies();
+    timer->expires = expires;
+    timer->pending = 1;
+    wheel_insert(timer);
+    /* pit_kick looks at the wheel through timer_next_deadline, which takes the lock */
+    spin_unlock(&wheel_lock);
+    pit_kick();
+    restore_flags(flags);
+}
+
+/* timer_del
+ * See timer.h.
+ * Inputs: timer - timer to stop
+ * Return value: 1 if it was pending, 0 otherwise */
+int timer_del(ktimer_t *timer) {
+    uint32_t flags;
+    int was_pending;
+    spin_lock_irqsave(&wheel_lock, flags);
+    was_pending = timer->pending;
+    if(was_pending) {
+        wheel_unlink(timer);
+        timer->pending = 0;
+    }
+    spin_unlock_irqrestore(&wheel_lock, flags);
+    return was_pending;
+}
+
+/* timer_run
+ * See timer.h.
+ * Inputs: now - the current jiffy
+ * Side effects: Calls the functions of expired timers */
+void timer_run(uint32_t now) {
+    uint32_t flags, slot, level;
+    ktimer_t *list, *timer;
+    spin_lock_irqsave(&wheel_lock, flags);
+    while(time_after_eq(now, wheel_jiffy)) {
+        if(!nr_timers) {
+            wheel_jiffy = now + 1;
+            break;
+        }
+        slot = wheel_jiffy & TIMER_WHEEL_MASK;
+        /* when a level wraps around, the next slot of the level above comes into range */
+        for(level = 1; level < TIMER_WHEEL_LEVELS; ++level) {
+            if((wheel_jiffy >> (TIMER_WHEEL_BITS * (level - 1))) & TIMER_WHEEL_MASK) break;
+            wheel_cascade(level,
+                    (wheel_jiffy >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK);
+        }
+        wheel_detach(&list, 0, slot);
+        /* timers the functions add for right now go in the next jiffy's slot */
+        ++wheel_jiffy;
+        while((timer = list) != NULL) {
+            wheel_unlink(timer);
+            timer->pending = 0;
+            /* the function might add timers itself (or wake someone who does) */
+            spin_unlock(&wheel_lock);
+            timer->fn(timer->data);
+            spin_lock(&wheel_lock);
+        }
+    }
+    spin_unlock_irqrestore(&wheel_lock, flags);
+}
+
+/* timer_next_deadline
+ * See timer.h.
+ * Inputs: deadline - where to put the deadline
+ * Return value: 1 if there is a deadline, 0 otherwise */
+int timer_next_deadline(uint32_t *deadline) {
+    uint32_t flags, delta, cascade;
+    spin_lock_irqsave(&wheel_lock, flags);
+    if(!nr_timers) {
+        spin_unlock_irqrestore(&wheel_lock, flags);
+        return 0;
+    }
+    delta = level0_next(wheel_jiffy & TIMER_WHEEL_MASK);
+    if(nr_timers != level_count[0]) {
+        /* jiffies until level 0 wraps around and the level above needs cascading */
+        cascade = (TIMER_WHEEL_SIZE - (wheel_jiffy & TIMER_WHEEL_MASK)) & TIMER_WHEEL_MASK;
+        if(cascade < delta) delta = cascade;
+    }
+    *deadline = wheel_jiffy + delta;
+    spin_unlock_irqrestore(&wheel_lock, flags);
+    return 1;
+}
+
+/* sleep_timer_fn
+ * Wakes up a process sleeping in syscall_sleep.
+ * Inputs: data - the wait queue it's sleeping on */
+static void sleep_timer_fn(void *data) {
+    sched_wake_all((wait_queue_t*)data);
+}
+
+/* syscall_sleep
+ * Puts the current process to sleep for at least the given number of milliseconds,
+ * without it taking up any CPU time in the meantime.
+ * Inputs: arg1 - how long to sleep in milliseconds, up to SLEEP_MAX_MS
+ *         arg2 - not used
+ *         arg3 - not used
+ * Return value: 0 once the time has passed, -1 if arg1 is out of range or a signal
+ *               cut the sleep short
+ * Side effects: Blocks the current process */
+int32_t syscall_sleep(int32_t arg1, int32_t arg2, int32_t arg3) {
+    pcb_t *current = get_current_pcb();
+    wait_queue_t queue = WAIT_QUEUE_INIT;
+    uint32_t flags;
+    if(arg1 < 0 || arg1 > SLEEP_MAX_MS) return -1;
+    if(arg1 == 0) return 0;
+    cli_and_save(flags);
+    timer_init(&current->sleep_timer, &sleep_timer_fn, &queue);
+    /* +1, since the current jiffy is already partly over */
+    timer_add(&current->sleep_timer, pit_jiffies() + ms_to_jiffies(arg1) + 1);
+    while(current->sleep_timer.pending) {
+        if(signal_pending(current)) {
+            /* the queue the timer would wake is on our stack */
+            timer_del(&current->sleep_timer);
+            restore_flags(flags);
+            return -1;
+        }
+        sched_sleep(&queue);
+    }
+    restore_flags(flags);
+    return 0;
+}
@@ -0,0 +1,67 @@
+/* timer.h - Definitions for kernel timers and the timer wheel */
+
+#ifndef _TIMER_H
+#define _TIMER_H
+
+#include "types.h"
+
+/* the timer wheel has TIMER_WHEEL_LEVELS levels of TIMER_WHEEL_SIZE slots each. level 0
+ * has a slot per jiffy, each slot of level i covers TIMER_WHEEL_SIZE^i jiffies. timers
+ * further out than the whole wheel (2^24 jiffies, over 4 hours at 1000 Hz) sit in the
+ * last slot they can reach and get moved along until they're in range */
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SIZE (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4
+
+#ifndef ASM
+
+/* ktimer_fn_t
+ * Function called when a timer expires, from the PIT interrupt handler. */
+typedef void ktimer_fn_t(void *data);
+
+/* ktimer_t
+ * A one-shot timer, usually embedded in whatever it's timing. Timers are kept on a
+ * hierarchical timing wheel, so adding, removing and expiring one takes constant time
+ * no matter how many timers there are. */
+typedef struct ktimer_t ktimer_t;
+struct ktimer_t {
+    /* jiffy the timer expires at */
+    uint32_t expires;
+    ktimer_fn_t *fn;
+    void *data;
+    /* links in the wheel slot the timer is in, pprev points at whatever points at it */
+    ktimer_t *next, **pprev;
+    /* which level and slot of the wheel it's in */
+    uint32_t level, slot;
+    /* set while the timer is on the wheel */
+    int pending;
+};
+
+/* timer_init
+ * Sets up a timer that calls fn(data) when it expires. */
+void timer_init(ktimer_t *timer, ktimer_fn_t *fn, void *data);
+
+/* timer_add
+ * Starts a timer that expires at the given jiffy (right away if that's already past),
+ * restarting it if it's already pending. Safe to call from interrupt handlers. */
+void timer_add(ktimer_t *timer, uint32_t expires);
+
+/* timer_del
+ * Stops a timer if it's pending.
+ * Return value: 1 if it was pending, 0 if it already expired (or was never started) */
+int timer_del(ktimer_t *timer);
+
+/* timer_run
+ * Expires every timer due at or before now. Called by the PIT interrupt handler. */
+void timer_run(uint32_t now);
+
+/* timer_next_deadline
+ * Finds the next jiffy the wheel needs servicing at, either to expire a timer or to
+ * move timers down from a higher level. Takes the wheel's lock, so it can't be called
+ * with it held (i.e. from timer_add).
+ * Inputs: deadline - where to put the deadline
+ * Return value: 1 if there is a deadline, 0 if no timers are pending */
+int timer_next_deadline(uint32_t *deadline);
+
+#endif /* ASM */
+#endif /* _TIMER_H */
@@ -12,6 +12,10 @@
 #ifndef ASM
 
 /* Types defined here just like in <stdint.h> */
+/* careful, we don't link libgcc, so 64 bit division won't link (see div64_32) */
+typedef long long int64_t;
+typedef unsigned long long uint64_t;
+
 typedef int int32_t;
 typedef unsigned int uint32_t;
 
@@ -0,0 +1,185 @@
+/* vma.c - Implements the list of regions making up a process's user memory, and the
+ * mmap and munmap syscalls.
+ * Every process keeps its regions in an array sorted by start address, so finding the
+ * region an address is in (for check_user_bounds and the page fault hook) is a binary
+ * search. Regions only say what may be mapped: the pages themselves get filled in on
+ * demand by user_page_fault, and unmapped again with user_space_unmap. */
+
+#include "vma.h"
+#include "lib.h"
+#include "mm.h"
+#include "process.h"
+
+#define PAGE_MASK (PAGE_SIZE - 1)
+
+/* vma_search
+ * Return value: index of the last region starting at or before addr, -1 if there is
+ *               none. Interrupts must be disabled, or the regions otherwise stable */
+static int32_t vma_search(pcb_t *pcb, uint32_t addr) {
+    int32_t lo = 0, hi = pcb->nr_vmas - 1, mid, found = -1;
+    while(lo <= hi) {
+        mid = (lo + hi) / 2;
+        if(pcb->vmas[mid].start <= addr) {
+            found = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return found;
+}
+
+/* vma_init
+ * See vma.h.
+ * Inputs: pcb - the new process, brk_start already set */
+void vma_init(pcb_t *pcb) {
+    pcb->nr_vmas = 0;
+    vma_insert(pcb, USER_PROG_START & ~PAGE_MASK, pcb->brk_start, VMA_TEXT);
+    vma_insert(pcb, pcb->brk_start, pcb->brk_start, VMA_HEAP);
+    vma_insert(pcb, USER_VMEM_END - USER_STACK_RESERVE, USER_VMEM_END, VMA_STACK);
+}
+
+/* vma_fork
+ * See vma.h.
+ * Inputs: child - the new process, its regions get overwritten
+ *         parent - the forking process */
+void vma_fork(pcb_t *child, pcb_t *parent) {
+    child->nr_vmas = parent->nr_vmas;
+    memcpy(child->vmas, parent->vmas, sizeof(child->vmas));
+}
+
+/* vma_find
+ * See vma.h.
+ * Inputs: pcb - process to look in
+ *         addr - user address to look up */
+vma_t *vma_find(pcb_t *pcb, uint32_t addr) {
+    int32_t i = vma_search(pcb, addr);
+    if(i < 0 || addr >= pcb->vmas[i].end) return NULL;
+    return &pcb->vmas[i];
+}
+
+/* vma_extent
+ * See vma.h.
+ * Inputs: pcb - process to look in
+ *         addr - user address to start at */
+uint32_t vma_extent(pcb_t *pcb, uint32_t addr) {
+    int32_t i = vma_search(pcb, addr);
+    uint32_t end;
+    if(i < 0 || addr >= pcb->vmas[i].end) return addr;
+    end = pcb->vmas[i].end;
+    /* i.e. a buffer running from the program's data into the heap */
+    for(++i; i < pcb->nr_vmas && pcb->vmas[i].start == end; ++i) end = pcb->vmas[i].end;
+    return end;
+}
+
+/* vma_insert
+ * See vma.h.
+ * Inputs: pcb - process to add the region to
+ *         start, end - page aligned range in user memory. only the heap can be empty
+ *         kind - VMA_TEXT, VMA_HEAP, ... */
+int32_t vma_insert(pcb_t *pcb, uint32_t start, uint32_t end, uint32_t kind) {
+    int32_t i;
+    if((start | end) & PAGE_MASK || start < USER_VMEM_START || end > USER_VMEM_END ||
+            end < start || (end == start && kind != VMA_HEAP) || pcb->nr_vmas == NUM_VMAS)
+        return -1;
+    i = vma_search(pcb, start);
+    /* the region before has to end by start, the one after can't start before end (or,
+     * for an empty heap, at start, so it keeps its place) */
+    if(i >= 0 && (pcb->vmas[i].end > start || pcb->vmas[i].start == start)) return -1;
+    if(i + 1 < pcb->nr_vmas && pcb->vmas[i + 1].start < end) return -1;
+    ++i;
+    memmove(&pcb->vmas[i + 1], &pcb->vmas[i], (pcb->nr_vmas - i) * sizeof(vma_t));
+    pcb->vmas[i].start = start;
+    pcb->vmas[i].end = end;
+    pcb->vmas[i].kind = kind;
+    ++pcb->nr_vmas;
+    return 0;
+}
+
+/* vma_remove
+ * See vma.h.
+ * Inputs: pcb - process to take the region from
+ *         vma - the region, from vma_find */
+void vma_remove(pcb_t *pcb, vma_t *vma) {
+    int32_t i = vma - pcb->vmas;
+    if(i < 0 || i >= pcb->nr_vmas) panic_msg("removing region %d out of %d!", i, pcb->nr_vmas);
+    memmove(vma, vma + 1, (pcb->nr_vmas - i - 1) * sizeof(vma_t));
+    --pcb->nr_vmas;
+}
+
+/* vma_set_heap_end
+ * See vma.h.
+ * Inputs: pcb - process whose heap to resize
+ *         end - new end of the heap region */
+int32_t vma_set_heap_end(pcb_t *pcb, uint32_t end) {
+    int32_t i;
+    for(i = 0; i < pcb->nr_vmas && pcb->vmas[i].kind != VMA_HEAP; ++i);
+    if(i == pcb->nr_vmas || end < pcb->vmas[i].start) return -1;
+    if(i + 1 < pcb->nr_vmas && pcb->vmas[i + 1].start < end) return -1;
+    pcb->vmas[i].end = end;
+    return 0;
+}
+
+/* vma_find_gap
+ * Return value: the highest page aligned address a len byte region fits at without
+ *               overlapping any other, 0 if there's no room. len must be page aligned */
+static uint32_t vma_find_gap(pcb_t *pcb, uint32_t len) {
+    int32_t i;
+    uint32_t gap_start, gap_end;
+    /* top down, so the heap keeps as much room to grow as it can */
+    for(i = pcb->nr_vmas; i >= 0; --i) {
+        gap_end = i == pcb->nr_vmas ? USER_VMEM_END : pcb->vmas[i].start;
+        gap_start = i == 0 ? USER_VMEM_START : pcb->vmas[i - 1].end;
+        if(gap_end - gap_start >= len) return gap_end - len;
+    }
+    return 0;
+}
+
+/* syscall_mmap
+ * Maps a region of demand-zero memory into the current process, which only takes up
+ * memory as its pages get touched. Forked children get a copy-on-write copy.
+ * Inputs: arg1 - page aligned user address to put it at, or 0 to let the kernel pick
+ *         arg2 - length in bytes, rounded up to whole pages
+ *         arg3 - not used
+ * Return value: the start of the region, -1 on a bad length or address, if there's no
+ *               room, or the process has too many regions
+ * Side effects: Adds a region */
+int32_t syscall_mmap(int32_t arg1, int32_t arg2, int32_t arg3) {
+    pcb_t *current = get_current_pcb();
+    uint32_t addr = (uint32_t) arg1, len, flags;
+    if(arg2 <= 0 || arg2 > USER_VMEM_END - USER_VMEM_START) return -1;
+    len = ((uint32_t) arg2 + PAGE_MASK) & ~PAGE_MASK;
+    cli_and_save(flags);
+    if(!addr) addr = vma_find_gap(current, len);
+    if(!addr || addr > USER_VMEM_END - len || vma_insert(current, addr, addr + len, VMA_MMAP)) {
+        restore_flags(flags);
+        return -1;
+    }
+    restore_flags(flags);
+    return addr;
+}
+
+/* syscall_munmap
+ * Unmaps a region mmap made, freeing its memory.
+ * Inputs: arg1 - start of the region, as mmap returned it
+ *         arg2 - its length, as passed to mmap
+ *         arg3 - not used
+ * Return value: 0 on success, -1 if that isn't exactly an mmapped region
+ * Side effects: Frees the region's pages */
+int32_t syscall_munmap(int32_t arg1, int32_t arg2, int32_t arg3) {
+    pcb_t *current = get_current_pcb();
+    uint32_t addr = (uint32_t) arg1, flags;
+    vma_t *vma;
+    if(arg2 <= 0) return -1;
+    cli_and_save(flags);
+    vma = vma_find(current, addr);
+    if(!vma || vma->kind != VMA_MMAP || vma->start != addr ||
+            vma->end - vma->start != (((uint32_t) arg2 + PAGE_MASK) & ~PAGE_MASK)) {
+        restore_flags(flags);
+        return -1;
+    }
+    user_space_unmap(current->user_pt, vma->start, (vma->end - vma->start) / PAGE_SIZE);
+    vma_remove(current, vma);
+    restore_flags(flags);
+    return 0;
+}
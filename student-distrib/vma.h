@@ -0,0 +1,68 @@
+/* vma.h - Definitions for the regions of a process's user memory */
+
+#ifndef _VMA_H
+#define _VMA_H
+
+#include "types.h"
+
+/* most regions a process can have mapped: text, heap, stack, plus whatever it mmaps
+ * and attaches */
+#define NUM_VMAS 16
+
+/* kinds of regions. only VMA_MMAP ones can be munmapped, the rest last as long as the
+ * process (or, for the heap, change size through brk) */
+#define VMA_TEXT 0
+#define VMA_HEAP 1
+#define VMA_STACK 2
+#define VMA_MMAP 3
+#define VMA_SHM 4
+
+#ifndef ASM
+
+/* vma_t
+ * A page aligned range of user memory, [start, end). Pages in it that aren't mapped yet
+ * get filled in with zeroed frames when they're touched, anywhere else is a segfault. */
+typedef struct vma_t {
+    uint32_t start;
+    uint32_t end;
+    uint32_t kind;
+} vma_t;
+
+struct pcb_t;
+
+/* vma_init
+ * Sets up the regions of a freshly loaded program: its image (up to brk_start), an
+ * empty heap after it, and the stack at the top of user memory. */
+void vma_init(struct pcb_t *pcb);
+
+/* vma_fork
+ * Gives a forked child the same regions as its parent. */
+void vma_fork(struct pcb_t *child, struct pcb_t *parent);
+
+/* vma_find
+ * Return value: the region containing addr, NULL if it's not in one */
+vma_t *vma_find(struct pcb_t *pcb, uint32_t addr);
+
+/* vma_extent
+ * Return value: the end of the run of back to back regions starting with the one
+ *               containing addr, i.e. how far from addr user memory can be accessed.
+ *               addr itself if it's not in a region */
+uint32_t vma_extent(struct pcb_t *pcb, uint32_t addr);
+
+/* vma_insert
+ * Adds a region, which can't overlap any other.
+ * Return value: 0 on success, -1 if the range is bad, overlaps something, or the
+ *               process is out of regions */
+int32_t vma_insert(struct pcb_t *pcb, uint32_t start, uint32_t end, uint32_t kind);
+
+/* vma_remove
+ * Takes away a region. The caller unmaps its pages. */
+void vma_remove(struct pcb_t *pcb, vma_t *vma);
+
+/* vma_set_heap_end
+ * Grows or shrinks the heap region to end at the given page aligned address.
+ * Return value: 0 on success, -1 if it would run into the next region */
+int32_t vma_set_heap_end(struct pcb_t *pcb, uint32_t end);
+
+#endif /* ASM */
+#endif /* _VMA_H */
@@ -0,0 +1,53 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define BUFSIZE 128
+
+/* usage: nice <increment> <command> [args...]
+ * runs command with its nice value raised by increment. the kernel refuses negative
+ * increments, there's no one privileged to hand out more priority */
+int main ()
+{
+    uint8_t buf[BUFSIZE];
+    uint8_t* cmd;
+    int32_t inc = 0, neg = 0, ret;
+
+    if (0 != ece391_getargs (buf, BUFSIZE)) {
+        ece391_fdputs (1, (uint8_t*)"usage: nice <increment> <command>\n");
+	return 3;
+    }
+
+    cmd = buf;
+    if ('-' == *cmd) {
+        neg = 1;
+	cmd++;
+    }
+    if (*cmd < '0' || *cmd > '9') {
+        ece391_fdputs (1, (uint8_t*)"usage: nice <increment> <command>\n");
+	return 3;
+    }
+    while (*cmd >= '0' && *cmd <= '9') {
+        if (inc < 1000) /* kernel clamps it anyways, just don't overflow */
+	    inc = inc * 10 + (*cmd - '0');
+	cmd++;
+    }
+    while (' ' == *cmd)
+        cmd++;
+    if ('\0' == *cmd) {
+        ece391_fdputs (1, (uint8_t*)"usage: nice <increment> <command>\n");
+	return 3;
+    }
+
+    /* the child inherits our nice value */
+    if (-1 == ece391_nice (neg ? -inc : inc)) {
+        ece391_fdputs (1, (uint8_t*)"nice: can't raise priority\n");
+	return 3;
+    }
+    if (-1 == (ret = ece391_execute (cmd))) {
+        ece391_fdputs (1, (uint8_t*)"no such command\n");
+	return 3;
+    }
+    return ret;
+}
@@ -5,13 +5,33 @@
 
 #define BUFSIZE 1024
 
+/* prints "[pid] msg", plus the exit status if it's not 0 */
+static void job_msg (int32_t pid, const char* msg, int32_t status)
+{
+    uint8_t num[12];
+
+    ece391_fdputs (1, (uint8_t*)"[");
+    ece391_fdputs (1, ece391_itoa (pid, num, 10));
+    ece391_fdputs (1, (uint8_t*)"] ");
+    ece391_fdputs (1, (uint8_t*)msg);
+    if (0 != status) {
+        ece391_fdputs (1, (uint8_t*)" (status ");
+	ece391_fdputs (1, ece391_itoa (status, num, 10));
+        ece391_fdputs (1, (uint8_t*)")");
+    }
+    ece391_fdputs (1, (uint8_t*)"\n");
+}
+
 int main ()
 {
-    int32_t cnt, rval;
+    int32_t cnt, rval, pid, status;
     uint8_t buf[BUFSIZE];
     ece391_fdputs (1, (uint8_t*)"Starting 391 Shell\n");
 
     while (1) {
+	/* collect background jobs that finished since the last prompt */
+	while (0 < (pid = ece391_waitpid (-1, &status, WNOHANG)))
+	    job_msg (pid, "done", status);
         ece391_fdputs (1, (uint8_t*)"391OS> ");
 	if (-1 == (cnt = ece391_read (0, buf, BUFSIZE-1))) {
 	    ece391_fdputs (1, (uint8_t*)"read from keyboard failed\n");
@@ -22,6 +42,21 @@ int main ()
 	buf[cnt] = '\0';
 	if (0 == ece391_strcmp (buf, (uint8_t*)"exit"))
 	    return 0;
+	/* a trailing & runs the command in the background */
+	while (cnt > 0 && ' ' == buf[cnt - 1])
+	    buf[--cnt] = '\0';
+	if (cnt > 0 && '&' == buf[cnt - 1]) {
+	    buf[--cnt] = '\0';
+	    while (cnt > 0 && ' ' == buf[cnt - 1])
+		buf[--cnt] = '\0';
+	    if ('\0' == buf[0])
+		continue;
+	    if (-1 == (pid = ece391_spawn (buf)))
+		ece391_fdputs (1, (uint8_t*)"no such command\n");
+	    else
+		job_msg (pid, "started", 0);
+	    continue;
+	}
 	if ('\0' == buf[0])
 	    continue;
 	rval = ece391_execute (buf);
@@ -102,3 +102,108 @@ uint8_t* ece391_strrev(uint8_t* s)
    return s;
 }
 
+
+/* Heap allocator on top of sbrk. Free blocks sit on a circular list sorted by
+ * address, so neighbours can be merged when freed; allocations take the first block
+ * that fits. The heap grows a page at a time, and pages freed off its end are handed
+ * back, since the kernel only backs the pages a process touches. */
+#define HEAP_PAGE_SIZE 4096
+#define HEAP_MAX_ALLOC 0x400000
+
+typedef struct heap_block {
+    struct heap_block* next;  /* next free block, only while free */
+    uint32_t units;           /* size including this header, in headers */
+} heap_block_t;
+
+static heap_block_t heap_base;
+static heap_block_t* heap_free = 0;
+
+/* Put a block on the free list, merging it with its neighbours. Returns the block it
+ * ended up part of */
+static heap_block_t* heap_insert(heap_block_t* block)
+{
+    heap_block_t* prev;
+
+    for (prev = heap_free; !(block > prev && block < prev->next); prev = prev->next) {
+        /* at the wrap around point, the block goes at either end */
+        if (prev >= prev->next && (block > prev || block < prev->next))
+            break;
+    }
+    if (block + block->units == prev->next) {
+        block->units += prev->next->units;
+        block->next = prev->next->next;
+    } else {
+        block->next = prev->next;
+    }
+    if (prev + prev->units == block) {
+        prev->units += block->units;
+        prev->next = block->next;
+        block = prev;
+    } else {
+        prev->next = block;
+    }
+    heap_free = prev;
+    return block;
+}
+
+/* Grow the heap by at least "units" headers, returns the free list or 0 */
+static heap_block_t* heap_grow(uint32_t units)
+{
+    uint32_t bytes = (units * sizeof(heap_block_t) + HEAP_PAGE_SIZE - 1) &
+                     ~(HEAP_PAGE_SIZE - 1);
+    heap_block_t* block = ece391_sbrk(bytes);
+
+    if ((void*)-1 == block)
+        return 0;
+    block->units = bytes / sizeof(heap_block_t);
+    heap_insert(block);
+    return heap_free;
+}
+
+void* ece391_malloc(uint32_t size)
+{
+    heap_block_t *prev, *block;
+    uint32_t units;
+
+    if (0 == size || size > HEAP_MAX_ALLOC)
+        return 0;
+    units = (size + sizeof(heap_block_t) - 1) / sizeof(heap_block_t) + 1;
+    if (0 == (prev = heap_free)) {
+        heap_base.next = heap_free = prev = &heap_base;
+        heap_base.units = 0;
+    }
+    for (block = prev->next; ; prev = block, block = block->next) {
+        if (block->units >= units) {
+            if (block->units == units) {
+                prev->next = block->next;
+            } else {
+                /* hand out the tail, the front stays on the list */
+                block->units -= units;
+                block += block->units;
+                block->units = units;
+            }
+            heap_free = prev;
+            return block + 1;
+        }
+        if (block == heap_free && 0 == (block = heap_grow(units)))
+            return 0;
+    }
+}
+
+void ece391_free(void* ptr)
+{
+    heap_block_t* block;
+    uint32_t release;
+
+    if (0 == ptr)
+        return;
+    block = heap_insert((heap_block_t*)ptr - 1);
+
+    /* give whole pages at the end of the heap back, keeping the header so the block
+     * can stay on the list */
+    if ((void*)(block + block->units) != ece391_sbrk(0))
+        return;
+    release = ((block->units - 1) * sizeof(heap_block_t)) & ~(HEAP_PAGE_SIZE - 1);
+    if (release > 0 && (void*)-1 != ece391_sbrk(-(int32_t)release))
+        block->units -= release / sizeof(heap_block_t);
+}
@@ -8,6 +8,9 @@ extern int32_t ece391_strcmp(const uint8_t* s1, const uint8_t* s2);
 extern int32_t ece391_strncmp(const uint8_t* s1, const uint8_t* s2, uint32_t n);
 extern uint8_t *ece391_itoa(uint32_t value, uint8_t* buf, int32_t radix);
 extern uint8_t *ece391_strrev(uint8_t* s);
+/* heap memory from sbrk, 8 byte aligned. malloc returns 0 when out of memory */
+extern void* ece391_malloc(uint32_t size);
+extern void ece391_free(void* ptr);
 
 #endif /* ECE391SUPPORT_H */
 
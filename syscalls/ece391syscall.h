@@ -21,6 +21,107 @@ extern int32_t ece391_getargs (uint8_t* buf, int32_t nbytes);
 extern int32_t ece391_vidmap (uint8_t** screen_start);
 extern int32_t ece391_set_handler (int32_t signum, void* handler);
 extern int32_t ece391_sigreturn (void);
+/* adds inc to the nice value (-8 to 15, higher is lower priority), returns the new one.
+ * inc can't be negative, -1 if it is */
+extern int32_t ece391_nice (int32_t inc);
+/* sets the time slice to ms milliseconds (1 to 1000), or just returns it if ms is 0 */
+extern int32_t ece391_timeslice (int32_t ms);
+/* duplicates the calling process, returns the child's pid to the parent and 0 to the
+ * child. collect the child's exit status with waitpid */
+extern int32_t ece391_fork (void);
+/* starts command in the background, returns its pid right away */
+extern int32_t ece391_spawn (const uint8_t* command);
+/* waits for child pid (or any child if pid is -1) to halt, storing its exit status.
+ * returns its pid, 0 if WNOHANG is given and it's still running, -1 if there's no
+ * such child */
+extern int32_t ece391_waitpid (int32_t pid, int32_t* status, int32_t flags);
+
+#define WNOHANG 1
+
+/* per-process statistics, filled in by procinfo */
+typedef struct procinfo_t {
+    int32_t pid;
+    int32_t parent_pid; /* -1 without a parent */
+    int32_t terminal;
+    int32_t nice;
+    uint8_t state; /* 'R'unnable, 'S'leeping, 'Z'ombie */
+    uint8_t background;
+    uint16_t reserved;
+    uint32_t cpu_ms;
+    uint32_t age_ms;
+    uint32_t nr_switches;
+    uint32_t nr_syscalls;
+    uint32_t bytes_read;
+    uint32_t bytes_written;
+    uint8_t name[32];
+} procinfo_t;
+
+/* fills in info for process pid, or the calling process if pid is -1. returns the
+ * number of pids (valid ones are 0 up to it), -1 if there's no such process */
+extern int32_t ece391_procinfo (int32_t pid, procinfo_t* info);
+
+/* sleeps for at least ms milliseconds (up to a day), -1 if ms is out of range */
+extern int32_t ece391_sleep (int32_t ms);
+
+/* clock ids for ece391_clock_gettime */
+#define CLOCK_MONOTONIC 1
+
+typedef struct timespec_t {
+    uint32_t tv_sec;
+    uint32_t tv_nsec;
+} timespec_t;
+
+/* reads a clock with nanosecond resolution, CLOCK_MONOTONIC counts from boot.
+ * -1 on a bad clock id or pointer */
+extern int32_t ece391_clock_gettime (int32_t clock_id, timespec_t* ts);
+
+/* sends this process ALARM every ms milliseconds, 0 stops it. returns the previous
+ * period. installing an ALARM handler without calling this gets one every 10 s */
+extern int32_t ece391_alarm (int32_t ms);
+/* sends process pid one of the signums below, -1 if there's no such process */
+extern int32_t ece391_kill (int32_t pid, int32_t signum);
+
+/* shared memory. shm_create returns the id of the segment with the given (nonzero) key,
+ * creating it with size bytes of zeroed memory if there isn't one yet. shm_attach maps
+ * it at a page aligned address that hasn't been touched yet. segments go away once
+ * every process holding them has exited */
+extern int32_t ece391_shm_create (uint32_t key, int32_t size);
+extern int32_t ece391_shm_attach (int32_t id, void* addr);
+
+/* synchronous message passing, every message is IPC_MSG_LEN bytes. ipc_send blocks
+ * until the receiver takes the message, ipc_receive returns the sender's pid (from can
+ * be IPC_ANY), ipc_call sends a request and waits for the reply in the same buffer */
+#define IPC_MSG_LEN 64
+#define IPC_ANY (-1)
+extern int32_t ece391_ipc_send (int32_t pid, const void* msg);
+extern int32_t ece391_ipc_receive (int32_t from, void* msg);
+extern int32_t ece391_ipc_call (int32_t pid, void* msg);
+
+/* sets a terminal's CPU share weight (1 to 65536, all start at 1024), 0 just looks it
+ * up. returns the old weight */
+extern int32_t ece391_termweight (int32_t terminal, int32_t weight);
+
+/* gives up the rest of the time slice */
+extern int32_t ece391_yield (void);
+/* picks a scheduling class. FIFO ones run ahead of everything else (rt_prio 1 to 7,
+ * higher first) until they block or yield, so they should sleep between bursts of work.
+ * rt_prio has to be 0 for the other two */
+#define SCHED_NORMAL 0
+#define SCHED_BATCH 1
+#define SCHED_FIFO 2
+extern int32_t ece391_sched_setparam (int32_t policy, int32_t rt_prio);
+
+/* the heap starts on the page after the program and ends at the program break. brk sets
+ * the break (0 just looks it up) and returns it, sbrk moves it and returns the old one.
+ * both return -1 on failure. see ece391_malloc in ece391support.h */
+extern int32_t ece391_brk (void* addr);
+extern void* ece391_sbrk (int32_t increment);
+
+/* maps length bytes of zeroed memory at addr (page aligned), or wherever there's room if
+ * addr is 0, returning where it went or -1. munmap takes the same arguments back, and
+ * only unmaps whole mappings */
+extern void* ece391_mmap (void* addr, int32_t length);
+extern int32_t ece391_munmap (void* addr, int32_t length);
 
 enum signums {
 	DIV_ZERO = 0,
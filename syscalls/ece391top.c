@@ -0,0 +1,127 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define BUFSIZE 128
+
+/* prints n right aligned in a field width characters wide */
+static void put_num (uint32_t n, uint32_t width)
+{
+    uint8_t buf[12];
+    uint32_t len;
+
+    ece391_itoa (n, buf, 10);
+    for (len = ece391_strlen (buf); len < width; len++)
+        ece391_fdputs (1, (uint8_t*)" ");
+    ece391_fdputs (1, buf);
+}
+
+/* prints one line per process. %CPU is the share of the time since the last
+ * refresh (or since the process started, the first time around) */
+static void show (uint32_t* last_cpu, uint32_t* last_now, uint8_t* seen,
+		  int32_t num_pids, uint32_t now)
+{
+    procinfo_t info;
+    int32_t pid;
+    uint32_t cpu, elapsed;
+    uint8_t state[2] = " ";
+
+    ece391_fdputs (1, (uint8_t*)
+      " PID PPID TTY S  NI %CPU   CPUms  SWTCH  SYSCL    READ   WRITE NAME\n");
+    for (pid = 0; pid < num_pids; pid++) {
+	if (0 > ece391_procinfo (pid, &info)) {
+	    seen[pid] = 0;
+	    continue;
+	}
+	/* new, or a slot that got reused since the last refresh */
+	if (!seen[pid] || info.cpu_ms < last_cpu[pid] ||
+	    info.age_ms < now - last_now[pid]) {
+	    last_cpu[pid] = 0;
+	    last_now[pid] = now - info.age_ms;
+	}
+	cpu = info.cpu_ms - last_cpu[pid];
+	elapsed = now - last_now[pid];
+	last_cpu[pid] = info.cpu_ms;
+	last_now[pid] = now;
+	seen[pid] = 1;
+
+	put_num (pid, 4);
+	if (info.parent_pid < 0)
+	    ece391_fdputs (1, (uint8_t*)"    -");
+	else
+	    put_num (info.parent_pid, 5);
+	put_num (info.terminal, 4);
+	state[0] = info.state;
+	ece391_fdputs (1, (uint8_t*)" ");
+	ece391_fdputs (1, state);
+	if (info.nice < 0) {
+	    ece391_fdputs (1, (uint8_t*)"  -");
+	    put_num (-info.nice, 1);
+	} else {
+	    put_num (info.nice, 4);
+	}
+	put_num (elapsed ? cpu * 100 / elapsed : 0, 5);
+	put_num (info.cpu_ms, 8);
+	put_num (info.nr_switches, 7);
+	put_num (info.nr_syscalls, 7);
+	put_num (info.bytes_read, 8);
+	put_num (info.bytes_written, 8);
+	ece391_fdputs (1, (uint8_t*)" ");
+	ece391_fdputs (1, info.name);
+	if (info.background)
+	    ece391_fdputs (1, (uint8_t*)" &");
+	ece391_fdputs (1, (uint8_t*)"\n");
+    }
+}
+
+/* usage: top [refreshes]
+ * shows per process CPU and I/O statistics, then refreshes them once a second
+ * as many times as asked */
+int main ()
+{
+    uint8_t buf[BUFSIZE];
+    uint32_t* last_cpu;
+    uint32_t* last_now;
+    uint8_t* seen;
+    uint32_t refreshes = 0, i;
+    int32_t num_pids;
+    procinfo_t me;
+    uint8_t* arg;
+
+    if (0 == ece391_getargs (buf, BUFSIZE)) {
+        for (arg = buf; *arg >= '0' && *arg <= '9'; arg++)
+	    refreshes = refreshes * 10 + (*arg - '0');
+	if ('\0' != *arg) {
+	    ece391_fdputs (1, (uint8_t*)"usage: top [refreshes]\n");
+	    return 3;
+	}
+    }
+
+    /* our own age is the clock %CPU gets measured against */
+    if (0 >= (num_pids = ece391_procinfo (-1, &me))) {
+        ece391_fdputs (1, (uint8_t*)"procinfo not supported\n");
+	return 3;
+    }
+    last_cpu = ece391_malloc (num_pids * sizeof (uint32_t));
+    last_now = ece391_malloc (num_pids * sizeof (uint32_t));
+    seen = ece391_malloc (num_pids);
+    if (!last_cpu || !last_now || !seen) {
+        ece391_fdputs (1, (uint8_t*)"out of memory\n");
+	return 3;
+    }
+    for (i = 0; i < num_pids; i++)
+        seen[i] = 0;
+    show (last_cpu, last_now, seen, num_pids, me.age_ms);
+
+    for (i = 0; i < refreshes; i++) {
+        if (0 != ece391_sleep (1000)) {
+	    ece391_fdputs (1, (uint8_t*)"sleep not supported\n");
+	    return 3;
+	}
+	ece391_procinfo (-1, &me);
+	ece391_fdputs (1, (uint8_t*)"\n");
+	show (last_cpu, last_now, seen, num_pids, me.age_ms);
+    }
+    return 0;
+}